@@ -0,0 +1,283 @@
+// Copyright (c) 2017-2018 The NanuCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+/**
+ * Offline replay of the stake kernel search. Runs the same code the stake
+ * minter runs (CheckStakeKernelHash, GetKernelStakeModifier and
+ * SearchStakeKernels) for a set of stake inputs over a time window, either on
+ * a synthetic chain or on the block index of a local datadir.
+ */
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "kernel.h"
+#include "main.h"
+#include "random.h"
+#include "txdb.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "utilmoneystr.h"
+#include "utilstrencodings.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+CClientUIInterface uiInterface;
+CWallet* pwalletMain;
+
+extern void noui_connect();
+
+void StartShutdown()
+{
+    exit(0);
+}
+
+bool ShutdownRequested()
+{
+    return false;
+}
+
+static const int DEFAULT_BENCH_UTXOS = 1000;
+static const int DEFAULT_BENCH_BLOCKS = 20000;
+static const int64_t DEFAULT_BENCH_WINDOW = 60 * 60;
+static const int64_t DEFAULT_BENCH_VALUE = 1000;
+static const unsigned int DEFAULT_BENCH_BITS = 0x1c00ffff;
+static const unsigned int DEFAULT_BENCH_DRIFT = 45;
+static const unsigned int DEFAULT_BENCH_INTERVAL = 22;
+
+static bool AppInitStakeBench(int argc, char* argv[])
+{
+    ParseParameters(argc, argv);
+
+    // Check for -testnet or -regtest parameter (Params() calls are only valid after this clause)
+    if (!SelectParamsFromCommandLine()) {
+        fprintf(stderr, "Error: Invalid combination of -regtest and -testnet.\n");
+        return false;
+    }
+
+    if (mapArgs.count("-?") || mapArgs.count("-help")) {
+        std::string strUsage = _("NanuCoin Core stake search benchmark version") + " " + FormatFullVersion() + "\n\n" +
+                               _("Usage:") + "\n" +
+                               "  bench_nanucoin [options]                  " + _("Replay the stake kernel search on a synthetic chain") + "\n" +
+                               "  bench_nanucoin -datadir=<dir> [options]   " + _("Replay the stake kernel search on the block index of <dir>") + "\n" +
+                               "\n";
+        strUsage += HelpMessageGroup(_("Options:"));
+        strUsage += HelpMessageOpt("-?", _("This help message"));
+        strUsage += HelpMessageOpt("-datadir=<dir>", _("Load the block index from this data directory (the node must not be running)"));
+        strUsage += HelpMessageOpt("-blocks=<n>", strprintf(_("Length of the synthetic chain (default: %d)"), DEFAULT_BENCH_BLOCKS));
+        strUsage += HelpMessageOpt("-utxos=<n>", strprintf(_("Number of stake inputs (default: %d)"), DEFAULT_BENCH_UTXOS));
+        strUsage += HelpMessageOpt("-value=<amt>", strprintf(_("Mean stake input value; values are drawn uniformly from (0, 2 * amt] (default: %d)"), DEFAULT_BENCH_VALUE));
+        strUsage += HelpMessageOpt("-window=<n>", strprintf(_("Seconds of staking to replay after the tip (default: %d)"), DEFAULT_BENCH_WINDOW));
+        strUsage += HelpMessageOpt("-hashinterval=<n>", strprintf(_("Seconds between stake attempts (default: %u)"), DEFAULT_BENCH_INTERVAL));
+        strUsage += HelpMessageOpt("-hashdrift=<n>", strprintf(_("Timestamps tried per stake input and attempt (default: %u)"), DEFAULT_BENCH_DRIFT));
+        strUsage += HelpMessageOpt("-bits=<hex>", strprintf(_("Compact stake target (default: the tip's, or %08x on a synthetic chain)"), DEFAULT_BENCH_BITS));
+        strUsage += HelpMessageOpt("-stakethreads=<n>", strprintf(_("Threads for the first-kernel search (0 = all cores, default: %d)"), DEFAULT_STAKETHREADS));
+        strUsage += HelpMessageOpt("-seed=<n>", _("Seed for the synthetic chain and stake inputs (default: 0)"));
+        strUsage += HelpMessageOpt("-regtest", _("Enter regression test mode, which uses a special chain in which blocks can be solved instantly."));
+        strUsage += HelpMessageOpt("-testnet", _("Use the test network"));
+        fprintf(stdout, "%s", strUsage.c_str());
+        return false;
+    }
+    return true;
+}
+
+/** Start insecure_rand from nSeed, so equal seeds replay equal chains and inputs */
+static void SeedStakeBench(uint64_t nSeed)
+{
+    seed_insecure_rand(true);
+    insecure_rand_Rz ^= (uint32_t)nSeed;
+    insecure_rand_Rw ^= (uint32_t)(nSeed >> 32);
+    // The same fixed points seed_insecure_rand() avoids
+    if (insecure_rand_Rz == 0 || insecure_rand_Rz == 0x9068ffffU)
+        insecure_rand_Rz = 11;
+    if (insecure_rand_Rw == 0 || insecure_rand_Rw == 0x464fffffU)
+        insecure_rand_Rw = 11;
+}
+
+static uint256 InsecureRandHash()
+{
+    uint256 hash;
+    for (unsigned char* p = hash.begin(); p < hash.end(); p += 4) {
+        uint32_t n = insecure_rand();
+        memcpy(p, &n, 4);
+    }
+    return hash;
+}
+
+/** Stand-in for the active chain: block times around the target spacing and
+ *  a new stake modifier whenever a modifier interval boundary is crossed.
+ *  It starts at the genesis block time, not the clock, so a seed always
+ *  gives the same kernel hashes. */
+static void BuildSyntheticChain(std::vector<CBlockIndex>& vIndex, int nBlocks, unsigned int nBits)
+{
+    vIndex.resize(nBlocks);
+    int64_t nTime = Params().GenesisBlock().GetBlockTime();
+    for (int i = 0; i < nBlocks; i++) {
+        CBlockIndex& index = vIndex[i];
+        index.nHeight = i;
+        index.pprev = (i == 0) ? NULL : &vIndex[i - 1];
+        nTime += 30 + insecure_rand() % 60;
+        index.nTime = nTime;
+        index.nBits = nBits;
+        bool fGenerated = (i == 0) || nTime / MODIFIER_INTERVAL != vIndex[i - 1].nTime / MODIFIER_INTERVAL;
+        index.SetStakeModifier(fGenerated ? (((uint64_t)insecure_rand() << 32) | insecure_rand()) : vIndex[i - 1].nStakeModifier, fGenerated);
+        chainActive.SetTip(&index);
+        stakeModifierIndex.Connect(&index);
+    }
+}
+
+static bool LoadChain(std::string& strError)
+{
+    // Small caches: only the block index is read
+    pblocktree = new CBlockTreeDB(1 << 22);
+    pcoinsTip = new CCoinsViewCache(new CCoinsViewDB(1 << 22));
+    if (!LoadBlockIndex()) {
+        strError = "Error loading block database";
+        return false;
+    }
+    if (!chainActive.Tip()) {
+        strError = "Block database is empty";
+        return false;
+    }
+    return true;
+}
+
+static int StakeBench()
+{
+    // Nothing else runs here, but the chain is read under cs_main as in the node
+    LOCK(cs_main);
+    SeedStakeBench(GetArg("-seed", 0));
+
+    std::vector<CBlockIndex> vIndex;
+    unsigned int nBits = DEFAULT_BENCH_BITS;
+    if (mapArgs.count("-datadir")) {
+        std::string strError;
+        if (!LoadChain(strError)) {
+            fprintf(stderr, "Error: %s\n", strError.c_str());
+            return EXIT_FAILURE;
+        }
+        nBits = chainActive.Tip()->nBits;
+    } else {
+        BuildSyntheticChain(vIndex, std::max((int)GetArg("-blocks", DEFAULT_BENCH_BLOCKS), 1000), DEFAULT_BENCH_BITS);
+    }
+    if (mapArgs.count("-bits"))
+        nBits = strtoul(mapArgs["-bits"].c_str(), NULL, 16);
+
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    int nUTXOs = std::max((int)GetArg("-utxos", DEFAULT_BENCH_UTXOS), 1);
+    int64_t nWindow = std::max(GetArg("-window", DEFAULT_BENCH_WINDOW), (int64_t)1);
+    unsigned int nHashInterval = std::max((int)GetArg("-hashinterval", DEFAULT_BENCH_INTERVAL), 1);
+    unsigned int nHashDrift = std::max((int)GetArg("-hashdrift", DEFAULT_BENCH_DRIFT), 1);
+    int nStakeThreads = GetArg("-stakethreads", DEFAULT_STAKETHREADS);
+    if (nStakeThreads <= 0)
+        nStakeThreads = boost::thread::hardware_concurrency();
+    CAmount nValueMean = DEFAULT_BENCH_VALUE * COIN;
+    if (mapArgs.count("-value") && !ParseMoney(mapArgs["-value"], nValueMean)) {
+        fprintf(stderr, "Error: Invalid amount for -value=<amt>\n");
+        return EXIT_FAILURE;
+    }
+
+    // Stake inputs come from blocks that are old enough for the modifier
+    // selection interval and the minimum stake age to have passed
+    int nHeightMax = pindexTip->nHeight;
+    while (nHeightMax > 0 && chainActive[nHeightMax]->GetBlockTime() + nStakeMinAge + 2 * 60 * 60 > pindexTip->GetBlockTime())
+        nHeightMax--;
+    if (nHeightMax == 0) {
+        fprintf(stderr, "Error: The chain is too short\n");
+        return EXIT_FAILURE;
+    }
+    uint64_t nStakeModifier = 0;
+    int nStakeModifierHeight = 0;
+    int64_t nStakeModifierTime = 0;
+    std::vector<CStakeCandidate> vCandidates;
+    for (int i = 0; i < nUTXOs; i++) {
+        const CBlockIndex* pindexFrom = chainActive[insecure_rand() % nHeightMax];
+        if (!GetKernelStakeModifier(pindexFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false)) {
+            fprintf(stderr, "Error: No stake modifier for a block at height %d\n", pindexFrom->nHeight);
+            return EXIT_FAILURE;
+        }
+        CAmount nValue = 1 + ((((uint64_t)insecure_rand() << 32) | insecure_rand()) % (2 * nValueMean));
+        vCandidates.push_back(CStakeCandidate(pindexFrom, nStakeModifier, nValue, COutPoint(InsecureRandHash(), insecure_rand() % 4)));
+    }
+
+    fprintf(stdout, "chain: %s, tip height %d, %d stake inputs, mean value %s, target %08x\n",
+        vIndex.empty() ? GetDataDir().string().c_str() : "synthetic", pindexTip->nHeight, nUTXOs, FormatMoney(nValueMean).c_str(), nBits);
+
+    // Stake modifier lookups, as the wallet does for its stake set
+    int64_t nStart = GetTimeMicros();
+    BOOST_FOREACH(const CStakeCandidate& candidate, vCandidates)
+        GetKernelStakeModifier(candidate.pindexFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false);
+    int64_t nModifierMicros = GetTimeMicros() - nStart;
+    fprintf(stdout, "modifier lookups: %.3f us each\n", (double)nModifierMicros / nUTXOs);
+
+    // Full sweep of every input on every attempt in the window
+    unsigned int nTimeStart = pindexTip->GetBlockTime() + 1;
+    int64_t nAttempts = 0, nHashes = 0, nKernels = 0, nAttemptsWithKernel = 0;
+    nStart = GetTimeMicros();
+    for (int64_t nOffset = 0; nOffset < nWindow; nOffset += nHashInterval) {
+        int nFound = 0;
+        BOOST_FOREACH(const CStakeCandidate& candidate, vCandidates) {
+            unsigned int nTimeTx = nTimeStart + nOffset;
+            uint256 hashProofOfStake;
+            if (CheckStakeKernelHash(nBits, candidate.pindexFrom, candidate.nValueIn, candidate.prevout, nTimeTx, nHashDrift, false, hashProofOfStake)) {
+                // The drift loop walks down from nTimeTx + nHashDrift and stops at the kernel
+                nHashes += nTimeStart + nOffset + nHashDrift - nTimeTx + 1;
+                nFound++;
+            } else {
+                nHashes += nHashDrift;
+            }
+        }
+        nAttempts++;
+        nKernels += nFound;
+        if (nFound)
+            nAttemptsWithKernel++;
+    }
+    int64_t nSweepMicros = std::max(GetTimeMicros() - nStart, (int64_t)1);
+    fprintf(stdout, "full sweep: %d attempts, %.1f hashes per input and attempt, %.0f kernel hashes/s, %.3f ms per attempt\n",
+        (int)nAttempts, (double)nHashes / (nAttempts * nUTXOs), nHashes * 1000000.0 / nSweepMicros, nSweepMicros / 1000.0 / nAttempts);
+    fprintf(stdout, "found stakes: %d kernels, %d of %d attempts (%.1f%%) found at least one, %.1f s expected between stakes\n",
+        (int)nKernels, (int)nAttemptsWithKernel, (int)nAttempts, 100.0 * nAttemptsWithKernel / nAttempts,
+        nAttemptsWithKernel ? (double)nAttempts * nHashInterval / nAttemptsWithKernel : 0.0);
+
+    // What the stake minter does: stop at the first kernel
+    boost::thread_group threadGroup;
+    for (int i = 1; i < nStakeThreads; i++)
+        threadGroup.create_thread(&ThreadStakeSearch);
+    nStart = GetTimeMicros();
+    for (int64_t nOffset = 0; nOffset < nWindow; nOffset += nHashInterval) {
+        size_t nFound = 0;
+        unsigned int nTimeTxFound = 0;
+        uint256 hashProofOfStake;
+        SearchStakeKernels(vCandidates, nBits, nTimeStart + nOffset, nHashDrift, 0, nStakeTipUpdates, nFound, nTimeTxFound, hashProofOfStake);
+    }
+    int64_t nSearchMicros = GetTimeMicros() - nStart;
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    fprintf(stdout, "first-kernel search on %d threads: %.3f ms per attempt\n", nStakeThreads, nSearchMicros / 1000.0 / nAttempts);
+
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+    SetupEnvironment();
+    fPrintToDebugLog = false;
+    noui_connect();
+
+    try {
+        if (!AppInitStakeBench(argc, argv))
+            return EXIT_FAILURE;
+        return StakeBench();
+    } catch (std::exception& e) {
+        PrintExceptionContinue(&e, "StakeBench()");
+    } catch (...) {
+        PrintExceptionContinue(NULL, "StakeBench()");
+    }
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,87 @@
+// Copyright (c) 2017-2018 The NanuCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+
+#include "core_memusage.h"
+#include "memusage.h"
+#include "streams.h"
+#include "version.h"
+
+CCachedBlock::CCachedBlock(const uint256& hashIn, const CBlock& blockIn) : hash(hashIn), block(blockIn)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    ss << block;
+    vRaw.assign(ss.begin(), ss.end());
+    nUsage = memusage::MallocUsage(sizeof(CCachedBlock)) + memusage::DynamicUsage(vRaw) + RecursiveDynamicUsage(block);
+}
+
+CBlockCache::CBlockCache(size_t nMaxUsageIn) : nMaxUsage(nMaxUsageIn), nUsage(0) {}
+
+void CBlockCache::Trim()
+{
+    while (nUsage > nMaxUsage && !listBlocks.empty()) {
+        const CCachedBlockRef& pblock = listBlocks.back();
+        nUsage -= pblock->DynamicMemoryUsage();
+        mapBlocks.erase(pblock->hash);
+        listBlocks.pop_back();
+    }
+}
+
+CCachedBlockRef CBlockCache::Add(const uint256& hash, const CBlock& block)
+{
+    CCachedBlockRef pblock = Get(hash);
+    if (pblock)
+        return pblock;
+
+    // Serialize outside the lock
+    pblock.reset(new CCachedBlock(hash, block));
+
+    LOCK(cs);
+    if (mapBlocks.count(hash))
+        return *mapBlocks[hash];
+    listBlocks.push_front(pblock);
+    mapBlocks[hash] = listBlocks.begin();
+    nUsage += pblock->DynamicMemoryUsage();
+    Trim();
+    return pblock;
+}
+
+CCachedBlockRef CBlockCache::Get(const uint256& hash)
+{
+    LOCK(cs);
+    std::map<uint256, BlockList::iterator>::iterator it = mapBlocks.find(hash);
+    if (it == mapBlocks.end())
+        return CCachedBlockRef();
+    listBlocks.splice(listBlocks.begin(), listBlocks, it->second);
+    return *it->second;
+}
+
+void CBlockCache::SetMaxUsage(size_t nMaxUsageIn)
+{
+    LOCK(cs);
+    nMaxUsage = nMaxUsageIn;
+    Trim();
+}
+
+void CBlockCache::Clear()
+{
+    LOCK(cs);
+    listBlocks.clear();
+    mapBlocks.clear();
+    nUsage = 0;
+}
+
+size_t CBlockCache::Size() const
+{
+    LOCK(cs);
+    return listBlocks.size();
+}
+
+size_t CBlockCache::DynamicMemoryUsage() const
+{
+    LOCK(cs);
+    return nUsage;
+}
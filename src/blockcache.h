@@ -0,0 +1,71 @@
+// Copyright (c) 2017-2018 The NanuCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCACHE_H
+#define BITCOIN_BLOCKCACHE_H
+
+#include "primitives/block.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+/** A block held in memory along with its serialization, which is the same on disk and on the wire */
+class CCachedBlock
+{
+public:
+    const uint256 hash;
+    const CBlock block;
+    std::vector<char> vRaw;
+
+    CCachedBlock(const uint256& hashIn, const CBlock& blockIn);
+
+    size_t DynamicMemoryUsage() const { return nUsage; }
+
+private:
+    size_t nUsage;
+};
+
+typedef boost::shared_ptr<const CCachedBlock> CCachedBlockRef;
+
+/**
+ * Bounded cache of recent blocks, keyed by hash, so that a new block is read
+ * from disk and hashed once rather than once for every peer, RPC call, reorg
+ * and notification that wants it. Entries are reference counted: a block that
+ * is evicted while someone still holds it stays valid for them. The least
+ * recently used blocks are evicted first once the memory limit is exceeded.
+ */
+class CBlockCache
+{
+private:
+    typedef std::list<CCachedBlockRef> BlockList;
+
+    mutable CCriticalSection cs;
+    //! Most recently used first
+    BlockList listBlocks;
+    std::map<uint256, BlockList::iterator> mapBlocks;
+    size_t nMaxUsage;
+    size_t nUsage;
+
+    void Trim();
+
+public:
+    explicit CBlockCache(size_t nMaxUsageIn);
+
+    /** Cache a block that is known to have the given hash, returning the entry for it */
+    CCachedBlockRef Add(const uint256& hash, const CBlock& block);
+    /** The cached block with this hash, or an empty reference */
+    CCachedBlockRef Get(const uint256& hash);
+
+    void SetMaxUsage(size_t nMaxUsageIn);
+    void Clear();
+    size_t Size() const;
+    size_t DynamicMemoryUsage() const;
+};
+
+#endif // BITCOIN_BLOCKCACHE_H
@@ -0,0 +1,114 @@
+// Copyright (c) 2017-2018 The NanuCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+
+#include "compat.h"
+#include "tinyformat.h"
+#include "util.h"
+
+#ifndef WIN32
+#include <sys/stat.h>
+#endif
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    munmap((void*)pch, nSize);
+#endif
+}
+
+CMappedFileRef CMappedFile::Open(const boost::filesystem::path& path, bool fSequential)
+{
+#ifdef WIN32
+    return CMappedFileRef();
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0)
+        return CMappedFileRef();
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return CMappedFileRef();
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps the file open
+    close(fd);
+    if (p == MAP_FAILED) {
+        LogPrintf("%s : mmap of %s failed: %s\n", __func__, path.string(), strerror(errno));
+        return CMappedFileRef();
+    }
+    // The default advice already reads ahead around each fault, which covers
+    // a block record; only a front to back pass benefits from more
+    if (fSequential)
+        posix_madvise(p, st.st_size, POSIX_MADV_SEQUENTIAL);
+    return CMappedFileRef(new CMappedFile((const char*)p, st.st_size));
+#endif
+}
+
+CBlockFileMapper::CBlockFileMapper() : fEnabled(false), nFinished(0), nUseCounter(0) {}
+
+void CBlockFileMapper::SetEnabled(bool fEnabledIn)
+{
+    LOCK(cs);
+    // Mapping whole block files needs a 64-bit address space
+    fEnabled = fEnabledIn && sizeof(void*) >= 8;
+    if (!fEnabled)
+        mapFiles.clear();
+}
+
+void CBlockFileMapper::SetFinishedFiles(int nFinishedIn)
+{
+    LOCK(cs);
+    // Going back (a reindex) means files may be rewritten
+    if (nFinishedIn < nFinished) {
+        mapFiles.erase(mapFiles.lower_bound(FileKey(false, nFinishedIn)), mapFiles.lower_bound(FileKey(true, 0)));
+        mapFiles.erase(mapFiles.lower_bound(FileKey(true, nFinishedIn)), mapFiles.end());
+    }
+    nFinished = nFinishedIn;
+}
+
+CMappedFileRef CBlockFileMapper::Get(int nFile, bool fUndo, uint64_t nMinSize, bool fSequential)
+{
+    LOCK(cs);
+    if (!fEnabled || nFile < 0 || nFile >= nFinished)
+        return CMappedFileRef();
+
+    FileKey key(fUndo, nFile);
+    std::map<FileKey, CEntry>::iterator it = mapFiles.find(key);
+    if (it == mapFiles.end() || it->second.pmap->size() < nMinSize) {
+        // Not mapped yet, or the file has grown since
+        boost::filesystem::path path = GetDataDir() / "blocks" / strprintf("%s%05u.dat", fUndo ? "rev" : "blk", nFile);
+        CMappedFileRef pmap = CMappedFile::Open(path, fSequential);
+        if (!pmap) {
+            if (it != mapFiles.end())
+                mapFiles.erase(it);
+            return CMappedFileRef();
+        }
+        if (it == mapFiles.end()) {
+            if (mapFiles.size() >= MAX_MAPPED_FILES) {
+                std::map<FileKey, CEntry>::iterator itOldest = mapFiles.begin();
+                for (std::map<FileKey, CEntry>::iterator itEntry = mapFiles.begin(); itEntry != mapFiles.end(); itEntry++) {
+                    if (itEntry->second.nLastUsed < itOldest->second.nLastUsed)
+                        itOldest = itEntry;
+                }
+                mapFiles.erase(itOldest);
+            }
+            it = mapFiles.insert(std::make_pair(key, CEntry())).first;
+        }
+        it->second.pmap = pmap;
+    }
+    it->second.nLastUsed = ++nUseCounter;
+
+    CMappedFileRef pmap = it->second.pmap;
+    if (pmap->size() < nMinSize)
+        return CMappedFileRef();
+    return pmap;
+}
+
+void CBlockFileMapper::Clear()
+{
+    LOCK(cs);
+    mapFiles.clear();
+}
@@ -0,0 +1,103 @@
+// Copyright (c) 2017-2018 The NanuCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include "sync.h"
+
+#include <map>
+#include <stdint.h>
+#include <utility>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/shared_ptr.hpp>
+
+/** Read-only memory mapping of a whole file, unmapped when the last reference goes */
+class CMappedFile
+{
+private:
+    const char* pch;
+    size_t nSize;
+
+    CMappedFile(const char* pchIn, size_t nSizeIn) : pch(pchIn), nSize(nSizeIn) {}
+
+    // Not copyable
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+
+public:
+    ~CMappedFile();
+
+    /**
+     * Map the file as it is now, advised for front to back reads if
+     * fSequential; empty if that is not possible or not supported on this
+     * platform
+     */
+    static boost::shared_ptr<CMappedFile> Open(const boost::filesystem::path& path, bool fSequential);
+
+    const char* begin() const { return pch; }
+    size_t size() const { return nSize; }
+};
+
+typedef boost::shared_ptr<CMappedFile> CMappedFileRef;
+
+/**
+ * Memory mappings of the blk and rev files that are no longer appended to, so
+ * that reading a block or its undo data needs no seek, read or copy into a
+ * stdio buffer, and deserialization runs straight out of the page cache; pages
+ * not yet in memory are still read in on first access. Files that are still
+ * being written are never mapped; their readers use stdio as before.
+ *
+ * The advice given to the kernel is fixed when a file is mapped: sequential
+ * for a reindex or import, the default otherwise. It is not changed per read,
+ * as all readers share the mapping.
+ *
+ * A rev file can still grow after its blk file is finished, when a block stored
+ * there is connected late; a request past the end of a mapping maps the file
+ * again. The least recently used mappings are dropped beyond a fixed count, but
+ * stay valid for readers holding them.
+ *
+ * A disk read error on a mapped page, or a file truncated under a mapping,
+ * raises SIGBUS where the stdio path returns an error, so mapping is opt-in.
+ */
+class CBlockFileMapper
+{
+private:
+    //! Whether it is a rev file, and its number
+    typedef std::pair<bool, int> FileKey;
+
+    struct CEntry {
+        CMappedFileRef pmap;
+        uint64_t nLastUsed;
+    };
+
+    CCriticalSection cs;
+    std::map<FileKey, CEntry> mapFiles;
+    bool fEnabled;
+    int nFinished;
+    uint64_t nUseCounter;
+
+public:
+    //! Most files mapped at once; at 128 MiB each this bounds the address space used
+    static const size_t MAX_MAPPED_FILES = 64;
+
+    CBlockFileMapper();
+
+    /** Turn mapping on or off; it is never on where the address space is too small for it */
+    void SetEnabled(bool fEnabledIn);
+    /** Files numbered below nFinishedIn are no longer appended to and may be mapped */
+    void SetFinishedFiles(int nFinishedIn);
+
+    /**
+     * A mapping of the given file at least nMinSize bytes long, or an empty
+     * reference if the caller should read the file with stdio instead.
+     * fSequential is the advice for the file if it has to be mapped now.
+     */
+    CMappedFileRef Get(int nFile, bool fUndo, uint64_t nMinSize, bool fSequential);
+
+    void Clear();
+};
+
+#endif // BITCOIN_BLOCKFILEMAP_H
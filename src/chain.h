@@ -96,6 +96,8 @@ enum BlockStatus {
     BLOCK_FAILED_VALID = 32, //! stage after last reached validness failed
     BLOCK_FAILED_CHILD = 64, //! descends from failed block
     BLOCK_FAILED_MASK = BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
+
+    BLOCK_SNAPSHOT = 128, //! below the tip of a loaded UTXO snapshot: valid, but no block data here
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -388,15 +390,21 @@ public:
     uint256 hashPrev;
     uint256 hashNext;
 
+    //! (memory only) hash of this block, taken from the CBlockIndex or from the
+    //! database key so that reading and writing entries never runs XEVAN
+    uint256 hashBlock;
+
     CDiskBlockIndex()
     {
         hashPrev = 0;
         hashNext = 0;
+        hashBlock = 0;
     }
 
     explicit CDiskBlockIndex(CBlockIndex* pindex) : CBlockIndex(*pindex)
     {
         hashPrev = (pprev ? pprev->GetBlockHash() : 0);
+        hashBlock = pindex->GetBlockHash();
     }
 
     ADD_SERIALIZE_METHODS;
@@ -442,6 +450,14 @@ public:
     }
 
     uint256 GetBlockHash() const
+    {
+        if (hashBlock != 0)
+            return hashBlock;
+        return ComputeBlockHash();
+    }
+
+    //! Recompute the hash from the stored header fields
+    uint256 ComputeBlockHash() const
     {
         CBlockHeader block;
         block.nVersion = nVersion;
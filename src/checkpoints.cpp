@@ -98,4 +98,28 @@ CBlockIndex* GetLastCheckpoint()
     return NULL;
 }
 
+uint256 GetLastCheckpointHash()
+{
+    if (!fEnabled)
+        return 0;
+
+    const MapCheckpoints& checkpoints = *Params().Checkpoints().mapCheckpoints;
+
+    return checkpoints.rbegin()->second;
+}
+
+int GetCheckpointHeight(const uint256& hash)
+{
+    if (!fEnabled)
+        return -1;
+
+    const MapCheckpoints& checkpoints = *Params().Checkpoints().mapCheckpoints;
+
+    BOOST_FOREACH (const MapCheckpoints::value_type& i, checkpoints) {
+        if (i.second == hash)
+            return i.first;
+    }
+    return -1;
+}
+
 } // namespace Checkpoints
@@ -35,6 +35,12 @@ int GetTotalBlocksEstimate();
 //! Returns last CBlockIndex* in mapBlockIndex that is a checkpoint
 CBlockIndex* GetLastCheckpoint();
 
+//! Hash of the last built-in checkpoint, 0 if checkpoints are disabled
+uint256 GetLastCheckpointHash();
+
+//! Height of the built-in checkpoint with this hash, -1 if there is none
+int GetCheckpointHeight(const uint256& hash);
+
 double GuessVerificationProgress(CBlockIndex* pindex, bool fSigchecks = true);
 
 extern bool fEnabled;
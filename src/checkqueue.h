@@ -6,8 +6,10 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <deque>
 #include <vector>
 
+#include <boost/atomic.hpp>
 #include <boost/foreach.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
@@ -16,7 +18,10 @@
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/** Work-stealing slots of a CCheckQueue; threads beyond this share slots */
+static const unsigned int MAX_CHECKQUEUE_SLOTS = 64;
+
+/**
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
@@ -25,12 +30,35 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every thread owns a slot with its own deque and lock. The master spreads
+  * each batch over the slots, a thread works through its own slot and steals
+  * half of another slot's checks when it runs dry, so no lock is shared by
+  * all threads on the hot path. The shared mutex is only taken to sleep and
+  * to wake sleepers; a thread only sleeps when no check sits in any slot.
+  * After the first failed check the remaining ones are drained without being
+  * run; the failed check itself is kept for the master, so the caller can
+  * report why it failed without running the checks again.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! One thread's share of the pending checks
+    struct Slot {
+        boost::mutex mutex;
+        std::deque<T> checks;
+    };
+
+    Slot vSlots[MAX_CHECKQUEUE_SLOTS];
+
+    //! Slots in use: the master's (slot 0) and one per worker thread
+    boost::atomic<unsigned int> nSlots;
+
+    //! Slot the next batch from the master goes to
+    unsigned int nNextSlot;
+
+    //! Protects sleeping and waking only
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,96 +67,130 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! The number of workers sleeping on condWorker.
+    boost::atomic<int> nIdle;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
-
-    //! The total number of workers (including the master).
+    //! The total number of worker threads, excluding the master.
     int nTotal;
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    boost::atomic<bool> fAllOk;
+
+    //! The check that failed first, under mutex; set once fAllOk turns false
+    T checkFailed;
 
     /**
      * Number of verifications that haven't completed yet.
-     * This includes elements that are not anymore in queue, but still in
-     * worker's own batches.
+     * This includes elements that are not anymore in a slot, but still in
+     * a thread's own batch.
      */
-    unsigned int nTodo;
+    boost::atomic<unsigned int> nTodo;
+
+    //! Number of verifications sitting in a slot; only changed under that slot's lock.
+    boost::atomic<unsigned int> nQueued;
 
     //! Whether we're shutting down.
     bool fQuit;
 
-    //! The maximum number of elements to be processed in one batch
+    //! The maximum number of elements to be taken from a slot at once
     unsigned int nBatchSize;
 
+    /** Move up to nMax checks from one end of slot into vChecks */
+    unsigned int TakeFrom(Slot& slot, std::vector<T>& vChecks, unsigned int nMax, bool fSteal)
+    {
+        boost::unique_lock<boost::mutex> lock(slot.mutex);
+        // A thief takes half of what it finds, so the owner keeps some work
+        unsigned int nNow = std::min(nMax, (unsigned int)(fSteal ? (slot.checks.size() + 1) / 2 : slot.checks.size()));
+        vChecks.resize(nNow);
+        for (unsigned int i = 0; i < nNow; i++) {
+            // Owner works from the back, thieves from the front
+            T& check = fSteal ? slot.checks.front() : slot.checks.back();
+            vChecks[i].swap(check);
+            if (fSteal)
+                slot.checks.pop_front();
+            else
+                slot.checks.pop_back();
+        }
+        nQueued -= nNow;
+        return nNow;
+    }
+
+    /** Fill vChecks from slot nSlot, or from any other slot if that is empty */
+    unsigned int Take(unsigned int nSlot, std::vector<T>& vChecks)
+    {
+        if (nQueued == 0)
+            return 0;
+        unsigned int nUsed = std::min((unsigned int)nSlots, MAX_CHECKQUEUE_SLOTS);
+        unsigned int nNow = TakeFrom(vSlots[nSlot], vChecks, nBatchSize, false);
+        for (unsigned int i = 1; nNow == 0 && i < nUsed; i++)
+            nNow = TakeFrom(vSlots[(nSlot + i) % nUsed], vChecks, nBatchSize, true);
+        return nNow;
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(bool fMaster = false, T* pcheckFailed = NULL)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        unsigned int nSlot = fMaster ? 0 : nSlots++ % MAX_CHECKQUEUE_SLOTS;
+        bool fCounted = false;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master he can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
+            unsigned int nNow = Take(nSlot, vChecks);
+            if (nNow) {
+                // execute work, or just drain it once something failed
+                BOOST_FOREACH (T& check, vChecks) {
+                    if (fAllOk && !check() && fAllOk.exchange(false)) {
+                        boost::unique_lock<boost::mutex> lock(mutex);
+                        checkFailed.swap(check);
+                    }
+                }
+                vChecks.clear();
+                nTodo -= nNow;
+                continue;
+            }
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster) {
+                // Only return once the workers are asleep again, so the next
+                // batch starts from an idle queue
+                while (nQueued == 0 && (nTodo != 0 || nIdle != nTotal))
+                    condMaster.wait(lock);
+                if (nTodo == 0 && nIdle == nTotal) {
+                    // return the current status, and reset it for new work later
+                    bool fRet = fAllOk;
+                    fAllOk = true;
+                    T checkNone;
+                    checkFailed.swap(checkNone);
+                    if (pcheckFailed)
+                        pcheckFailed->swap(checkNone);
+                    return fRet;
+                }
+            } else {
+                if (!fCounted) {
                     nTotal++;
+                    fCounted = true;
                 }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+                // Pairs with the check of nIdle in Add(): either we see the new
+                // work here or Add() sees us idle and wakes us
+                nIdle++;
+                if (nTodo == 0) {
+                    // Everything is done; inform the master he can exit and return the result
+                    condMaster.notify_one();
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+                while (nQueued == 0 && !fQuit)
+                    condWorker.wait(lock);
+                nIdle--;
+                if (fQuit) {
+                    nTotal--;
+                    return fAllOk;
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
         } while (true);
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nSlots(1), nNextSlot(0), nIdle(0), nTotal(0), fAllOk(true), nTodo(0), nQueued(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
@@ -136,25 +198,45 @@ public:
         Loop();
     }
 
-    //! Wait until execution finishes, and return whether all evaluations where successful.
-    bool Wait()
+    /**
+     * Wait until execution finishes, and return whether all evaluations where
+     * successful. On failure the check that failed is swapped into
+     * pcheckFailed, if given.
+     */
+    bool Wait(T* pcheckFailed = NULL)
     {
-        return Loop(true);
+        return Loop(true, pcheckFailed);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+
+        // Spread the batch over the slots of running threads
+        unsigned int nUsed = std::min((unsigned int)nSlots, MAX_CHECKQUEUE_SLOTS);
+        unsigned int nChunk = std::max(1U, std::min(nBatchSize, (unsigned int)(vChecks.size() + nUsed - 1) / nUsed));
+        for (size_t nPos = 0; nPos < vChecks.size(); nPos += nChunk) {
+            Slot& slot = vSlots[nNextSlot];
+            nNextSlot = (nNextSlot + 1) % nUsed;
+            boost::unique_lock<boost::mutex> lock(slot.mutex);
+            size_t nEnd = std::min(nPos + nChunk, vChecks.size());
+            for (size_t i = nPos; i < nEnd; i++) {
+                slot.checks.push_back(T());
+                vChecks[i].swap(slot.checks.back());
+            }
+            nQueued += nEnd - nPos;
+        }
+
+        if (nIdle > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (vChecks.size() == 1)
+                condWorker.notify_one();
+            else
+                condWorker.notify_all();
+        }
     }
 
     ~CCheckQueue()
@@ -164,11 +246,11 @@ public:
     bool IsIdle()
     {
         boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return (nTotal == nIdle && nTodo == 0 && nQueued == 0 && fAllOk == true);
     }
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
@@ -189,11 +271,11 @@ public:
         }
     }
 
-    bool Wait()
+    bool Wait(T* pcheckFailed = NULL)
     {
         if (pqueue == NULL)
             return true;
-        bool fRet = pqueue->Wait();
+        bool fRet = pqueue->Wait(pcheckFailed);
         fDone = true;
         return fRet;
     }
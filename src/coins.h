@@ -7,6 +7,9 @@
 #define BITCOIN_COINS_H
 
 #include "compressor.h"
+#include "core_memusage.h"
+#include "memusage.h"
+#include "pooledmap.h"
 #include "script/standard.h"
 #include "serialize.h"
 #include "uint256.h"
@@ -14,9 +17,9 @@
 
 #include <assert.h>
 #include <stdint.h>
+#include <vector>
 
 #include <boost/foreach.hpp>
-#include <boost/unordered_map.hpp>
 
 /** 
 
@@ -125,6 +128,15 @@ public:
             std::vector<CTxOut>().swap(vout);
     }
 
+    size_t DynamicMemoryUsage() const
+    {
+        size_t ret = memusage::DynamicUsage(vout);
+        BOOST_FOREACH (const CTxOut& out, vout) {
+            ret += RecursiveDynamicUsage(out.scriptPubKey);
+        }
+        return ret;
+    }
+
     void ClearUnspendable()
     {
         BOOST_FOREACH (CTxOut& txout, vout) {
@@ -307,16 +319,29 @@ public:
 struct CCoinsCacheEntry {
     CCoins coins; // The actual cached data.
     unsigned char flags;
+    // Bitmask of the outputs that were unspent in the parent view when this entry was
+    // first modified. Only kept for entries that are DIRTY but not FRESH, so a parent
+    // that stores outputs separately can write just the ones that changed.
+    std::vector<unsigned char> vParentUnspent;
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
+        REPLACED = (1 << 2), // The outputs may differ from the parent's by more than spends.
     };
 
     CCoinsCacheEntry() : coins(), flags(0) {}
+
+    //! Remember which outputs the parent has, before the entry is first modified
+    void SetParentUnspent();
+
+    bool IsParentUnspent(unsigned int n) const
+    {
+        return n / 8 < vParentUnspent.size() && (vParentUnspent[n / 8] & (1 << (n % 8))) != 0;
+    }
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+typedef pooledmap<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
 
 struct CCoinsStats {
     int nHeight;
@@ -398,7 +423,8 @@ class CCoinsModifier
 private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
-    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
+    size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
     CCoins* operator->() { return &it->second.coins; }
@@ -421,6 +447,9 @@ protected:
     mutable uint256 hashBlock;
     mutable CCoinsMap cacheCoins;
 
+    /* Cached dynamic memory usage for the inner CCoins objects. */
+    mutable size_t cachedCoinsUsage;
+
 public:
     CCoinsViewCache(CCoinsView* baseIn);
     ~CCoinsViewCache();
@@ -446,6 +475,12 @@ public:
      */
     CCoinsModifier ModifyCoins(const uint256& txid);
 
+    /**
+     * Add coins for txid that another thread read from the base view, unless
+     * this cache already has an entry for it. The coins are swapped out.
+     */
+    bool AddPrefetched(const uint256& txid, CCoins& coins);
+
     /**
      * Push the modifications applied to this cache to its base.
      * Failure to call this method before destruction will cause the changes to be forgotten.
@@ -456,6 +491,9 @@ public:
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
+    //! Calculate the size of the cache (in bytes)
+    size_t DynamicMemoryUsage() const;
+
     /** 
      * Amount of nanucoin coming in to a transaction
      * Note that lightweight clients may not know anything besides the hash of previous transactions,
@@ -0,0 +1,149 @@
+// Copyright (c) 2018 The NanuCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/echo512_aesni.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// Only built when configure found AES-NI intrinsics (ENABLE_AESNI)
+#if !defined(__x86_64__) && !defined(__i386__)
+#error "echo512_aesni.cpp needs an x86 target"
+#endif
+
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+
+namespace
+{
+/**
+ * The ECHO BIG.SubWords step is two AES rounds per 128-bit word, keyed by
+ * the running 128-bit counter and then by zero, which is exactly what two
+ * AESENC instructions compute.
+ */
+struct Counter {
+    uint32_t k[4];
+
+    void Increment()
+    {
+        if (++k[0] == 0)
+            if (++k[1] == 0)
+                if (++k[2] == 0)
+                    ++k[3];
+    }
+};
+
+__attribute__((target("aes,sse2"))) inline __m128i XTime(__m128i x)
+{
+    // Multiply every byte by 2 in GF(2^8) with the AES polynomial
+    __m128i hi = _mm_cmpgt_epi8(_mm_setzero_si128(), x);
+    return _mm_xor_si128(_mm_add_epi8(x, x), _mm_and_si128(hi, _mm_set1_epi8(0x1B)));
+}
+
+__attribute__((target("aes,sse2"))) inline void MixColumn(__m128i W[16], int ia, int ib, int ic, int id)
+{
+    __m128i a = W[ia], b = W[ib], c = W[ic], d = W[id];
+    __m128i ab = _mm_xor_si128(a, b);
+    __m128i bc = _mm_xor_si128(b, c);
+    __m128i cd = _mm_xor_si128(c, d);
+    __m128i abx = XTime(ab);
+    __m128i bcx = XTime(bc);
+    __m128i cdx = XTime(cd);
+    W[ia] = _mm_xor_si128(abx, _mm_xor_si128(bc, d));
+    W[ib] = _mm_xor_si128(bcx, _mm_xor_si128(a, cd));
+    W[ic] = _mm_xor_si128(cdx, _mm_xor_si128(ab, d));
+    W[id] = _mm_xor_si128(_mm_xor_si128(abx, bcx), _mm_xor_si128(cdx, _mm_xor_si128(ab, c)));
+}
+
+__attribute__((target("aes,sse2"))) inline void ShiftRow1(__m128i W[16], int a, int b, int c, int d)
+{
+    __m128i tmp = W[a];
+    W[a] = W[b];
+    W[b] = W[c];
+    W[c] = W[d];
+    W[d] = tmp;
+}
+
+__attribute__((target("aes,sse2"))) inline void ShiftRow2(__m128i W[16], int a, int b, int c, int d)
+{
+    __m128i tmp = W[a];
+    W[a] = W[c];
+    W[c] = tmp;
+    tmp = W[b];
+    W[b] = W[d];
+    W[d] = tmp;
+}
+
+/** One ECHO-512 compression of a 128-byte block into the chaining value V. */
+__attribute__((target("aes,sse2"))) void Compress(__m128i V[8], const unsigned char block[128], Counter K)
+{
+    __m128i W[16];
+    const __m128i zero = _mm_setzero_si128();
+    for (int i = 0; i < 8; i++) {
+        W[i] = V[i];
+        W[i + 8] = _mm_loadu_si128((const __m128i*)(block + 16 * i));
+    }
+
+    for (int r = 0; r < 10; r++) {
+        for (int i = 0; i < 16; i++) {
+            __m128i key = _mm_set_epi32(K.k[3], K.k[2], K.k[1], K.k[0]);
+            W[i] = _mm_aesenc_si128(_mm_aesenc_si128(W[i], key), zero);
+            K.Increment();
+        }
+        ShiftRow1(W, 1, 5, 9, 13);
+        ShiftRow2(W, 2, 6, 10, 14);
+        ShiftRow1(W, 15, 11, 7, 3);
+        MixColumn(W, 0, 1, 2, 3);
+        MixColumn(W, 4, 5, 6, 7);
+        MixColumn(W, 8, 9, 10, 11);
+        MixColumn(W, 12, 13, 14, 15);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        __m128i m = _mm_loadu_si128((const __m128i*)(block + 16 * i));
+        V[i] = _mm_xor_si128(V[i], _mm_xor_si128(m, _mm_xor_si128(W[i], W[i + 8])));
+    }
+}
+
+bool DetectAESNI()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+    return (ecx & bit_AES) && (edx & bit_SSE2);
+}
+} // namespace
+
+bool Echo512AESNIAvailable()
+{
+    static const bool fAvailable = DetectAESNI();
+    return fAvailable;
+}
+
+__attribute__((target("aes,sse2"))) void Echo512AESNI128(const unsigned char in[128], unsigned char out[64])
+{
+    // Initial chaining value: the output length in bits in every word
+    __m128i V[8];
+    for (int i = 0; i < 8; i++)
+        V[i] = _mm_set_epi32(0, 0, 0, 512);
+
+    // The message fills exactly one block; the counter counts message bits
+    Counter K = {{1024, 0, 0, 0}};
+    Compress(V, in, K);
+
+    // Final block holds only padding: the 0x80 marker, the output size and
+    // the bit count. Since it carries no message bits, it is keyed by zero.
+    unsigned char pad[128];
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    pad[110] = 512 & 0xFF;
+    pad[111] = 512 >> 8;
+    memcpy(pad + 112, K.k, 16);
+    Counter Kzero = {{0, 0, 0, 0}};
+    Compress(V, pad, Kzero);
+
+    for (int i = 0; i < 4; i++)
+        _mm_storeu_si128((__m128i*)(out + 16 * i), V[i]);
+}
@@ -0,0 +1,20 @@
+// Copyright (c) 2018 The NanuCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_ECHO512_AESNI_H
+#define BITCOIN_CRYPTO_ECHO512_AESNI_H
+
+// Defined in echo512_aesni.cpp, which is only built when ENABLE_AESNI is set
+
+/** True if the CPU supports AES-NI. */
+bool Echo512AESNIAvailable();
+
+/**
+ * ECHO-512 of exactly 128 input bytes using AES-NI, matching
+ * sph_echo512_init/sph_echo512/sph_echo512_close. Only call this when
+ * Echo512AESNIAvailable() returned true.
+ */
+void Echo512AESNI128(const unsigned char in[128], unsigned char out[64]);
+
+#endif // BITCOIN_CRYPTO_ECHO512_AESNI_H
@@ -27,11 +27,13 @@
 #include "rpcserver.h"
 #include "script/standard.h"
 #include "spork.h"
+#include "stratum.h"
 #include "txdb.h"
 #include "ui_interface.h"
 #include "util.h"
 #include "utilmoneystr.h"
 #include "validationinterface.h"
+#include "xevan.h"
 #ifdef ENABLE_WALLET
 #include "db.h"
 #include "wallet.h"
@@ -153,7 +155,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB* pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher* pcoinscatcher = NULL;
 
 /** Preparing steps before shutting down or restarting the wallet */
@@ -175,6 +176,7 @@ void PrepareShutdown()
     mempool.AddTransactionsUpdated(1);
     StopRPCThreads();
 	ShutdownRPCMining();
+    StopStratumServer();
 
 #ifdef ENABLE_WALLET
     if (pwalletMain)
@@ -303,6 +305,8 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
+    strUsage += HelpMessageOpt("-assumevalid=<hex>", _("If this block is in the chain, assume that it and its ancestors are valid and skip their script verification (0 to verify all, default: the last checkpoint)"));
+    strUsage += HelpMessageOpt("-blockcache=<n>", strprintf(_("Keep up to <n> megabytes of recent blocks in memory for serving peers and reorgs (default: %u)"), DEFAULT_BLOCK_CACHE_SIZE));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), 500));
     strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), 3));
@@ -315,16 +319,20 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file") + " " + _("on startup"));
+    strUsage += HelpMessageOpt("-mapblockfiles", strprintf(_("Read finished block and undo files through memory mappings; a disk read error or a block file truncated while mapped then stops the node instead of failing the read (default: %u)"), DEFAULT_MAP_BLOCK_FILES));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), -(int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), "nanucoind.pid"));
 #endif
+    strUsage += HelpMessageOpt("-prefetchthreads=<n>", strprintf(_("Number of threads reading the coins spent by blocks ahead of connecting them, 0 to disable (default: %d)"), DEFAULT_PREFETCH_THREADS));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild block chain index from current blk000??.dat files") + " " + _("on startup"));
 #if !defined(WIN32)
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), 0));
+    strUsage += HelpMessageOpt("-utxoperoutput", strprintf(_("Store the chainstate as one record per unspent output instead of per transaction; changing it converts the database on startup (default: keep the current layout, %u for a new one)"), DEFAULT_UTXO_PER_OUTPUT));
+    strUsage += HelpMessageOpt("-verifyblockhashes", strprintf(_("Re-hash the block index and check proof-of-work in the background after startup (default: %u)"), DEFAULT_VERIFY_BLOCK_HASHES));
     strUsage += HelpMessageOpt("-forcestart", _("Attempt to force blockchain corruption recovery") + " " + _("on startup"));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
@@ -411,7 +419,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-stopafterblockimport", strprintf(_("Stop running after importing blocks from disk (default: %u)"), 0));
         strUsage += HelpMessageOpt("-sporkkey=<privkey>", _("Enable spork administration functionality with the appropriate private key."));
     }
-    string debugCategories = "addrman, alert, bench, coindb, db, lock, rand, rpc, selectcoins, mempool, net, nanucoin, (obfuscation, swifttx, masternode, mnpayments, mnbudget)"; // Don't translate these and qt below
+    string debugCategories = "addrman, alert, bench, coindb, db, lock, rand, rpc, selectcoins, mempool, net, nanucoin, stratum, (obfuscation, swifttx, masternode, mnpayments, mnbudget)"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
         debugCategories += ", qt";
         strUsage += HelpMessageOpt("-debug=<category>", strprintf(_("Output debugging information (default: %u, supplying <category> is optional)"), 0) + ". " +
@@ -444,6 +452,7 @@ std::string HelpMessage(HelpMessageMode mode)
 #ifdef ENABLE_WALLET
     strUsage += HelpMessageGroup(_("Staking options:"));
     strUsage += HelpMessageOpt("-staking=<n>", strprintf(_("Enable staking functionality (0-1, default: %u)"), 1));
+    strUsage += HelpMessageOpt("-stakethreads=<n>", strprintf(_("Set the number of threads searching the stake set for a kernel (0 = all cores, default: %d)"), DEFAULT_STAKETHREADS));
     strUsage += HelpMessageOpt("-reservebalance=<amt>", _("Keep the specified amount available for spending at all times (default: 0)"));
     if (GetBoolArg("-help-debug", false)) {
         strUsage += HelpMessageOpt("-printstakemodifier", _("Display the stake modifier calculations in the debug.log file."));
@@ -481,6 +490,13 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockmaxsize=<n>", strprintf(_("Set maximum block size in bytes (default: %d)"), DEFAULT_BLOCK_MAX_SIZE));
     strUsage += HelpMessageOpt("-blockprioritysize=<n>", strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE));
 
+    strUsage += HelpMessageGroup(_("Stratum server options:"));
+    strUsage += HelpMessageOpt("-stratum", strprintf(_("Serve proof-of-work jobs to Stratum v1 miners (default: %u)"), DEFAULT_STRATUM));
+    strUsage += HelpMessageOpt("-stratumaddress=<addr>", _("Pay blocks found through the Stratum server to <addr>"));
+    strUsage += HelpMessageOpt("-stratumbind=<addr>", strprintf(_("Bind the Stratum server to given address (default: %s)"), "127.0.0.1"));
+    strUsage += HelpMessageOpt("-stratumport=<port>", strprintf(_("Listen for Stratum connections on <port> (default: %u)"), DEFAULT_STRATUM_PORT));
+    strUsage += HelpMessageOpt("-stratumdifficulty=<n>", strprintf(_("Accept shares with at least 1/<n> of the proof-of-work limit (default: %u)"), DEFAULT_STRATUM_DIFFICULTY));
+
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), 0));
@@ -791,6 +807,11 @@ bool AppInit2(boost::thread_group& threadGroup)
     mempool.setSanityCheck(GetBoolArg("-checkmempool", Params().DefaultConsistencyChecks()));
     fCheckBlockIndex = GetBoolArg("-checkblockindex", Params().DefaultConsistencyChecks());
     Checkpoints::fEnabled = GetBoolArg("-checkpoints", true);
+    hashAssumeValid = uint256(GetArg("-assumevalid", Checkpoints::GetLastCheckpointHash().GetHex()));
+    if (hashAssumeValid != 0)
+        LogPrintf("Assuming ancestors of block %s have valid signatures.\n", hashAssumeValid.GetHex());
+    else
+        LogPrintf("Validating signatures for all blocks.\n");
 
     // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
     nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
@@ -911,6 +932,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     LogPrintf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     LogPrintf("NanuCoin version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
     LogPrintf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
+    LogPrintf("Using XEVAN implementation: %s\n", XEVANAutoDetect());
 #ifdef ENABLE_WALLET
     LogPrintf("Using BerkeleyDB version %s\n", DbEnv::version(0, 0, 0));
 #endif
@@ -1210,7 +1232,31 @@ bool AppInit2(boost::thread_group& threadGroup)
     nTotalCache -= nBlockTreeDBCache;
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
+    nCoinCacheUsage = nTotalCache;
+    LogPrintf("Cache configuration:\n");
+    LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
+    size_t nBlockCache = std::max((int64_t)0, GetArg("-blockcache", DEFAULT_BLOCK_CACHE_SIZE)) << 20;
+    blockcache.SetMaxUsage(nBlockCache);
+    blockFileMapper.SetEnabled(GetBoolArg("-mapblockfiles", DEFAULT_MAP_BLOCK_FILES));
+    LogPrintf("* Using %.1fMiB for recent blocks\n", nBlockCache * (1.0 / 1024 / 1024));
+
+    // A UTXO snapshot load that was cut short leaves part of the snapshot in
+    // both databases. Such a node had no blocks beyond genesis, so rebuilding
+    // them from the block files rolls it back cheaply.
+    if (!fReindex) {
+        bool fSnapshotLoading = false;
+        try {
+            CBlockTreeDB(nBlockTreeDBCache, false, false).ReadFlag("snapshotloading", fSnapshotLoading);
+        } catch (std::exception& e) {
+            // Reported when the database is opened below
+        }
+        if (fSnapshotLoading) {
+            LogPrintf("Unfinished UTXO snapshot load found; rebuilding the block database\n");
+            fReindex = true;
+        }
+    }
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -1230,6 +1276,10 @@ bool AppInit2(boost::thread_group& threadGroup)
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex);
+                if (!pcoinsdbview->SetPerOutput(GetBoolArg("-utxoperoutput", pcoinsdbview->IsPerOutput()))) {
+                    strLoadError = _("Error converting the chainstate database");
+                    break;
+                }
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
@@ -1299,6 +1349,10 @@ bool AppInit2(boost::thread_group& threadGroup)
         LogPrintf("Shutdown requested. Exiting.\n");
         return false;
     }
+
+    // Hashes of the loaded index come from the database keys; re-check them off the startup path
+    StartBlockIndexVerification(threadGroup);
+    StartCoinsPrefetch(threadGroup, pcoinsdbview);
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
@@ -1635,6 +1689,12 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     StartNode(threadGroup);
 
+    if (GetBoolArg("-stratum", DEFAULT_STRATUM)) {
+        std::string strError;
+        if (!StartStratumServer(strError))
+            return InitError(strError);
+    }
+
 #ifdef ENABLE_WALLET
     // Generate coins in the background
     if (pwalletMain)
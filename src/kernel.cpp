@@ -4,8 +4,11 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <boost/assign/list_of.hpp>
+#include <boost/atomic.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
 
+#include "crypto/common.h"
 #include "db.h"
 #include "kernel.h"
 #include "script/interpreter.h"
@@ -60,8 +63,7 @@ static int64_t GetStakeModifierSelectionIntervalSection(int nSection)
     return a;
 }
 
-// Get stake modifier selection interval (in seconds)
-static int64_t GetStakeModifierSelectionInterval()
+static int64_t SumStakeModifierSelectionIntervalSections()
 {
     int64_t nSelectionInterval = 0;
     for (int nSection = 0; nSection < 64; nSection++) {
@@ -70,6 +72,14 @@ static int64_t GetStakeModifierSelectionInterval()
     return nSelectionInterval;
 }
 
+// Get stake modifier selection interval (in seconds)
+static int64_t GetStakeModifierSelectionInterval()
+{
+    // Only depends on the network, so it is summed once
+    static const int64_t nSelectionInterval = SumStakeModifierSelectionIntervalSections();
+    return nSelectionInterval;
+}
+
 // select a block from the candidate blocks in vSortedByTimestamp, excluding
 // already selected blocks in vSelectedBlocks, and with timestamp up to
 // nSelectionIntervalStop.
@@ -239,61 +249,168 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeMod
     return true;
 }
 
+CStakeModifierIndex stakeModifierIndex;
+
+void CStakeModifierIndex::Push(const CBlockIndex* pindex)
+{
+    if (vGenerated.size() % CHUNK_SIZE == 0)
+        vChunkMaxTime.push_back(pindex->GetBlockTime());
+    else
+        vChunkMaxTime.back() = std::max(vChunkMaxTime.back(), pindex->GetBlockTime());
+    vGenerated.push_back(pindex);
+}
+
+void CStakeModifierIndex::Pop()
+{
+    vGenerated.pop_back();
+    size_t nLast = vGenerated.size() % CHUNK_SIZE;
+    if (nLast == 0) {
+        vChunkMaxTime.pop_back();
+        return;
+    }
+    int64_t nMaxTime = 0;
+    for (size_t i = vGenerated.size() - nLast; i < vGenerated.size(); i++)
+        nMaxTime = std::max(nMaxTime, vGenerated[i]->GetBlockTime());
+    vChunkMaxTime.back() = nMaxTime;
+}
+
+void CStakeModifierIndex::Sync()
+{
+    AssertLockHeld(cs_main);
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    if (pindexSynced == pindexTip)
+        return;
+    while (!vGenerated.empty() && !chainActive.Contains(vGenerated.back()))
+        Pop();
+    int nHeight = vGenerated.empty() ? 0 : vGenerated.back()->nHeight + 1;
+    for (; pindexTip && nHeight <= pindexTip->nHeight; nHeight++) {
+        if (chainActive[nHeight]->GeneratedStakeModifier())
+            Push(chainActive[nHeight]);
+    }
+    pindexSynced = pindexTip;
+}
+
+void CStakeModifierIndex::Connect(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (pindexSynced != pindex->pprev) {
+        Sync();
+        return;
+    }
+    if (pindex->GeneratedStakeModifier())
+        Push(pindex);
+    pindexSynced = pindex;
+}
+
+void CStakeModifierIndex::Disconnect(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (pindexSynced != pindex) {
+        Sync();
+        return;
+    }
+    if (!vGenerated.empty() && vGenerated.back() == pindex)
+        Pop();
+    pindexSynced = pindex->pprev;
+}
+
+const CBlockIndex* CStakeModifierIndex::Find(int nHeightFrom, int64_t nTime) const
+{
+    AssertLockHeld(cs_main);
+
+    // Block times are not monotonic, so skip whole chunks only when none of
+    // their blocks is late enough, and otherwise keep the height order
+    size_t nStart = 0, nEnd = vGenerated.size();
+    while (nStart < nEnd) {
+        size_t nMid = (nStart + nEnd) / 2;
+        if (vGenerated[nMid]->nHeight <= nHeightFrom)
+            nStart = nMid + 1;
+        else
+            nEnd = nMid;
+    }
+    for (size_t i = nStart; i < vGenerated.size();) {
+        if (i % CHUNK_SIZE == 0 && vChunkMaxTime[i / CHUNK_SIZE] < nTime) {
+            i += CHUNK_SIZE;
+            continue;
+        }
+        if (vGenerated[i]->GetBlockTime() >= nTime)
+            return vGenerated[i];
+        i++;
+    }
+    return NULL;
+}
+
 // The stake modifier used to hash for a stake kernel is chosen as the stake
-// modifier about a selection interval later than the coin generating the kernel
-bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
+// modifier about a selection interval later than the coin generating the kernel:
+// that of the first modifier-generating block after pindexFrom on the active
+// chain whose time is at least a selection interval past pindexFrom
+bool GetKernelStakeModifier(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake)
 {
     nStakeModifier = 0;
-    if (!mapBlockIndex.count(hashBlockFrom))
+    if (!pindexFrom)
         return error("GetKernelStakeModifier() : block not indexed");
-    const CBlockIndex* pindexFrom = mapBlockIndex[hashBlockFrom];
     nStakeModifierHeight = pindexFrom->nHeight;
     nStakeModifierTime = pindexFrom->GetBlockTime();
-    int64_t nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
-    const CBlockIndex* pindex = pindexFrom;
-    CBlockIndex* pindexNext = chainActive[pindexFrom->nHeight + 1];
-
-    // loop to find the stake modifier later by a selection interval
-    while (nStakeModifierTime < pindexFrom->GetBlockTime() + nStakeModifierSelectionInterval) {
-        if (!pindexNext) {
-            // Should never happen
-            return error("Null pindexNext\n");
-        }
+    int64_t nSelectionTime = pindexFrom->GetBlockTime() + GetStakeModifierSelectionInterval();
+    if (nStakeModifierTime >= nSelectionTime) {
+        nStakeModifier = pindexFrom->nStakeModifier;
+        return true;
+    }
 
-        pindex = pindexNext;
-        pindexNext = chainActive[pindexNext->nHeight + 1];
-        if (pindex->GeneratedStakeModifier()) {
-            nStakeModifierHeight = pindex->nHeight;
-            nStakeModifierTime = pindex->GetBlockTime();
-        }
+    const CBlockIndex* pindex = stakeModifierIndex.Find(pindexFrom->nHeight, nSelectionTime);
+    if (!pindex) {
+        // Should never happen
+        return error("Null pindexNext\n");
     }
+    nStakeModifierHeight = pindex->nHeight;
+    nStakeModifierTime = pindex->GetBlockTime();
     nStakeModifier = pindex->nStakeModifier;
     return true;
 }
 
-uint256 stakeHash(unsigned int nTimeTx, CDataStream ss, unsigned int prevoutIndex, uint256 prevoutHash, unsigned int nTimeBlockFrom)
+uint256 stakeHash(unsigned int nTimeTx, uint64_t nStakeModifier, unsigned int prevoutIndex, const uint256& prevoutHash, unsigned int nTimeBlockFrom)
 {
     //NanuCoin will hash in the transaction hash and the index number in order to make sure each hash is unique
-    ss << nTimeBlockFrom << prevoutIndex << prevoutHash << nTimeTx;
-    return Hash(ss.begin(), ss.end());
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << nStakeModifier << nTimeBlockFrom << prevoutIndex << prevoutHash << nTimeTx;
+    return ss.GetHash();
 }
 
 //test hash vs target
-bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTargetPerCoinDay)
+bool stakeTargetHit(const uint256& hashProofOfStake, int64_t nValueIn, const uint256& bnTargetPerCoinDay)
 {
     //get the stake weight - weight is equal to coin amount
     uint256 bnCoinDayWeight = uint256(nValueIn) / 100;
 
     // Now check if proof-of-stake hash meets target protocol
-    return (uint256(hashProofOfStake) < bnCoinDayWeight * bnTargetPerCoinDay);
+    return (hashProofOfStake < bnCoinDayWeight * bnTargetPerCoinDay);
 }
 
-//instead of looping outside and reinitializing variables many times, we will give a nTimeTx and also search interval so that we can do all the hashing here
-bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTransaction txPrev, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake)
+CStakeKernel::CStakeKernel(uint64_t nStakeModifier, unsigned int nTimeBlockFrom, const COutPoint& prevout, int64_t nValueIn, unsigned int nBits)
+{
+    // Everything stakeHash() serializes ahead of nTimeTx
+    CDataStream ss(SER_GETHASH, 0);
+    ss << nStakeModifier << nTimeBlockFrom << prevout.n << prevout.hash;
+    assert(ss.size() == PREFIX_SIZE);
+    memcpy(vchKernel, &ss[0], PREFIX_SIZE);
+
+    uint256 bnTargetPerCoinDay;
+    bnTargetPerCoinDay.SetCompact(nBits);
+    bnThreshold = (uint256(nValueIn) / 100) * bnTargetPerCoinDay;
+}
+
+uint256 CStakeKernel::GetHash(unsigned int nTimeTx) const
+{
+    unsigned char vch[sizeof(vchKernel)];
+    memcpy(vch, vchKernel, PREFIX_SIZE);
+    WriteLE32(vch + PREFIX_SIZE, nTimeTx);
+    return Hash(vch, vch + sizeof(vch));
+}
+
+// CheckStakeKernelHash for a stake modifier that is already known
+static bool CheckStakeKernelHash(unsigned int nBits, const CBlockIndex* pindexFrom, uint64_t nStakeModifier, int64_t nValueIn, const COutPoint& prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake)
 {
-    //assign new variables to make it easier to read
-    int64_t nValueIn = txPrev.vout[prevout.n].nValue;
-    unsigned int nTimeBlockFrom = blockFrom.GetBlockTime();
+    unsigned int nTimeBlockFrom = pindexFrom->GetBlockTime();
 
     if (nTimeTx < nTimeBlockFrom) // Transaction timestamp violation
         return error("CheckStakeKernelHash() : nTime violation");
@@ -301,27 +418,13 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
     if (nTimeBlockFrom + nStakeMinAge > nTimeTx) // Min age requirement
         return error("CheckStakeKernelHash() : min age violation - nTimeBlockFrom=%d nStakeMinAge=%d nTimeTx=%d", nTimeBlockFrom, nStakeMinAge, nTimeTx);
 
-    //grab difficulty
-    uint256 bnTargetPerCoinDay;
-    bnTargetPerCoinDay.SetCompact(nBits);
-
-    //grab stake modifier
-    uint64_t nStakeModifier = 0;
-    int nStakeModifierHeight = 0;
-    int64_t nStakeModifierTime = 0;
-    if (!GetKernelStakeModifier(blockFrom.GetHash(), nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake)) {
-        LogPrintf("CheckStakeKernelHash(): failed to get kernel stake modifier \n");
-        return false;
-    }
-
-    //create data stream once instead of repeating it in the loop
-    CDataStream ss(SER_GETHASH, 0);
-    ss << nStakeModifier;
+    //absorb the constant part of the kernel and the target once instead of in the loop
+    CStakeKernel kernel(nStakeModifier, nTimeBlockFrom, prevout, nValueIn, nBits);
 
     //if wallet is simply checking to make sure a hash is valid
     if (fCheck) {
-        hashProofOfStake = stakeHash(nTimeTx, ss, prevout.n, prevout.hash, nTimeBlockFrom);
-        return stakeTargetHit(hashProofOfStake, nValueIn, bnTargetPerCoinDay);
+        hashProofOfStake = kernel.GetHash(nTimeTx);
+        return kernel.IsTargetHit(hashProofOfStake);
     }
 
     bool fSuccess = false;
@@ -331,21 +434,16 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
     {
         //hash this iteration
         nTryTime = nTimeTx + nHashDrift - i;
-        hashProofOfStake = stakeHash(nTryTime, ss, prevout.n, prevout.hash, nTimeBlockFrom);
+        hashProofOfStake = kernel.GetHash(nTryTime);
 
         // if stake hash does not meet the target then continue to next iteration
-        if (!stakeTargetHit(hashProofOfStake, nValueIn, bnTargetPerCoinDay))
+        if (!kernel.IsTargetHit(hashProofOfStake))
             continue;
 
         fSuccess = true; // if we make it this far then we have successfully created a stake hash
         nTimeTx = nTryTime;
 
         if (fDebug || fPrintProofOfStake) {
-            LogPrintf("CheckStakeKernelHash() : using modifier %s at height=%d timestamp=%s for block from height=%d timestamp=%s\n",
-                boost::lexical_cast<std::string>(nStakeModifier).c_str(), nStakeModifierHeight,
-                DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nStakeModifierTime).c_str(),
-                mapBlockIndex[blockFrom.GetHash()]->nHeight,
-                DateTimeStrFormat("%Y-%m-%d %H:%M:%S", blockFrom.GetBlockTime()).c_str());
             LogPrintf("CheckStakeKernelHash() : pass protocol=%s modifier=%s nTimeBlockFrom=%u prevoutHash=%s nTimeTxPrev=%u nPrevout=%u nTimeTx=%u hashProof=%s\n",
                 "0.3",
                 boost::lexical_cast<std::string>(nStakeModifier).c_str(),
@@ -355,46 +453,217 @@ bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTra
         break;
     }
 
-    mapHashedBlocks.clear();
-    mapHashedBlocks[chainActive.Tip()->nHeight] = GetTime(); //store a time stamp of when we last hashed on this block
     return fSuccess;
 }
 
+//instead of looping outside and reinitializing variables many times, we will give a nTimeTx and also search interval so that we can do all the hashing here
+bool CheckStakeKernelHash(unsigned int nBits, const CBlockIndex* pindexFrom, int64_t nValueIn, const COutPoint& prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake)
+{
+    //grab stake modifier
+    uint64_t nStakeModifier = 0;
+    int nStakeModifierHeight = 0;
+    int64_t nStakeModifierTime = 0;
+    if (!GetKernelStakeModifier(pindexFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, fPrintProofOfStake)) {
+        LogPrintf("CheckStakeKernelHash(): failed to get kernel stake modifier \n");
+        return false;
+    }
+
+    if (!CheckStakeKernelHash(nBits, pindexFrom, nStakeModifier, nValueIn, prevout, nTimeTx, nHashDrift, fCheck, hashProofOfStake, fPrintProofOfStake))
+        return false;
+
+    if (!fCheck && (fDebug || fPrintProofOfStake)) {
+        LogPrintf("CheckStakeKernelHash() : using modifier %s at height=%d timestamp=%s for block from height=%d timestamp=%s\n",
+            boost::lexical_cast<std::string>(nStakeModifier).c_str(), nStakeModifierHeight,
+            DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nStakeModifierTime).c_str(),
+            pindexFrom->nHeight,
+            DateTimeStrFormat("%Y-%m-%d %H:%M:%S", pindexFrom->GetBlockTime()).c_str());
+    }
+    return true;
+}
+
+boost::atomic<unsigned int> nStakeTipUpdates(0);
+
+namespace
+{
+struct CStakeSearch {
+    const std::vector<CStakeCandidate>& vCandidates;
+    unsigned int nBits;
+    unsigned int nTimeTx;
+    unsigned int nHashDrift;
+    int64_t nMinTime;
+    unsigned int nTipUpdates;
+
+    //! Next candidate to hand out; indices are handed out in increasing order
+    boost::atomic<size_t> nNext;
+    boost::atomic<bool> fStop;
+    boost::atomic<size_t> nExamined;
+    boost::atomic<uint64_t> nHashes;
+
+    CCriticalSection cs;
+    bool fFound;
+    size_t nFound;
+    unsigned int nTimeTxFound;
+    uint256 hashProofOfStake;
+
+    CStakeSearch(const std::vector<CStakeCandidate>& vCandidatesIn) : vCandidates(vCandidatesIn), nNext(0), fStop(false), nExamined(0), nHashes(0), fFound(false), nFound(0), nTimeTxFound(0) {}
+};
+}
+
+//! Serializes SearchStakeKernels callers, the workers help with one search at a time
+static CCriticalSection csStakeSearch;
+//! Guards the three below and wakes workers when a search starts or the last one leaves it
+static CWaitableCriticalSection csStakeSearchWorkers;
+static CConditionVariable condStakeSearchWorkers;
+//! Search the workers may join, NULL between searches
+static CStakeSearch* pStakeSearch = NULL;
+//! Bumped per search so a worker joins each search at most once
+static unsigned int nStakeSearchId = 0;
+//! Workers that joined pStakeSearch and have not left it yet
+static int nStakeSearchActive = 0;
+
+static void RunStakeSearch(CStakeSearch* search)
+{
+    // A worker only stops before fetching, so once candidate k has a kernel
+    // every candidate below k has already been taken and is still finished
+    while (!search->fStop) {
+        size_t i = search->nNext++;
+        if (i >= search->vCandidates.size())
+            break;
+        if (nStakeTipUpdates != search->nTipUpdates) {
+            search->fStop = true;
+            break;
+        }
+
+        const CStakeCandidate& candidate = search->vCandidates[i];
+        unsigned int nTimeTx = search->nTimeTx;
+        uint256 hashProofOfStake = 0;
+        search->nExamined++;
+        if (!CheckStakeKernelHash(search->nBits, candidate.pindexFrom, candidate.nStakeModifier, candidate.nValueIn, candidate.prevout, nTimeTx, search->nHashDrift, false, hashProofOfStake, true)) {
+            search->nHashes += search->nHashDrift;
+            continue;
+        }
+        // The drift loop walks down from nTimeTx + nHashDrift and stops at the kernel
+        search->nHashes += search->nTimeTx + search->nHashDrift - nTimeTx + 1;
+
+        //Double check that this will pass time requirements
+        if (nTimeTx <= search->nMinTime) {
+            LogPrintf("SearchStakeKernels() : kernel found, but it is too far in the past \n");
+            continue;
+        }
+
+        LOCK(search->cs);
+        if (!search->fFound || i < search->nFound) {
+            search->fFound = true;
+            search->nFound = i;
+            search->nTimeTxFound = nTimeTx;
+            search->hashProofOfStake = hashProofOfStake;
+        }
+        search->fStop = true;
+    }
+}
+
+void ThreadStakeSearch()
+{
+    unsigned int nSearchJoined = 0;
+    while (true) {
+        CStakeSearch* search = NULL;
+        {
+            boost::unique_lock<boost::mutex> lock(csStakeSearchWorkers);
+            while (!pStakeSearch || nStakeSearchId == nSearchJoined)
+                condStakeSearchWorkers.wait(lock);
+            search = pStakeSearch;
+            nSearchJoined = nStakeSearchId;
+            nStakeSearchActive++;
+        }
+        RunStakeSearch(search);
+        {
+            boost::unique_lock<boost::mutex> lock(csStakeSearchWorkers);
+            if (--nStakeSearchActive == 0)
+                condStakeSearchWorkers.notify_all();
+        }
+    }
+}
+
+bool SearchStakeKernels(const std::vector<CStakeCandidate>& vCandidates, unsigned int nBits, unsigned int nTimeTx, unsigned int nHashDrift, int64_t nMinTime, unsigned int nTipUpdates, size_t& nFound, unsigned int& nTimeTxFound, uint256& hashProofOfStake, CStakeSearchStats* pstats)
+{
+    CStakeSearch search(vCandidates);
+    search.nBits = nBits;
+    search.nTimeTx = nTimeTx;
+    search.nHashDrift = nHashDrift;
+    search.nMinTime = nMinTime;
+    search.nTipUpdates = nTipUpdates;
+
+    LOCK(csStakeSearch);
+    {
+        boost::unique_lock<boost::mutex> lock(csStakeSearchWorkers);
+        pStakeSearch = &search;
+        nStakeSearchId++;
+        condStakeSearchWorkers.notify_all();
+    }
+    RunStakeSearch(&search);
+    {
+        // The workers point into this frame, so they must be done with it even
+        // if the calling thread is being interrupted
+        boost::this_thread::disable_interruption di;
+        boost::unique_lock<boost::mutex> lock(csStakeSearchWorkers);
+        pStakeSearch = NULL;
+        while (nStakeSearchActive > 0)
+            condStakeSearchWorkers.wait(lock);
+    }
+    if (pstats) {
+        pstats->nExamined = search.nExamined;
+        pstats->nHashes = search.nHashes;
+    }
+
+    if (!search.fFound || nStakeTipUpdates != nTipUpdates)
+        return false;
+    nFound = search.nFound;
+    nTimeTxFound = search.nTimeTxFound;
+    hashProofOfStake = search.hashProofOfStake;
+    return true;
+}
+
 // Check kernel hash target and coinstake signature
-bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake)
+bool CheckProofOfStake(const CBlock& block, uint256& hashProofOfStake)
 {
-    const CTransaction tx = block.vtx[1];
+    const CTransaction& tx = block.vtx[1];
     if (!tx.IsCoinStake())
         return error("CheckProofOfStake() : called on non-coinstake %s", tx.GetHash().ToString().c_str());
 
     // Kernel (input 0) must match the stake hash target per coin age (nBits)
     const CTxIn& txin = tx.vin[0];
 
-    // First try finding the previous transaction in database
-    uint256 hashBlock;
+    // Unspent stake inputs come straight from the coins view; the block they
+    // were created in is the active chain block at the recorded height
+    const CBlockIndex* pindexFrom = NULL;
+    const CTxOut* ptxoutPrev = NULL;
     CTransaction txPrev;
-    if (!GetTransaction(txin.prevout.hash, txPrev, hashBlock, true))
-        return error("CheckProofOfStake() : INFO: read txPrev failed");
+    const CCoins* coins = pcoinsTip->AccessCoins(txin.prevout.hash);
+    if (coins && coins->IsAvailable(txin.prevout.n)) {
+        pindexFrom = chainActive[coins->nHeight];
+        ptxoutPrev = &coins->vout[txin.prevout.n];
+    } else {
+        // Spent on the active chain, e.g. a block on a competing fork
+        uint256 hashBlock;
+        if (!GetTransaction(txin.prevout.hash, txPrev, hashBlock, true))
+            return error("CheckProofOfStake() : INFO: read txPrev failed");
+        if (txin.prevout.n >= txPrev.vout.size())
+            return error("CheckProofOfStake() : invalid prevout on coinstake %s", tx.GetHash().ToString().c_str());
+        BlockMap::iterator it = mapBlockIndex.find(hashBlock);
+        if (it != mapBlockIndex.end())
+            pindexFrom = it->second;
+        ptxoutPrev = &txPrev.vout[txin.prevout.n];
+    }
+    if (!pindexFrom)
+        return error("CheckProofOfStake() : read block failed");
 
     //verify signature and script
-    if (!VerifyScript(txin.scriptSig, txPrev.vout[txin.prevout.n].scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&tx, 0)))
+    if (!VerifyScript(txin.scriptSig, ptxoutPrev->scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&tx, 0)))
         return error("CheckProofOfStake() : VerifySignature failed on coinstake %s", tx.GetHash().ToString().c_str());
 
-    CBlockIndex* pindex = NULL;
-    BlockMap::iterator it = mapBlockIndex.find(hashBlock);
-    if (it != mapBlockIndex.end())
-        pindex = it->second;
-    else
-        return error("CheckProofOfStake() : read block failed");
-
-    // Read block header
-    CBlock blockprev;
-    if (!ReadBlockFromDisk(blockprev, pindex->GetBlockPos()))
-        return error("CheckProofOfStake(): INFO: failed to find block");
-
     unsigned int nInterval = 0;
     unsigned int nTime = block.nTime;
-    if (!CheckStakeKernelHash(block.nBits, blockprev, txPrev, txin.prevout, nTime, nInterval, true, hashProofOfStake, fDebug))
+    if (!CheckStakeKernelHash(block.nBits, pindexFrom, ptxoutPrev->nValue, txin.prevout, nTime, nInterval, true, hashProofOfStake, fDebug))
         return error("CheckProofOfStake() : INFO: check kernel failed on coinstake %s, hashProof=%s \n", tx.GetHash().ToString().c_str(), hashProofOfStake.ToString().c_str()); // may occur during initial download or if behind on block chain sync
 
     return true;
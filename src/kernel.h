@@ -6,6 +6,8 @@
 
 #include "main.h"
 
+#include <boost/atomic.hpp>
+
 // To decrease granularity of timestamp
 // Supposed to be 2^n-1
 static const int STAKE_TIMESTAMP_MASK = 15;
@@ -20,18 +22,119 @@ extern unsigned int getIntervalVersion(bool fTestNet);
 // ratio of group interval length between the last group and the first group
 static const int MODIFIER_INTERVAL_RATIO = 3;
 
+// Threads sweeping the stake set for a kernel (0 = one per core)
+static const int DEFAULT_STAKETHREADS = 1;
+
+/**
+ * Modifier-generating blocks of the active chain in height order, so the
+ * modifier for a kernel is found without walking chainActive block by block.
+ * Guarded by cs_main. ConnectTip/DisconnectTip keep it in step, and it is
+ * synced once wherever the tip is set directly (loading the block index or a
+ * UTXO snapshot). Threads without cs_main, like the kernel search workers,
+ * are handed modifiers looked up beforehand instead.
+ */
+class CStakeModifierIndex
+{
+public:
+    CStakeModifierIndex() : pindexSynced(NULL) {}
+
+    void Connect(const CBlockIndex* pindex);
+    void Disconnect(const CBlockIndex* pindex);
+
+    /** Rebuild from chainActive after its tip was set other than by ConnectTip/DisconnectTip */
+    void Sync();
+
+    /** First modifier-generating block above nHeightFrom with a time of at least nTime, or NULL */
+    const CBlockIndex* Find(int nHeightFrom, int64_t nTime) const;
+
+private:
+    //! Entries per run whose latest block time is kept in vChunkMaxTime
+    static const size_t CHUNK_SIZE = 64;
+
+    std::vector<const CBlockIndex*> vGenerated;
+    std::vector<int64_t> vChunkMaxTime;
+    const CBlockIndex* pindexSynced;
+
+    void Push(const CBlockIndex* pindex);
+    void Pop();
+};
+
+extern CStakeModifierIndex stakeModifierIndex;
+
+// Find the stake modifier a kernel from pindexFrom has to use; requires cs_main
+bool GetKernelStakeModifier(const CBlockIndex* pindexFrom, uint64_t& nStakeModifier, int& nStakeModifierHeight, int64_t& nStakeModifierTime, bool fPrintProofOfStake);
+
 // Compute the hash modifier for proof-of-stake
 bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
 
 // Check whether stake kernel meets hash target
 // Sets hashProofOfStake on success return
-uint256 stakeHash(unsigned int nTimeTx, CDataStream ss, unsigned int prevoutIndex, uint256 prevoutHash, unsigned int nTimeBlockFrom);
-bool stakeTargetHit(uint256 hashProofOfStake, int64_t nValueIn, uint256 bnTargetPerCoinDay);
-bool CheckStakeKernelHash(unsigned int nBits, const CBlock blockFrom, const CTransaction txPrev, const COutPoint prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake = false);
+uint256 stakeHash(unsigned int nTimeTx, uint64_t nStakeModifier, unsigned int prevoutIndex, const uint256& prevoutHash, unsigned int nTimeBlockFrom);
+bool stakeTargetHit(const uint256& hashProofOfStake, int64_t nValueIn, const uint256& bnTargetPerCoinDay);
+
+/**
+ * stakeHash() and stakeTargetHit() for one stake input swept over candidate
+ * nTimeTx values. The stake modifier, block-from time and prevout are
+ * serialized and the weighted target is computed once.
+ */
+class CStakeKernel
+{
+public:
+    CStakeKernel(uint64_t nStakeModifier, unsigned int nTimeBlockFrom, const COutPoint& prevout, int64_t nValueIn, unsigned int nBits);
+
+    uint256 GetHash(unsigned int nTimeTx) const;
+    bool IsTargetHit(const uint256& hashProofOfStake) const { return hashProofOfStake < bnThreshold; }
+
+private:
+    //! Serialized size of everything before nTimeTx
+    static const size_t PREFIX_SIZE = 48;
+
+    unsigned char vchKernel[PREFIX_SIZE + 4];
+    uint256 bnThreshold;
+};
+
+bool CheckStakeKernelHash(unsigned int nBits, const CBlockIndex* pindexFrom, int64_t nValueIn, const COutPoint& prevout, unsigned int& nTimeTx, unsigned int nHashDrift, bool fCheck, uint256& hashProofOfStake, bool fPrintProofOfStake = false);
+
+// A stake input offered to SearchStakeKernels, with the stake modifier of
+// its kernel looked up beforehand under cs_main
+struct CStakeCandidate
+{
+    const CBlockIndex* pindexFrom;
+    uint64_t nStakeModifier;
+    int64_t nValueIn;
+    COutPoint prevout;
+
+    CStakeCandidate(const CBlockIndex* pindexFromIn, uint64_t nStakeModifierIn, int64_t nValueInIn, const COutPoint& prevoutIn)
+        : pindexFrom(pindexFromIn), nStakeModifier(nStakeModifierIn), nValueIn(nValueInIn), prevout(prevoutIn) {}
+};
+
+// What a SearchStakeKernels call went through
+struct CStakeSearchStats
+{
+    size_t nExamined;
+    uint64_t nHashes;
+
+    CStakeSearchStats() : nExamined(0), nHashes(0) {}
+};
+
+// Bumped by the stake minter whenever a new tip is announced
+extern boost::atomic<unsigned int> nStakeTipUpdates;
+
+// Worker for SearchStakeKernels; -stakethreads minus one of them are started
+void ThreadStakeSearch();
+
+// Run the kernel search over vCandidates on the calling thread and every
+// ThreadStakeSearch worker. Workers stop taking candidates once a kernel is
+// found or nStakeTipUpdates moves off nTipUpdates, and kernels timed at or
+// before nMinTime are skipped. On success nFound is the lowest candidate index
+// with a kernel, which is the one a serial search would have returned. pstats,
+// if given, receives how many candidates were looked at and how many kernel
+// hashes that took.
+bool SearchStakeKernels(const std::vector<CStakeCandidate>& vCandidates, unsigned int nBits, unsigned int nTimeTx, unsigned int nHashDrift, int64_t nMinTime, unsigned int nTipUpdates, size_t& nFound, unsigned int& nTimeTxFound, uint256& hashProofOfStake, CStakeSearchStats* pstats = NULL);
 
 // Check kernel hash target and coinstake signature
 // Sets hashProofOfStake on success return
-bool CheckProofOfStake(const CBlock block, uint256& hashProofOfStake);
+bool CheckProofOfStake(const CBlock& block, uint256& hashProofOfStake);
 
 // Check whether the coinstake timestamp meets protocol
 bool CheckCoinStakeTimestamp(int64_t nTimeBlock, int64_t nTimeTx);
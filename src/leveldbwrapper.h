@@ -168,6 +168,15 @@ public:
     {
         return pdb->NewIterator(iteroptions);
     }
+
+    /**
+     * Iterator for short prefix scans at a point lookup: it reads with
+     * readoptions, so the blocks it touches stay in the block cache.
+     */
+    leveldb::Iterator* NewLookupIterator()
+    {
+        return pdb->NewIterator(readoptions);
+    }
 };
 
 #endif // BITCOIN_LEVELDBWRAPPER_H
@@ -12,6 +12,7 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "crypto/common.h"
 #include "init.h"
 #include "kernel.h"
 #include "masternode-budget.h"
@@ -51,11 +52,13 @@ using namespace std;
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
-map<uint256, uint256> mapProofOfStake;
-set<pair<COutPoint, unsigned int> > setStakeSeen;
+/** Proof-of-stake hashes from CheckWork() of blocks not yet added to the block index */
+static boost::unordered_map<uint256, uint256, BlockHasher> mapProofOfStake;
 map<unsigned int, unsigned int> mapHashedBlocks;
 CChain chainActive;
 CBlockIndex* pindexBestHeader = NULL;
+/** Tip of the loaded UTXO snapshot; the blocks below it have no data to reorganize with */
+static CBlockIndex* pindexSnapshotBase = NULL;
 int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
@@ -65,7 +68,10 @@ bool fReindex = false;
 bool fTxIndex = true;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
+CBlockCache blockcache(DEFAULT_BLOCK_CACHE_SIZE << 20);
+CBlockFileMapper blockFileMapper;
+uint256 hashAssumeValid;
 bool fAlerts = DEFAULT_ALERTS;
 
 unsigned int nStakeMinAge = 60 * 60;
@@ -184,6 +190,8 @@ namespace {
 namespace {
 
     struct CMainSignals {
+        /** Notifies listeners of updated block chain tip */
+        boost::signals2::signal<void(const CBlockIndex*) > UpdatedBlockTip;
         /** Notifies listeners of updated transaction data (transaction, and optionally the block it is found in. */
         boost::signals2::signal<void(const CTransaction&, const CBlock*) > SyncTransaction;
         /** Notifies listeners of an erased transaction (currently disabled, requires transaction replacement). */
@@ -203,6 +211,7 @@ namespace {
 } // anon namespace
 
 void RegisterValidationInterface(CValidationInterface* pwalletIn) {
+    g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
     g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
     // XX42 g_signals.EraseTransaction.connect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
     g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
@@ -220,6 +229,7 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
     g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
     // XX42    g_signals.EraseTransaction.disconnect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
     g_signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2));
+    g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
 }
 
 void UnregisterAllValidationInterfaces() {
@@ -230,6 +240,7 @@ void UnregisterAllValidationInterfaces() {
     g_signals.UpdatedTransaction.disconnect_all_slots();
     // XX42    g_signals.EraseTransaction.disconnect_all_slots();
     g_signals.SyncTransaction.disconnect_all_slots();
+    g_signals.UpdatedBlockTip.disconnect_all_slots();
 }
 
 void SyncWithWallets(const CTransaction& tx, const CBlock* pblock) {
@@ -570,6 +581,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache* pcoinsTip = NULL;
+CCoinsViewDB* pcoinsdbview = NULL;
 CBlockTreeDB* pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1055,6 +1067,59 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
     return nMinFee;
 }
 
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+
+/** Reject tx for the script check of input nIn that failed with error under flags */
+static bool ScriptCheckFailed(const CTransaction& tx, CValidationState& state, const CCoins& coins, unsigned int nIn, unsigned int flags, bool cacheStore, ScriptError error)
+{
+    if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
+        // Check whether the failure was caused by a
+        // non-mandatory script verification check, such as
+        // non-standard DER encodings or non-null dummy
+        // arguments; if so, don't trigger DoS protection to
+        // avoid splitting the network between upgraded and
+        // non-upgraded nodes.
+        CScriptCheck check(coins, tx, nIn,
+                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
+        if (check())
+            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(error)));
+    }
+    // Failures of other flags indicate a transaction that is
+    // invalid in new blocks, e.g. a invalid P2SH. We DoS ban
+    // such nodes as they are not following the protocol. That
+    // said during an upgrade careful thought should be taken
+    // as to the correct behavior - we may want to continue
+    // peering with non-upgraded nodes even after a soft-fork
+    // super-majority vote has passed.
+    return state.DoS(100, false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(error)));
+}
+
+/**
+ * CheckInputs() with the script checks of a multi-input transaction run on
+ * the script-check threads. On failure the queue hands back the check that
+ * failed through Wait(&checkFailed), and only that input is re-run without
+ * the non-mandatory flags to pick the reject reason and DoS score.
+ */
+static bool CheckInputsParallel(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view, unsigned int flags)
+{
+    if (!nScriptCheckThreads || tx.vin.size() < 2)
+        return CheckInputs(tx, state, view, true, flags, true);
+
+    std::vector<CScriptCheck> vChecks;
+    if (!CheckInputs(tx, state, view, true, flags, true, &vChecks))
+        return false;
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    control.Add(vChecks);
+    CScriptCheck checkFailed;
+    if (control.Wait(&checkFailed))
+        return true;
+    // The queue kept the check that failed, so only its input is looked at again
+    unsigned int nIn = checkFailed.GetInputIndex();
+    const CCoins* coins = view.AccessCoins(tx.vin[nIn].prevout.hash);
+    assert(coins);
+    return ScriptCheckFailed(tx, state, *coins, nIn, flags, true, checkFailed.GetScriptError());
+}
+
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree, bool* pfMissingInputs, bool fRejectInsaneFee, bool ignoreFees) {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1221,7 +1286,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true)) {
+        if (!CheckInputsParallel(tx, state, view, STANDARD_SCRIPT_VERIFY_FLAGS)) {
             return error("AcceptToMemoryPool: : ConnectInputs failed %s", hash.ToString());
         }
 
@@ -1234,7 +1299,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true)) {
+        if (!CheckInputsParallel(tx, state, view, MANDATORY_SCRIPT_VERIFY_FLAGS)) {
             return error("AcceptToMemoryPool: : BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s", hash.ToString());
         }
 
@@ -1526,21 +1591,65 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos) {
     return true;
 }
 
+/**
+ * Find the record at pos in a mapping of its finished blk or rev file. Records
+ * are preceded by the network magic and their size, and undo records followed
+ * by nExtra bytes of checksum. Returns NULL if the caller should read the file
+ * with stdio instead.
+ */
+static const char* MapDiskRecord(CMappedFileRef& pmap, const CDiskBlockPos& pos, bool fUndo, unsigned int nExtra, unsigned int& nSize) {
+    static const unsigned int nHeaderSize = MESSAGE_START_SIZE + sizeof(unsigned int);
+    if (pos.nPos < nHeaderSize)
+        return NULL;
+    bool fSequential = fReindex || fImporting;
+    pmap = blockFileMapper.Get(pos.nFile, fUndo, pos.nPos, fSequential);
+    if (!pmap)
+        return NULL;
+    const char* pchHeader = pmap->begin() + pos.nPos - nHeaderSize;
+    if (memcmp(pchHeader, Params().MessageStart(), MESSAGE_START_SIZE) != 0)
+        return NULL;
+    nSize = ReadLE32((const unsigned char*)pchHeader + MESSAGE_START_SIZE);
+    uint64_t nEnd = (uint64_t)pos.nPos + nSize + nExtra;
+    if (nEnd > pmap->size()) {
+        // A rev file may have grown since it was mapped
+        pmap = blockFileMapper.Get(pos.nFile, fUndo, nEnd, fSequential);
+        if (!pmap)
+            return NULL;
+    }
+    return pmap->begin() + pos.nPos;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos) {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk : OpenBlockFile failed");
+    // Deserialize straight from the mapping of a finished file, if there is one
+    CMappedFileRef pmap;
+    unsigned int nSize;
+    const char* pch = MapDiskRecord(pmap, pos, false, 0, nSize);
+    if (pch) {
+        try {
+            CBufferReader reader(pch, nSize, SER_DISK, CLIENT_VERSION);
+            reader >> block;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize error - %s", __func__, e.what());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk : OpenBlockFile failed");
 
-    // Read block
-    try {
-        filein >> block;
-    } catch (std::exception& e) {
-        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        // Read block
+        try {
+            filein >> block;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
     }
 
+    // Nothing modifies a block once it is read, so hash it only once
+    block.SetCachedHash(block.ComputeHash());
+
     // Check the header
     if (block.IsProofOfWork()) {
         if (!CheckProofOfWork(block.GetHash(), block.nBits))
@@ -1550,7 +1659,56 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos) {
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex) {
+bool ReadRawBlockFromDisk(std::vector<char>& vRaw, const CDiskBlockPos& pos) {
+    // The block is preceded by the network magic and its size, see WriteBlockToDisk
+    if (pos.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("ReadRawBlockFromDisk : bad position %d:%u", pos.nFile, pos.nPos);
+
+    CMappedFileRef pmap;
+    unsigned int nMappedSize;
+    const char* pch = MapDiskRecord(pmap, pos, false, 0, nMappedSize);
+    if (pch) {
+        if (nMappedSize < 80 || nMappedSize > MAX_BLOCK_SIZE)
+            return error("ReadRawBlockFromDisk : bad block size %u at %d:%u", nMappedSize, pos.nFile, pos.nPos);
+        vRaw.assign(pch, pch + nMappedSize);
+        return true;
+    }
+
+    CDiskBlockPos posHeader(pos.nFile, pos.nPos - MESSAGE_START_SIZE - sizeof(unsigned int));
+    CAutoFile filein(OpenBlockFile(posHeader, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("ReadRawBlockFromDisk : OpenBlockFile failed");
+
+    try {
+        MessageStartChars pchMagic;
+        unsigned int nSize;
+        filein >> FLATDATA(pchMagic) >> nSize;
+        if (memcmp(pchMagic, Params().MessageStart(), MESSAGE_START_SIZE) != 0)
+            return error("ReadRawBlockFromDisk : no block header at %d:%u", pos.nFile, pos.nPos);
+        if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+            return error("ReadRawBlockFromDisk : bad block size %u at %d:%u", nSize, pos.nFile, pos.nPos);
+        vRaw.resize(nSize);
+        filein.read(&vRaw[0], nSize);
+    } catch (std::exception& e) {
+        return error("%s : I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<char>& vRaw, const CBlockIndex* pindex) {
+    if (!ReadRawBlockFromDisk(vRaw, pindex->GetBlockPos()))
+        return false;
+    // The index holds every header field, so the record has to start with
+    // them; the receiver checks the rest against its merkle root
+    CDataStream ssHeader(SER_DISK, CLIENT_VERSION);
+    ssHeader << pindex->GetBlockHeader();
+    if (vRaw.size() < ssHeader.size() || memcmp(&vRaw[0], &ssHeader[0], ssHeader.size()) != 0) {
+        return error("ReadRawBlockFromDisk(std::vector<char>&, CBlockIndex*) : header doesn't match index for %s", pindex->GetBlockHash().ToString().c_str());
+    }
+    return true;
+}
+
+static bool ReadBlockFromDiskUncached(CBlock& block, const CBlockIndex* pindex) {
     if (!ReadBlockFromDisk(block, pindex->GetBlockPos()))
         return false;
     if (block.GetHash() != pindex->GetBlockHash()) {
@@ -1560,6 +1718,35 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex) {
     return true;
 }
 
+bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex) {
+    // Use a cached copy if there is one, but do not cache blocks read in bulk (rescans, VerifyDB)
+    CCachedBlockRef pcached = blockcache.Get(pindex->GetBlockHash());
+    if (pcached) {
+        block = pcached->block;
+        return true;
+    }
+    return ReadBlockFromDiskUncached(block, pindex);
+}
+
+/**
+ * Whether blocks received or connected now are worth keeping in blockcache.
+ * During initial sync or a reindex nobody asks for them again, and they would
+ * only push the blocks peers do want out of the cache.
+ */
+static bool ShouldCacheBlocks() {
+    return !IsInitialBlockDownload() && !fReindex;
+}
+
+CCachedBlockRef ReadBlockCached(const CBlockIndex* pindex) {
+    CCachedBlockRef pcached = blockcache.Get(pindex->GetBlockHash());
+    if (pcached)
+        return pcached;
+    CBlock block;
+    if (!ReadBlockFromDiskUncached(block, pindex))
+        return CCachedBlockRef();
+    return blockcache.Add(pindex->GetBlockHash(), block);
+}
+
 double ConvertBitsToDouble(unsigned int nBits) {
     int nShift = (nBits >> 24) & 0xff;
 
@@ -1923,26 +2110,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
                 } else if (!check()) {
-                    if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
-                        // Check whether the failure was caused by a
-                        // non-mandatory script verification check, such as
-                        // non-standard DER encodings or non-null dummy
-                        // arguments; if so, don't trigger DoS protection to
-                        // avoid splitting the network between upgraded and
-                        // non-upgraded nodes.
-                        CScriptCheck check(*coins, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
-                        if (check())
-                            return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
-                    }
-                    // Failures of other flags indicate a transaction that is
-                    // invalid in new blocks, e.g. a invalid P2SH. We DoS ban
-                    // such nodes as they are not following the protocol. That
-                    // said during an upgrade careful thought should be taken
-                    // as to the correct behavior - we may want to continue
-                    // peering with non-upgraded nodes even after a soft-fork
-                    // super-majority vote has passed.
-                    return state.DoS(100, false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
+                    return ScriptCheckFailed(tx, state, *coins, i, flags, cacheStore, check.GetScriptError());
                 }
             }
         }
@@ -1951,7 +2119,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState& state, const CCoinsVi
     return true;
 }
 
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean) {
+bool DisconnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean) {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
     if (pfClean)
@@ -2061,13 +2229,43 @@ void static FlushBlockFile(bool fFinalize = false) {
 
 bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
-
 void ThreadScriptCheck() {
     RenameThread("nanucoin-scriptch");
     scriptcheckqueue.Thread();
 }
 
+// Inputs whose scripts were assumed valid, and the cost of the inputs verified after them
+static int nAssumedValidBlocks = 0;
+static int64_t nAssumedValidInputs = 0;
+static int64_t nVerifiedInputs = 0;
+static int64_t nTimeVerifiedInputs = 0;
+static const int64_t ASSUMEVALID_SAMPLE_INPUTS = 10000;
+
+bool IsAssumedValid(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (hashAssumeValid == 0)
+        return false;
+    BlockMap::const_iterator it = mapBlockIndex.find(hashAssumeValid);
+    if (pindexBestHeader == NULL)
+        return false;
+    const CBlockIndex* pindexAssumed = NULL;
+    if (it != mapBlockIndex.end()) {
+        pindexAssumed = it->second;
+    } else {
+        // Blocks fetched with getblocks are connected before the assumed block
+        // is indexed; until then, stand in the last indexed checkpoint below a
+        // checkpointed assumed block
+        int nAssumedHeight = Checkpoints::GetCheckpointHeight(hashAssumeValid);
+        pindexAssumed = Checkpoints::GetLastCheckpoint();
+        if (nAssumedHeight < 0 || pindexAssumed == NULL || pindexAssumed->nHeight > nAssumedHeight ||
+            pindexBestHeader->GetAncestor(pindexAssumed->nHeight) != pindexAssumed)
+            return false;
+    }
+    return pindexAssumed->GetAncestor(pindex->nHeight) == pindex &&
+           pindexBestHeader->GetAncestor(pindex->nHeight) == pindex;
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
@@ -2101,7 +2299,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 //        return state.DoS(100, error("ConnectBlock() : PoW period ended"),
 //            REJECT_INVALID, "PoW-ended"); //nanuchange
 
-    bool fScriptChecks = pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate();
+    bool fScriptChecks = !IsAssumedValid(pindex);
 
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // unless those are already completely spent.
@@ -2219,6 +2417,22 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     nTimeVerify += nTime2 - nTimeStart;
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs - 1), nTimeVerify * 0.000001);
 
+    if (!fJustCheck) {
+        if (!fScriptChecks) {
+            if (nAssumedValidBlocks++ == 0)
+                LogPrintf("ConnectBlock() : skipping script checks below assumed valid block %s\n", hashAssumeValid.ToString());
+            nAssumedValidInputs += nInputs - 1;
+        } else if (nAssumedValidInputs > 0 && nVerifiedInputs < ASSUMEVALID_SAMPLE_INPUTS) {
+            // Price the skipped inputs at the cost of the first ones verified after them
+            nVerifiedInputs += nInputs - 1;
+            nTimeVerifiedInputs += nTime2 - nTimeStart;
+            if (nVerifiedInputs >= ASSUMEVALID_SAMPLE_INPUTS)
+                LogPrintf("ConnectBlock() : assumed valid the scripts of %d txins in %d blocks, saving about %.2fs (at %.3fms/txin)\n",
+                    nAssumedValidInputs, nAssumedValidBlocks, 0.000001 * nTimeVerifiedInputs * nAssumedValidInputs / nVerifiedInputs,
+                    0.001 * nTimeVerifiedInputs / nVerifiedInputs);
+        }
+    }
+
     if (fJustCheck)
         return true;
 
@@ -2278,8 +2492,9 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode) {
     LOCK(cs_main);
     static int64_t nLastWrite = 0;
     try {
+        size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
         if ((mode == FLUSH_STATE_ALWAYS) ||
-                ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && pcoinsTip->GetCacheSize() > nCoinCacheSize) ||
+                ((mode == FLUSH_STATE_PERIODIC || mode == FLUSH_STATE_IF_NEEDED) && cacheSize > nCoinCacheUsage) ||
                 (mode == FLUSH_STATE_PERIODIC && GetTimeMicros() > nLastWrite + DATABASE_WRITE_INTERVAL * 1000000)) {
             // Typical CCoins structures on disk are around 100 bytes in size.
             // Pushing a new one to the database can cause it to be written
@@ -2337,10 +2552,10 @@ void static UpdateTip(CBlockIndex* pindexNew) {
     nTimeBestReceived = GetTime();
     mempool.AddTransactionsUpdated(1);
 
-    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%u\n",
+    LogPrintf("UpdateTip: new best=%s  height=%d  log2_work=%.8g  tx=%lu  date=%s progress=%f  cache=%.1fMiB(%utx)\n",
             chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(), log(chainActive.Tip()->nChainWork.getdouble()) / log(2.0), (unsigned long) chainActive.Tip()->nChainTx,
             DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
-            Checkpoints::GuessVerificationProgress(chainActive.Tip()), (unsigned int) pcoinsTip->GetCacheSize());
+            Checkpoints::GuessVerificationProgress(chainActive.Tip()), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1 << 20)), (unsigned int) pcoinsTip->GetCacheSize());
 
     cvBlockChange.notify_all();
 
@@ -2371,9 +2586,16 @@ bool static DisconnectTip(CValidationState& state) {
     assert(pindexDelete);
     mempool.check(pcoinsTip);
     // Read block from disk.
-    CBlock block;
-    if (!ReadBlockFromDisk(block, pindexDelete))
+    CBlock blockRead;
+    CCachedBlockRef pcached;
+    if (ShouldCacheBlocks()) {
+        pcached = ReadBlockCached(pindexDelete);
+        if (!pcached)
+            return state.Abort("Failed to read block");
+    } else if (!ReadBlockFromDisk(blockRead, pindexDelete)) {
         return state.Abort("Failed to read block");
+    }
+    const CBlock& block = pcached ? pcached->block : blockRead;
     // Apply the block atomically to the chain state.
     int64_t nStart = GetTimeMicros();
     {
@@ -2399,6 +2621,7 @@ bool static DisconnectTip(CValidationState& state) {
     mempool.check(pcoinsTip);
     // Update chainActive and related variables.
     UpdateTip(pindexDelete->pprev);
+    stakeModifierIndex.Disconnect(pindexDelete);
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
 
@@ -2408,6 +2631,242 @@ bool static DisconnectTip(CValidationState& state) {
     return true;
 }
 
+namespace {
+
+/**
+ * Warms pcoinsTip with the coins spent by blocks about to be connected.
+ * Worker threads read each queued block, split its distinct prevout txids
+ * into chunks and look them up in the chainstate DB, so the next blocks'
+ * lookups overlap the script checks of the one being connected. ConnectTip()
+ * merges the results right before connecting a block. Results are dropped if
+ * the chainstate was written since the block was queued, as they may be stale.
+ */
+class CCoinsPrefetcher
+{
+public:
+    CCoinsPrefetcher() : pcoinsdb(NULL), nThreadsRunning(0) {}
+
+    void Start(boost::thread_group& threadGroup, CCoinsViewDB* pcoinsdbIn, int nThreads);
+
+    /** Queue the block at pindex; pblock may already hold its data */
+    void Add(const CBlockIndex* pindex, const CBlock* pblock);
+
+    /** Wait for the lookups of pindex's block, if it was queued, and add them to cache */
+    void Merge(const CBlockIndex* pindex, CCoinsViewCache& cache);
+
+private:
+    //! Txids looked up by one task
+    static const size_t CHUNK_SIZE = 64;
+
+    struct Job {
+        int nHeight;
+        CDiskBlockPos pos;
+        uint64_t nWriteCount;
+        std::vector<uint256> vTxids;
+        std::vector<std::pair<uint256, CCoins> > vCoins;
+        //! Tasks not finished yet, counting the read of the block
+        unsigned int nPending;
+        bool fAbandoned;
+    };
+    typedef boost::shared_ptr<Job> JobRef;
+
+    struct Task {
+        JobRef job;
+        //! Range of job->vTxids to look up; the block still has to be read if fRead
+        size_t nBegin;
+        size_t nEnd;
+        bool fRead;
+
+        Task(const JobRef& jobIn, size_t nBeginIn, size_t nEndIn, bool fReadIn) : job(jobIn), nBegin(nBeginIn), nEnd(nEndIn), fRead(fReadIn) {}
+    };
+
+    boost::mutex mutex;
+    boost::condition_variable condWorker;
+    boost::condition_variable condDone;
+    std::deque<Task> queue;
+    std::map<uint256, JobRef> mapJobs;
+    CCoinsViewDB* pcoinsdb;
+    //! Worker threads not yet interrupted
+    int nThreadsRunning;
+
+    static void ListTxids(const CBlock& block, std::vector<uint256>& vTxids);
+    /** Queue lookups for job->vTxids in front of the queue; returns the number of tasks */
+    unsigned int QueueChunks(const JobRef& job);
+    void Thread();
+};
+
+void CCoinsPrefetcher::Start(boost::thread_group& threadGroup, CCoinsViewDB* pcoinsdbIn, int nThreads)
+{
+    pcoinsdb = pcoinsdbIn;
+    nThreadsRunning = nThreads;
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&CCoinsPrefetcher::Thread, this));
+}
+
+void CCoinsPrefetcher::ListTxids(const CBlock& block, std::vector<uint256>& vTxids)
+{
+    std::vector<uint256> vCreated;
+    vCreated.reserve(block.vtx.size());
+    BOOST_FOREACH (const CTransaction& tx, block.vtx)
+        vCreated.push_back(tx.GetHash());
+    std::sort(vCreated.begin(), vCreated.end());
+
+    BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+        if (tx.IsCoinBase())
+            continue;
+        BOOST_FOREACH (const CTxIn& txin, tx.vin) {
+            // Outputs of the block itself are not in the database yet
+            if (!std::binary_search(vCreated.begin(), vCreated.end(), txin.prevout.hash))
+                vTxids.push_back(txin.prevout.hash);
+        }
+    }
+    std::sort(vTxids.begin(), vTxids.end());
+    vTxids.erase(std::unique(vTxids.begin(), vTxids.end()), vTxids.end());
+}
+
+unsigned int CCoinsPrefetcher::QueueChunks(const JobRef& job)
+{
+    unsigned int nTasks = 0;
+    // Pushed in reverse so the chunks run in order, ahead of later blocks
+    for (size_t nEnd = job->vTxids.size(); nEnd > 0; nTasks++) {
+        size_t nBegin = nEnd > CHUNK_SIZE ? nEnd - CHUNK_SIZE : 0;
+        queue.push_front(Task(job, nBegin, nEnd, false));
+        nEnd = nBegin;
+    }
+    if (nTasks > 1)
+        condWorker.notify_all();
+    else if (nTasks == 1)
+        condWorker.notify_one();
+    return nTasks;
+}
+
+void CCoinsPrefetcher::Add(const CBlockIndex* pindex, const CBlock* pblock)
+{
+    AssertLockHeld(cs_main);
+    if (pcoinsdb == NULL || !(pindex->nStatus & BLOCK_HAVE_DATA))
+        return;
+    // A block that was just received is usually still cached; no need to read it again
+    CCachedBlockRef pcached;
+    if (!pblock && (pcached = blockcache.Get(pindex->GetBlockHash())))
+        pblock = &pcached->block;
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    // Forget blocks that were connected without a merge or left behind by a reorg
+    for (std::map<uint256, JobRef>::iterator it = mapJobs.begin(); it != mapJobs.end();) {
+        if (it->second->nHeight <= chainActive.Height()) {
+            it->second->fAbandoned = true;
+            mapJobs.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+    if (mapJobs.count(pindex->GetBlockHash()))
+        return;
+
+    JobRef job(new Job());
+    job->nHeight = pindex->nHeight;
+    job->pos = pindex->GetBlockPos();
+    job->nWriteCount = pcoinsdb->GetWriteCount();
+    job->fAbandoned = false;
+    mapJobs.insert(std::make_pair(pindex->GetBlockHash(), job));
+    if (pblock) {
+        ListTxids(*pblock, job->vTxids);
+        job->nPending = QueueChunks(job);
+    } else {
+        job->nPending = 1;
+        queue.push_back(Task(job, 0, 0, true));
+        condWorker.notify_one();
+    }
+}
+
+void CCoinsPrefetcher::Merge(const CBlockIndex* pindex, CCoinsViewCache& cache)
+{
+    JobRef job;
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::map<uint256, JobRef>::iterator it = mapJobs.find(pindex->GetBlockHash());
+        if (it == mapJobs.end())
+            return;
+        job = it->second;
+        mapJobs.erase(it);
+        // Whatever was found is still good if the workers are gone on shutdown
+        while (job->nPending > 0 && nThreadsRunning > 0)
+            condDone.wait(lock);
+        job->fAbandoned = true;
+    }
+
+    if (job->nWriteCount != pcoinsdb->GetWriteCount()) {
+        LogPrint("bench", "  - Prefetch: dropped %u coins after a chainstate write\n", job->vCoins.size());
+        return;
+    }
+    unsigned int nAdded = 0;
+    for (size_t i = 0; i < job->vCoins.size(); i++) {
+        if (cache.AddPrefetched(job->vCoins[i].first, job->vCoins[i].second))
+            nAdded++;
+    }
+    LogPrint("bench", "  - Prefetch: %u of %u inputs found, %u not cached yet\n", job->vCoins.size(), job->vTxids.size(), nAdded);
+}
+
+void CCoinsPrefetcher::Thread()
+{
+    RenameThread("nanucoin-prefetch");
+    while (true) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        try {
+            while (queue.empty())
+                condWorker.wait(lock);
+        } catch (const boost::thread_interrupted&) {
+            nThreadsRunning--;
+            condDone.notify_all();
+            throw;
+        }
+        Task task = queue.front();
+        queue.pop_front();
+        Job& job = *task.job;
+        bool fAbandoned = job.fAbandoned;
+        lock.unlock();
+
+        if (task.fRead) {
+            CBlock block;
+            std::vector<uint256> vTxids;
+            if (!fAbandoned && ReadBlockFromDisk(block, job.pos))
+                ListTxids(block, vTxids);
+            lock.lock();
+            job.vTxids.swap(vTxids);
+            job.nPending += QueueChunks(task.job);
+        } else {
+            std::vector<std::pair<uint256, CCoins> > vFound;
+            try {
+                if (!fAbandoned)
+                    pcoinsdb->GetCoins(job.vTxids, task.nBegin, task.nEnd, vFound);
+            } catch (const std::exception& e) {
+                // ConnectBlock will run into the same error and handle it
+                LogPrintf("%s : %s\n", __func__, e.what());
+            }
+            lock.lock();
+            for (size_t i = 0; i < vFound.size(); i++) {
+                job.vCoins.push_back(std::make_pair(vFound[i].first, CCoins()));
+                job.vCoins.back().second.swap(vFound[i].second);
+            }
+        }
+        if (--job.nPending == 0)
+            condDone.notify_all();
+    }
+}
+
+CCoinsPrefetcher coinsPrefetcher;
+
+} // anon namespace
+
+void StartCoinsPrefetch(boost::thread_group& threadGroup, CCoinsViewDB* pcoinsdb)
+{
+    int nThreads = std::max(0, (int)GetArg("-prefetchthreads", DEFAULT_PREFETCH_THREADS));
+    if (nThreads == 0)
+        return;
+    LogPrintf("Using %d threads to prefetch coins of blocks being connected\n", nThreads);
+    coinsPrefetcher.Start(threadGroup, pcoinsdb, nThreads);
+}
+
 static int64_t nTimeReadFromDisk = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
@@ -2418,24 +2877,33 @@ static int64_t nTimePostConnect = 0;
  * Connect a new block to chainActive. pblock is either NULL or a pointer to a CBlock
  * corresponding to pindexNew, to bypass loading it again from disk.
  */
-bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock* pblock) {
+bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, const CBlock* pblock) {
     assert(pindexNew->pprev == chainActive.Tip());
     mempool.check(pcoinsTip);
     CCoinsViewCache view(pcoinsTip);
 
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
-    CBlock block;
+    CBlock blockRead;
+    CCachedBlockRef pcached;
     if (!pblock) {
-        if (!ReadBlockFromDisk(block, pindexNew))
-            return state.Abort("Failed to read block");
-        pblock = &block;
+        if (ShouldCacheBlocks()) {
+            pcached = ReadBlockCached(pindexNew);
+            if (!pcached)
+                return state.Abort("Failed to read block");
+            pblock = &pcached->block;
+        } else {
+            if (!ReadBlockFromDisk(blockRead, pindexNew))
+                return state.Abort("Failed to read block");
+            pblock = &blockRead;
+        }
     }
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros();
     nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    coinsPrefetcher.Merge(pindexNew, *pcoinsTip);
     {
         CInv inv(MSG_BLOCK, pindexNew->GetBlockHash());
         bool rv = ConnectBlock(*pblock, state, pindexNew, view);
@@ -2471,6 +2939,7 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     mempool.check(pcoinsTip);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
+    stakeModifierIndex.Connect(pindexNew);
     // Tell wallet about transactions that went from mempool
     // to conflicted:
 
@@ -2680,6 +3149,14 @@ static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMo
         }
         nHeight = nTargetHeight;
 
+        // Start looking up the coins of the next blocks while the first ones connect
+        int nPrefetch = 0;
+        BOOST_REVERSE_FOREACH(CBlockIndex* pindexPrefetch, vpindexToConnect) {
+            if (nPrefetch++ == MAX_PREFETCH_BLOCKS)
+                break;
+            coinsPrefetcher.Add(pindexPrefetch, pindexPrefetch == pindexMostWork ? pblock : NULL);
+        }
+
         // Connect new blocks.
 
         BOOST_REVERSE_FOREACH(CBlockIndex* pindexConnect, vpindexToConnect) {
@@ -2762,6 +3239,7 @@ bool ActivateBestChain(CValidationState& state, CBlock* pblock) {
                     pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
             }
             // Notify external listeners about the new tip.
+            g_signals.UpdatedBlockTip(pindexNewTip);
             uiInterface.NotifyBlockTip(hashNewTip);
         }
     } while (pindexMostWork != chainActive.Tip());
@@ -2778,6 +3256,10 @@ bool ActivateBestChain(CValidationState& state, CBlock* pblock) {
 bool InvalidateBlock(CValidationState& state, CBlockIndex* pindex) {
     AssertLockHeld(cs_main);
 
+    if (pindexSnapshotBase && pindexSnapshotBase->GetAncestor(pindex->nHeight) == pindex)
+        return state.Invalid(error("%s : block %s is part of the UTXO snapshot", __func__, pindex->GetBlockHash().ToString()),
+            REJECT_INVALID, "block-in-utxo-snapshot");
+
     // Mark the block itself as invalid.
     pindex->nStatus |= BLOCK_FAILED_VALID;
     setDirtyBlockIndex.insert(pindex);
@@ -2858,10 +3340,6 @@ CBlockIndex* AddToBlockIndex(const CBlock& block) {
     pindexNew->nSequenceId = 0;
     BlockMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
 
-    //mark as PoS seen
-    if (pindexNew->IsProofOfStake())
-        setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
-
     pindexNew->phashBlock = &((*mi).first);
     BlockMap::iterator miPrev = mapBlockIndex.find(block.hashPrevBlock);
     if (miPrev != mapBlockIndex.end()) {
@@ -2881,9 +3359,13 @@ CBlockIndex* AddToBlockIndex(const CBlock& block) {
 
         // ppcoin: record proof-of-stake hash value
         if (pindexNew->IsProofOfStake()) {
-            if (!mapProofOfStake.count(hash))
+            boost::unordered_map<uint256, uint256, BlockHasher>::iterator itPoS = mapProofOfStake.find(hash);
+            if (itPoS == mapProofOfStake.end()) {
                 LogPrintf("AddToBlockIndex() : hashProofOfStake not found in map \n");
-            pindexNew->hashProofOfStake = mapProofOfStake[hash];
+            } else {
+                pindexNew->hashProofOfStake = itPoS->second;
+                mapProofOfStake.erase(itPoS);
+            }
         }
 
         // ppcoin: compute stake modifier
@@ -2896,6 +3378,7 @@ CBlockIndex* AddToBlockIndex(const CBlock& block) {
         if (!CheckStakeModifierCheckpoints(pindexNew->nHeight, pindexNew->nStakeModifierChecksum))
             LogPrintf("AddToBlockIndex() : Rejected by stake modifier checkpoint height=%d, modifier=%s \n", pindexNew->nHeight, boost::lexical_cast<std::string>(nStakeModifier));
     }
+
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
     if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexNew->nChainWork)
@@ -2979,6 +3462,7 @@ bool FindBlockPos(CValidationState& state, CDiskBlockPos& pos, unsigned int nAdd
     }
 
     nLastBlockFile = nFile;
+    blockFileMapper.SetFinishedFiles(nLastBlockFile);
     vinfoBlockFile[nFile].AddBlock(nHeight, nTime);
     if (fKnown)
         vinfoBlockFile[nFile].nSize = std::max(pos.nPos + nAddSize, vinfoBlockFile[nFile].nSize);
@@ -3172,7 +3656,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
     return true;
 }
 
-bool CheckWork(const CBlock block, CBlockIndex * const pindexPrev) {
+bool CheckWork(const CBlock& block, CBlockIndex * const pindexPrev) {
     if (pindexPrev == NULL)
         return error("%s : null pindexPrev for block %s", __func__, block.GetHash().ToString().c_str());
 
@@ -3220,6 +3704,12 @@ bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& sta
     if (chainActive.Height() - nHeight >= Params().MaxReorganizationDepth())
         return state.DoS(1, error("%s: forked chain older than max reorganization depth (height %d)", __func__, nHeight));
 
+    // The chain below a loaded UTXO snapshot can not be disconnected, and
+    // known headers never get here, so any header at or below it is a fork
+    if (pindexSnapshotBase && (nHeight <= pindexSnapshotBase->nHeight || pindexPrev->GetAncestor(pindexSnapshotBase->nHeight) != pindexSnapshotBase))
+        return state.DoS(100, error("%s : forked chain older than the UTXO snapshot (height %d)", __func__, nHeight),
+            REJECT_INVALID, "bad-fork-prior-to-snapshot");
+
     // Check timestamp against prev
     if (block.GetBlockTime() <= pindexPrev->GetMedianTimePast()) {
         LogPrintf("Block time = %d , GetMedianTimePast = %d \n", block.GetBlockTime(), pindexPrev->GetMedianTimePast());
@@ -3317,7 +3807,10 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
     if (block.GetHash() != Params().HashGenesisBlock() && !CheckWork(block, pindexPrev))
         return false;
 
-    if (!AcceptBlockHeader(block, state, &pindex))
+    bool fHeaderAccepted = AcceptBlockHeader(block, state, &pindex);
+    // Left over if the header was already indexed or got rejected
+    mapProofOfStake.erase(block.GetHash());
+    if (!fHeaderAccepted)
         return false;
 
     if (pindex->nStatus & BLOCK_HAVE_DATA) {
@@ -3349,6 +3842,10 @@ bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex** ppindex,
                 return state.Abort("Failed to write block");
         if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
             return error("AcceptBlock() : ReceivedBlockTransactions failed");
+        // Peers will ask for a block we just received; imported ones, and
+        // those of the initial sync, are not worth keeping
+        if (dbp == NULL && ShouldCacheBlocks())
+            blockcache.Add(pindex->GetBlockHash(), block);
     } catch (std::runtime_error& e) {
         return state.Abort(std::string("System error: ") + e.what());
     }
@@ -3407,12 +3904,6 @@ bool ProcessNewBlock(CValidationState& state, CNode* pfrom, CBlock* pblock, CDis
     // Preliminary checks
     bool checked = CheckBlock(*pblock, state);
 
-    // ppcoin: check proof-of-stake
-    // Limited duplicity on stake: prevents block flood attack
-    // Duplicate stake allowed only when there is orphan child block
-    //if (pblock->IsProofOfStake() && setStakeSeen.count(pblock->GetProofOfStake())/* && !mapOrphanBlocksByPrev.count(hash)*/)
-    //    return error("ProcessNewBlock() : duplicate proof-of-stake (%s, %d) for block %s", pblock->GetProofOfStake().first.ToString().c_str(), pblock->GetProofOfStake().second, pblock->GetHash().ToString().c_str());
-
     // NovaCoin: check proof-of-stake block signature
     if (!pblock->CheckBlockSignature())
         return error("ProcessNewBlock() : bad proof-of-stake block signature");
@@ -3565,16 +4056,78 @@ CBlockIndex* InsertBlockIndex(uint256 hash) {
     if (!pindexNew)
         throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
-
-    //mark as PoS seen
-    if (pindexNew->IsProofOfStake())
-        setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
-
     pindexNew->phashBlock = &((*mi).first);
 
     return pindexNew;
 }
 
+static void ThreadVerifyBlockIndex(boost::shared_ptr<const std::vector<CBlockIndex*> > pvIndex, int nThread, int nThreads)
+{
+    RenameThread("nanucoin-idxverify");
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+
+    // Header fields of loaded index entries are never modified, so no lock is needed
+    const std::vector<CBlockIndex*>& vIndex = *pvIndex;
+    std::vector<CBlockHeader> vHeaders;
+    std::vector<CBlockHeader*> vpHeaders;
+    std::vector<const CBlockIndex*> vpBatch;
+    for (size_t i = nThread; i < vIndex.size(); i += nThreads * XEVAN_MAX_BATCH) {
+        boost::this_thread::interruption_point();
+
+        // Hash this thread's next XEVAN_MAX_BATCH entries in one batch
+        vHeaders.clear();
+        vpBatch.clear();
+        for (size_t j = i; j < vIndex.size() && vpBatch.size() < XEVAN_MAX_BATCH; j += nThreads) {
+            vpBatch.push_back(vIndex[j]);
+            vHeaders.push_back(vIndex[j]->GetBlockHeader());
+        }
+        vpHeaders.clear();
+        for (size_t j = 0; j < vHeaders.size(); j++)
+            vpHeaders.push_back(&vHeaders[j]);
+        PrecomputeBlockHashes(vpHeaders);
+
+        for (size_t j = 0; j < vpBatch.size(); j++) {
+            const CBlockIndex* pindex = vpBatch[j];
+            uint256 hash = vHeaders[j].GetHash();
+            if (hash != pindex->GetBlockHash()) {
+                AbortNode(strprintf("Block index entry %s has header hash %s", pindex->GetBlockHash().ToString(), hash.ToString()),
+                    _("Corrupted block database detected") + ". " + _("Please restart with -reindex to recover."));
+                return;
+            }
+            if (pindex->IsProofOfWork() && !CheckProofOfWork(hash, pindex->nBits)) {
+                AbortNode(strprintf("Block index entry %s fails CheckProofOfWork", pindex->GetBlockHash().ToString()),
+                    _("Corrupted block database detected") + ". " + _("Please restart with -reindex to recover."));
+                return;
+            }
+        }
+    }
+    LogPrint("bench", "%s : thread %d done\n", __func__, nThread);
+}
+
+void StartBlockIndexVerification(boost::thread_group& threadGroup)
+{
+    if (!GetBoolArg("-verifyblockhashes", DEFAULT_VERIFY_BLOCK_HASHES))
+        return;
+
+    boost::shared_ptr<std::vector<CBlockIndex*> > pvIndex(new std::vector<CBlockIndex*>());
+    {
+        LOCK(cs_main);
+        pvIndex->reserve(mapBlockIndex.size());
+        BOOST_FOREACH (const PAIRTYPE(const uint256, CBlockIndex*) & item, mapBlockIndex) {
+            // Entries only referenced as a predecessor/successor have no header yet
+            if (item.second->nTime != 0)
+                pvIndex->push_back(item.second);
+        }
+    }
+    if (pvIndex->empty())
+        return;
+
+    int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), MAX_SCRIPTCHECK_THREADS));
+    LogPrintf("Verifying %u block index hashes in the background using %d threads\n", pvIndex->size(), nThreads);
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&ThreadVerifyBlockIndex, pvIndex, i, nThreads));
+}
+
 bool static LoadBlockIndexDB() {
     if (!pblocktree->LoadBlockIndexGuts())
         return false;
@@ -3594,7 +4147,7 @@ bool static LoadBlockIndexDB() {
     BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*) & item, vSortedByHeight) {
         CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
-        if (pindex->nStatus & BLOCK_HAVE_DATA) {
+        if (pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_SNAPSHOT)) {
             if (pindex->pprev) {
                 if (pindex->pprev->nChainTx) {
                     pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
@@ -3618,6 +4171,7 @@ bool static LoadBlockIndexDB() {
 
     // Load block file info
     pblocktree->ReadLastBlockFile(nLastBlockFile);
+    blockFileMapper.SetFinishedFiles(nLastBlockFile);
     vinfoBlockFile.resize(nLastBlockFile + 1);
     LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
     for (int nFile = 0; nFile <= nLastBlockFile; nFile++) {
@@ -3690,7 +4244,11 @@ bool static LoadBlockIndexDB() {
         }
 
         //set the chain to the block before lastMeta so that the meta block will be seen as new
-        chainActive.SetTip(pindexLastMeta->pprev);
+        {
+            LOCK(cs_main);
+            chainActive.SetTip(pindexLastMeta->pprev);
+            stakeModifierIndex.Sync();
+        }
 
         //Process the lastMetaBlock again, using the known location on disk
         CDiskBlockPos blockPos = pindexLastMeta->GetBlockPos();
@@ -3740,6 +4298,16 @@ bool static LoadBlockIndexDB() {
     pblocktree->ReadReindexing(fReindexing);
     fReindex |= fReindexing;
 
+    // Check whether the chain starts from a UTXO snapshot
+    uint256 hashSnapshotBase;
+    if (pblocktree->ReadSnapshotBase(hashSnapshotBase)) {
+        BlockMap::iterator mi = mapBlockIndex.find(hashSnapshotBase);
+        if (mi == mapBlockIndex.end())
+            return error("%s : UTXO snapshot block %s is not in the block index", __func__, hashSnapshotBase.ToString());
+        pindexSnapshotBase = mi->second;
+        LogPrintf("LoadBlockIndexDB(): UTXO snapshot at height %d\n", pindexSnapshotBase->nHeight);
+    }
+
     // Check whether we have a transaction index
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("LoadBlockIndexDB(): transaction index %s\n", fTxIndex ? "enabled" : "disabled");
@@ -3751,7 +4319,11 @@ bool static LoadBlockIndexDB() {
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
         return true;
-    chainActive.SetTip(it->second);
+    {
+        LOCK(cs_main);
+        chainActive.SetTip(it->second);
+        stakeModifierIndex.Sync();
+    }
 
     PruneBlockIndexCandidates();
 
@@ -3793,6 +4365,9 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
         uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int) (((double) (chainActive.Height() - pindex->nHeight)) / (double) nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
         if (pindex->nHeight < chainActive.Height() - nCheckDepth)
             break;
+        // Blocks below a loaded UTXO snapshot have no data to check
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            break;
         CBlock block;
         // check level 0: read from disk
         if (!ReadBlockFromDisk(block, pindex))
@@ -3810,7 +4385,7 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.GetCacheSize() + pcoinsTip->GetCacheSize()) <= nCoinCacheSize) {
+        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
             if (!DisconnectBlock(block, state, pindex, coins, &fClean))
                 return error("VerifyDB() : *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
@@ -3848,10 +4423,13 @@ bool CVerifyDB::VerifyDB(CCoinsView* coinsview, int nCheckLevel, int nCheckDepth
 }
 
 void UnloadBlockIndex() {
+    LOCK(cs_main);
     mapBlockIndex.clear();
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
+    stakeModifierIndex.Sync();
     pindexBestInvalid = NULL;
+    pindexSnapshotBase = NULL;
 }
 
 bool LoadBlockIndex() {
@@ -3899,6 +4477,419 @@ bool InitBlockIndex() {
     return true;
 }
 
+//! Version of the UTXO snapshot file format
+static const int UTXO_SNAPSHOT_VERSION = 1;
+//! Block index entries written to the block tree database per batch when loading a snapshot
+static const size_t UTXO_SNAPSHOT_INDEX_BATCH = 10000;
+
+/**
+ * A UTXO snapshot is a sequence of length-prefixed records, each added to a
+ * running SHA256d checksum:
+ * - the header: network magic, format version, tip hash, tip height and the number of blocks
+ * - one record per block of the active chain from genesis to the tip: hash and CDiskBlockIndex,
+ *   which includes the stake modifier and proof-of-stake fields
+ * - one record per transaction with unspent outputs: txid and CCoins, then an empty record
+ * - the number of transactions and unspent outputs
+ * The checksum follows, outside of any record. It commits to the whole file,
+ * so an operator can pin the value printed by dumptxoutset.
+ */
+static void WriteSnapshotRecord(CAutoFile& fileout, CHashWriter& hasher, const CDataStream& ssRecord)
+{
+    std::string strRecord = ssRecord.str();
+    fileout << strRecord;
+    hasher << strRecord;
+}
+
+static void ReadSnapshotRecord(CAutoFile& filein, CHashWriter& hasher, CDataStream& ssRecord)
+{
+    std::string strRecord;
+    filein >> strRecord;
+    hasher << strRecord;
+    ssRecord.clear();
+    ssRecord.write(strRecord.data(), strRecord.size());
+}
+
+bool DumpUTXOSnapshot(const boost::filesystem::path& path, CUTXOSnapshotInfo& info, std::string& strError)
+{
+    if (boost::filesystem::exists(path)) {
+        strError = path.string() + " already exists";
+        return false;
+    }
+    CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull()) {
+        strError = "Cannot open " + path.string() + " for writing";
+        return false;
+    }
+
+    CHashWriter hasher(SER_GETHASH, 0);
+    CDataStream ssRecord(SER_DISK, CLIENT_VERSION);
+    boost::scoped_ptr<CCoinsViewDBCursor> pcursor;
+    try {
+        {
+            // The block index and a database cursor are taken at the same tip;
+            // the coins are then streamed out without holding cs_main
+            LOCK(cs_main);
+            CValidationState state;
+            if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+                strError = "Failed to flush the chain state";
+                return false;
+            }
+            CBlockIndex* pindexTip = chainActive.Tip();
+            info.hashBlock = pindexTip->GetBlockHash();
+            info.nHeight = pindexTip->nHeight;
+            ssRecord << FLATDATA(Params().MessageStart()) << UTXO_SNAPSHOT_VERSION << info.hashBlock << info.nHeight << (uint64_t)(info.nHeight + 1);
+            WriteSnapshotRecord(fileout, hasher, ssRecord);
+            for (int nHeight = 0; nHeight <= pindexTip->nHeight; nHeight++) {
+                CBlockIndex* pindex = chainActive[nHeight];
+                ssRecord.clear();
+                ssRecord << pindex->GetBlockHash() << CDiskBlockIndex(pindex);
+                WriteSnapshotRecord(fileout, hasher, ssRecord);
+            }
+            pcursor.reset(pcoinsdbview->Cursor());
+        }
+
+        uint256 txid;
+        CCoins coins;
+        while (pcursor->Next(txid, coins)) {
+            boost::this_thread::interruption_point();
+            ssRecord.clear();
+            ssRecord << txid << coins;
+            WriteSnapshotRecord(fileout, hasher, ssRecord);
+            info.nTransactions++;
+            BOOST_FOREACH (const CTxOut& out, coins.vout) {
+                if (!out.IsNull())
+                    info.nOutputs++;
+            }
+        }
+        ssRecord.clear();
+        WriteSnapshotRecord(fileout, hasher, ssRecord);
+        ssRecord << info.nTransactions << info.nOutputs;
+        WriteSnapshotRecord(fileout, hasher, ssRecord);
+        info.hashSnapshot = hasher.GetHash();
+        fileout << info.hashSnapshot;
+    } catch (std::exception& e) {
+        fileout.fclose();
+        boost::filesystem::remove(path);
+        strError = strprintf("Error writing the snapshot: %s", e.what());
+        return false;
+    }
+    LogPrintf("Wrote UTXO snapshot at block %s (height %d): %u transactions, %u outputs, checksum %s\n",
+        info.hashBlock.ToString(), info.nHeight, info.nTransactions, info.nOutputs, info.hashSnapshot.ToString());
+    return true;
+}
+
+/** Read a snapshot's header record and check that it is for this network */
+static bool ReadSnapshotHeader(CAutoFile& filein, CHashWriter& hasher, CUTXOSnapshotInfo& info, uint64_t& nBlocks, std::string& strError)
+{
+    CDataStream ssRecord(SER_DISK, CLIENT_VERSION);
+    ReadSnapshotRecord(filein, hasher, ssRecord);
+    unsigned char pchMagic[MESSAGE_START_SIZE];
+    int nVersion;
+    ssRecord >> FLATDATA(pchMagic) >> nVersion >> info.hashBlock >> info.nHeight >> nBlocks;
+    if (memcmp(pchMagic, Params().MessageStart(), MESSAGE_START_SIZE) != 0) {
+        strError = "The snapshot is for a different network";
+        return false;
+    }
+    if (nVersion != UTXO_SNAPSHOT_VERSION) {
+        strError = strprintf("Unsupported snapshot version %d", nVersion);
+        return false;
+    }
+    if (info.nHeight < 1 || nBlocks != (uint64_t)info.nHeight + 1) {
+        strError = "The snapshot header is invalid";
+        return false;
+    }
+    return true;
+}
+
+/** Read a whole snapshot without changing anything: check its structure and its checksum */
+static bool CheckUTXOSnapshot(const boost::filesystem::path& path, const uint256& hashExpected, CUTXOSnapshotInfo& info, std::string& strError)
+{
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        strError = "Cannot open " + path.string();
+        return false;
+    }
+    CHashWriter hasher(SER_GETHASH, 0);
+    CDataStream ssRecord(SER_DISK, CLIENT_VERSION);
+    try {
+        uint64_t nBlocks;
+        if (!ReadSnapshotHeader(filein, hasher, info, nBlocks, strError))
+            return false;
+        uint256 hashPrev = 0;
+        for (uint64_t nHeight = 0; nHeight < nBlocks; nHeight++) {
+            boost::this_thread::interruption_point();
+            ReadSnapshotRecord(filein, hasher, ssRecord);
+            uint256 hash;
+            CDiskBlockIndex diskindex;
+            ssRecord >> hash >> diskindex;
+            if ((uint64_t)diskindex.nHeight != nHeight || diskindex.hashPrev != hashPrev ||
+                (nHeight == 0 && hash != Params().HashGenesisBlock())) {
+                strError = strprintf("The snapshot's block index is not a chain at height %d", (int)nHeight);
+                return false;
+            }
+            // The hash a record is filed under has to be the hash of its header
+            if (diskindex.ComputeBlockHash() != hash) {
+                strError = strprintf("The snapshot's block index entry at height %d does not match its hash", (int)nHeight);
+                return false;
+            }
+            // Chain work is taken from the claimed nBits, so they have to be met
+            if (nHeight > 0 && (nHeight <= (uint64_t)Params().LAST_POW_BLOCK() || diskindex.IsProofOfWork()) && !CheckProofOfWork(hash, diskindex.nBits)) {
+                strError = strprintf("The snapshot's block at height %d fails CheckProofOfWork", (int)nHeight);
+                return false;
+            }
+            if (!Checkpoints::CheckBlock(nHeight, hash)) {
+                strError = strprintf("The snapshot's block at height %d does not match the checkpoint", (int)nHeight);
+                return false;
+            }
+            hashPrev = hash;
+        }
+        if (hashPrev != info.hashBlock) {
+            strError = "The snapshot's block index does not end at its tip";
+            return false;
+        }
+        uint64_t nTransactions = 0, nOutputs = 0;
+        while (true) {
+            boost::this_thread::interruption_point();
+            ReadSnapshotRecord(filein, hasher, ssRecord);
+            if (ssRecord.empty())
+                break;
+            uint256 txid;
+            CCoins coins;
+            ssRecord >> txid >> coins;
+            nTransactions++;
+            BOOST_FOREACH (const CTxOut& out, coins.vout) {
+                if (!out.IsNull())
+                    nOutputs++;
+            }
+        }
+        ReadSnapshotRecord(filein, hasher, ssRecord);
+        ssRecord >> info.nTransactions >> info.nOutputs;
+        filein >> info.hashSnapshot;
+        if (nTransactions != info.nTransactions || nOutputs != info.nOutputs) {
+            strError = "The snapshot is truncated";
+            return false;
+        }
+    } catch (std::exception& e) {
+        strError = strprintf("Error reading the snapshot: %s", e.what());
+        return false;
+    }
+    if (hasher.GetHash() != info.hashSnapshot) {
+        strError = "The snapshot checksum does not match its contents";
+        return false;
+    }
+    if (info.hashSnapshot != hashExpected) {
+        strError = strprintf("The snapshot checksum %s is not the expected %s", info.hashSnapshot.ToString(), hashExpected.ToString());
+        return false;
+    }
+    return true;
+}
+
+/** Whether a block index entry the node already had agrees with the snapshot's record of it */
+static bool SnapshotIndexMatches(const CBlockIndex* pindex, const CDiskBlockIndex& diskindex)
+{
+    return pindex->nHeight == diskindex.nHeight &&
+           pindex->nVersion == diskindex.nVersion &&
+           pindex->hashMerkleRoot == diskindex.hashMerkleRoot &&
+           pindex->nTime == diskindex.nTime &&
+           pindex->nBits == diskindex.nBits &&
+           pindex->nNonce == diskindex.nNonce &&
+           pindex->nStakeModifier == diskindex.nStakeModifier &&
+           pindex->GeneratedStakeModifier() == diskindex.GeneratedStakeModifier() &&
+           pindex->prevoutStake == diskindex.prevoutStake &&
+           pindex->nStakeTime == diskindex.nStakeTime;
+}
+
+/**
+ * Once loading has started the databases and mapBlockIndex hold part of the
+ * snapshot; shut down so the rollback on restart is the only way forward.
+ */
+static bool AbortSnapshotLoad(std::string& strError, std::string strReason)
+{
+    strError = strReason + "; shutting down to roll back";
+    return AbortNode("Failed to load UTXO snapshot: " + strReason,
+        _("Error: Loading the UTXO snapshot failed, see debug.log for details. Restart to roll it back."));
+}
+
+bool LoadUTXOSnapshot(const boost::filesystem::path& path, const uint256& hashExpected, CUTXOSnapshotInfo& info, std::string& strError)
+{
+    // The coins are taken on trust, so only a file the caller has vouched for
+    if (hashExpected == 0) {
+        strError = "A snapshot can only be loaded with its expected checksum";
+        return false;
+    }
+    {
+        LOCK(cs_main);
+        if (chainActive.Height() != 0) {
+            strError = "A snapshot can only be loaded by a node without blocks beyond genesis";
+            return false;
+        }
+        // The transactions below the snapshot would be missing from the index
+        if (fTxIndex) {
+            strError = "A snapshot can not be loaded with -txindex; restart with -txindex=0";
+            return false;
+        }
+    }
+    // Checked in full first, so a bad file leaves the databases untouched
+    LogPrintf("Checking UTXO snapshot %s...\n", path.string());
+    if (!CheckUTXOSnapshot(path, hashExpected, info, strError))
+        return false;
+
+    LOCK(cs_main);
+    if (chainActive.Height() != 0) {
+        strError = "A snapshot can only be loaded by a node without blocks beyond genesis";
+        return false;
+    }
+    CValidationState state;
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+        strError = "Failed to flush the chain state";
+        return false;
+    }
+
+    LogPrintf("Loading UTXO snapshot at block %s (height %d)...\n", info.hashBlock.ToString(), info.nHeight);
+    int64_t nStart = GetTimeMillis();
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        strError = "Cannot open " + path.string();
+        return false;
+    }
+    // The index and coins go to the databases in several batches before the
+    // best block moves; until the flag is cleared a restart rolls them back
+    if (!pblocktree->WriteFlag("snapshotloading", true) || !pblocktree->Sync()) {
+        strError = "Failed to write to the block index database";
+        return false;
+    }
+
+    CHashWriter hasher(SER_GETHASH, 0);
+    CDataStream ssRecord(SER_DISK, CLIENT_VERSION);
+    CBlockIndex* pindexTip = NULL;
+    try {
+        uint64_t nBlocks;
+        if (!ReadSnapshotHeader(filein, hasher, info, nBlocks, strError))
+            return AbortSnapshotLoad(strError, strError);
+
+        // The snapshot vouches for the blocks below its tip: they become
+        // valid index entries without block data
+        std::vector<CBlockIndex*> vIndex;
+        for (uint64_t nHeight = 0; nHeight < nBlocks; nHeight++) {
+            boost::this_thread::interruption_point();
+            ReadSnapshotRecord(filein, hasher, ssRecord);
+            uint256 hash;
+            CDiskBlockIndex diskindex;
+            ssRecord >> hash >> diskindex;
+            if (nHeight == 0) {
+                pindexTip = chainActive.Genesis();
+                continue;
+            }
+            CBlockIndex* pindexNew;
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
+            if (mi == mapBlockIndex.end()) {
+                pindexNew = InsertBlockIndex(hash);
+                pindexNew->nFile = 0;
+                pindexNew->nDataPos = 0;
+                pindexNew->nUndoPos = 0;
+                pindexNew->nStatus = BLOCK_VALID_SCRIPTS | BLOCK_SNAPSHOT;
+                pindexNew->pprev = pindexTip;
+                pindexNew->nHeight = diskindex.nHeight;
+                pindexNew->nVersion = diskindex.nVersion;
+                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+                pindexNew->nTime = diskindex.nTime;
+                pindexNew->nBits = diskindex.nBits;
+                pindexNew->nNonce = diskindex.nNonce;
+                pindexNew->nStakeModifier = diskindex.nStakeModifier;
+                pindexNew->prevoutStake = diskindex.prevoutStake;
+                pindexNew->nStakeTime = diskindex.nStakeTime;
+                pindexNew->BuildSkip();
+            } else {
+                // A header or block received earlier keeps its data and undo
+                // positions, and what the node worked out for it must agree
+                pindexNew = mi->second;
+                if (pindexNew->nStatus & BLOCK_FAILED_MASK) {
+                    return AbortSnapshotLoad(strError, strprintf("The snapshot's chain contains block %s, which this node found invalid", hash.ToString()));
+                }
+                if (pindexNew->pprev != pindexTip || !SnapshotIndexMatches(pindexNew, diskindex)) {
+                    return AbortSnapshotLoad(strError, strprintf("The snapshot's entry for block %s differs from this node's", hash.ToString()));
+                }
+                pindexNew->RaiseValidity(BLOCK_VALID_SCRIPTS);
+                if (!(pindexNew->nStatus & BLOCK_HAVE_DATA))
+                    pindexNew->nStatus |= BLOCK_SNAPSHOT;
+            }
+            pindexNew->nTx = diskindex.nTx;
+            pindexNew->nChainTx = pindexTip->nChainTx + diskindex.nTx;
+            pindexNew->nChainWork = pindexTip->nChainWork + GetBlockProof(*pindexNew);
+
+            //Proof Of Stake
+            pindexNew->nMint = diskindex.nMint;
+            pindexNew->nMoneySupply = diskindex.nMoneySupply;
+            pindexNew->nFlags = diskindex.nFlags;
+
+            pindexTip = pindexNew;
+            vIndex.push_back(pindexNew);
+            if (vIndex.size() >= UTXO_SNAPSHOT_INDEX_BATCH || nHeight + 1 == nBlocks) {
+                if (!pblocktree->WriteBlockIndex(vIndex)) {
+                    return AbortSnapshotLoad(strError, "Failed to write the block index");
+                }
+                vIndex.clear();
+            }
+        }
+
+        // Coins go to the database in batches the size of the coins cache
+        CCoinsMap mapCoins;
+        size_t nBatchUsage = 0;
+        while (true) {
+            boost::this_thread::interruption_point();
+            ReadSnapshotRecord(filein, hasher, ssRecord);
+            if (ssRecord.empty())
+                break;
+            uint256 txid;
+            ssRecord >> txid;
+            CCoinsCacheEntry& entry = mapCoins[txid];
+            ssRecord >> entry.coins;
+            entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+            nBatchUsage += entry.coins.DynamicMemoryUsage();
+            if (nBatchUsage + mapCoins.DynamicMemoryUsage() > nCoinCacheUsage) {
+                if (!pcoinsdbview->BatchWrite(mapCoins, uint256(0))) {
+                    return AbortSnapshotLoad(strError, "Failed to write the coins database");
+                }
+                mapCoins.clear();
+                nBatchUsage = 0;
+            }
+        }
+        ReadSnapshotRecord(filein, hasher, ssRecord);
+        uint256 hashSnapshot;
+        filein >> hashSnapshot;
+        if (hasher.GetHash() != hashSnapshot || hashSnapshot != info.hashSnapshot) {
+            return AbortSnapshotLoad(strError, "The snapshot changed while it was being loaded");
+        }
+        if (!pcoinsdbview->BatchWrite(mapCoins, info.hashBlock)) {
+            return AbortSnapshotLoad(strError, "Failed to write the coins database");
+        }
+    } catch (std::exception& e) {
+        return AbortSnapshotLoad(strError, strprintf("Error loading the snapshot: %s", e.what()));
+    }
+
+    pcoinsTip->SetBestBlock(info.hashBlock);
+    chainActive.SetTip(pindexTip);
+    stakeModifierIndex.Sync();
+    if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexTip->nChainWork)
+        pindexBestHeader = pindexTip;
+    setBlockIndexCandidates.insert(pindexTip);
+    PruneBlockIndexCandidates();
+    mempool.clear();
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS)) {
+        return AbortSnapshotLoad(strError, "Failed to flush the chain state");
+    }
+    pindexSnapshotBase = pindexTip;
+    if (!pblocktree->WriteSnapshotBase(info.hashBlock) || !pblocktree->WriteFlag("snapshotloading", false) || !pblocktree->Sync()) {
+        return AbortSnapshotLoad(strError, "Failed to write to the block index database");
+    }
+    LogPrintf("Loaded UTXO snapshot: %u transactions, %u outputs in %dms\n", info.nTransactions, info.nOutputs, GetTimeMillis() - nStart);
+    CheckBlockIndex();
+
+    g_signals.UpdatedBlockTip(pindexTip);
+    uiInterface.NotifyBlockTip(info.hashBlock);
+    return true;
+}
+
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp) {
     // Map of disk positions for blocks with unknown parent (only used for reindex)
     static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
@@ -3942,6 +4933,7 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp) {
                 CBlock block;
                 blkdat >> block;
                 nRewind = blkdat.GetPos();
+                block.SetCachedHash(block.ComputeHash());
 
                 // detect out of order blocks, and store them for later
                 uint256 hash = block.GetHash();
@@ -4039,7 +5031,9 @@ void static CheckBlockIndex() {
     while (pindex != NULL) {
         nNodes++;
         if (pindexFirstInvalid == NULL && pindex->nStatus & BLOCK_FAILED_VALID) pindexFirstInvalid = pindex;
-        if (pindexFirstMissing == NULL && !(pindex->nStatus & BLOCK_HAVE_DATA)) pindexFirstMissing = pindex;
+        // Blocks below a loaded UTXO snapshot count as having data: the snapshot vouches for them
+        bool fHaveData = pindex->nStatus & (BLOCK_HAVE_DATA | BLOCK_SNAPSHOT);
+        if (pindexFirstMissing == NULL && !fHaveData) pindexFirstMissing = pindex;
         if (pindex->pprev != NULL && pindexFirstNotTreeValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotScriptsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
@@ -4051,7 +5045,7 @@ void static CheckBlockIndex() {
             assert(pindex == chainActive.Genesis()); // The current active chain's genesis block must be this block.
         }
         // HAVE_DATA is equivalent to VALID_TRANSACTIONS and equivalent to nTx > 0 (we stored the number of transactions in the block)
-        assert(!(pindex->nStatus & BLOCK_HAVE_DATA) == (pindex->nTx == 0));
+        assert(!fHaveData == (pindex->nTx == 0));
         assert(((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS) == (pindex->nTx > 0));
         if (pindex->nChainTx == 0) assert(pindex->nSequenceId == 0); // nSequenceId can't be set for blocks that aren't linked
         // All parents having data is equivalent to all parents being VALID_TRANSACTIONS, which is equivalent to nChainTx being set.
@@ -4085,7 +5079,7 @@ void static CheckBlockIndex() {
             }
             rangeUnlinked.first++;
         }
-        if (pindex->pprev && pindex->nStatus & BLOCK_HAVE_DATA && pindexFirstMissing != NULL) {
+        if (pindex->pprev && fHaveData && pindexFirstMissing != NULL) {
             if (pindexFirstInvalid == NULL) { // If this block has block data available, some parent doesn't, and has no invalid parents, it must be in mapBlocksUnlinked.
                 assert(foundInUnlinked);
             }
@@ -4280,7 +5274,7 @@ void static ProcessGetData(CNode* pfrom) {
             if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK) {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end()) {
+                if (mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA)) {
                     if (chainActive.Contains(mi->second)) {
                         send = true;
                     } else {
@@ -4295,14 +5289,22 @@ void static ProcessGetData(CNode* pfrom) {
                     }
                 }
                 if (send) {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
+                    if (inv.type == MSG_BLOCK) {
+                        // Send the serialized block as is, from the cache or else straight from disk
+                        CCachedBlockRef pcached = blockcache.Get(inv.hash);
+                        if (pcached) {
+                            pfrom->PushMessageRaw("block", &pcached->vRaw[0], pcached->vRaw.size());
+                        } else {
+                            std::vector<char> vRaw;
+                            if (!ReadRawBlockFromDisk(vRaw, (*mi).second))
+                                assert(!"cannot load block from disk");
+                            pfrom->PushMessageRaw("block", &vRaw[0], vRaw.size());
+                        }
+                    } else // MSG_FILTERED_BLOCK)
                     {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            assert(!"cannot load block from disk");
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
                             CMerkleBlock merkleBlock(block, *pfrom->pfilter);
@@ -4966,6 +5968,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Hash the whole message in batches before taking cs_main
+        std::vector<CBlockHeader*> vpHeaders;
+        vpHeaders.reserve(headers.size());
+        BOOST_FOREACH (CBlockHeader& header, headers)
+            vpHeaders.push_back(&header);
+        PrecomputeBlockHashes(vpHeaders);
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -5011,6 +6020,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     {
         CBlock block;
         vRecv >> block;
+        block.SetCachedHash(block.ComputeHash());
         uint256 hashBlock = block.GetHash();
         CInv inv(MSG_BLOCK, hashBlock);
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
@@ -5619,18 +6629,31 @@ bool CBlockUndo::WriteToDisk(CDiskBlockPos& pos, const uint256& hashBlock) {
 }
 
 bool CBlockUndo::ReadFromDisk(const CDiskBlockPos& pos, const uint256& hashBlock) {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("CBlockUndo::ReadFromDisk : OpenBlockFile failed");
-
-    // Read block
     uint256 hashChecksum;
-    try {
-        filein >> *this;
-        filein >> hashChecksum;
-    } catch (std::exception& e) {
-        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+    CMappedFileRef pmap;
+    unsigned int nSize;
+    const char* pch = MapDiskRecord(pmap, pos, true, sizeof(hashChecksum), nSize);
+    if (pch) {
+        try {
+            CBufferReader reader(pch, nSize + sizeof(hashChecksum), SER_DISK, CLIENT_VERSION);
+            reader >> *this;
+            reader >> hashChecksum;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize error - %s", __func__, e.what());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("CBlockUndo::ReadFromDisk : OpenBlockFile failed");
+
+        // Read block
+        try {
+            filein >> *this;
+            filein >> hashChecksum;
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
     }
 
     // Verify checksum
@@ -13,6 +13,8 @@
 #endif
 
 #include "amount.h"
+#include "blockcache.h"
+#include "blockfilemap.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "coins.h"
@@ -42,12 +44,15 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewDB;
 class CBloomFilter;
 class CInv;
 class CScriptCheck;
 class CValidationInterface;
 class CValidationState;
 
+struct CUTXOSnapshotInfo;
+
 struct CBlockTemplate;
 struct CNodeStateStats;
 
@@ -82,6 +87,20 @@ static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** -blockcache default (megabytes of recent blocks kept in memory) */
+static const unsigned int DEFAULT_BLOCK_CACHE_SIZE = 32;
+/**
+ * -mapblockfiles default (read finished block and undo files through memory
+ * mappings). Off, as a disk read error or a truncated file then raises SIGBUS
+ * instead of failing the read.
+ */
+static const bool DEFAULT_MAP_BLOCK_FILES = false;
+/** -verifyblockhashes default (re-hash the loaded block index in the background) */
+static const bool DEFAULT_VERIFY_BLOCK_HASHES = true;
+/** -prefetchthreads default (threads reading the coins of blocks about to be connected, 0 = off) */
+static const int DEFAULT_PREFETCH_THREADS = 4;
+/** Blocks ahead of the tip whose coins are prefetched */
+static const int MAX_PREFETCH_BLOCKS = 8;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -132,7 +151,13 @@ extern int nScriptCheckThreads;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
+/** Recently accepted and connected blocks */
+extern CBlockCache blockcache;
+/** Memory mappings of finished block and undo files */
+extern CBlockFileMapper blockFileMapper;
+/** Scripts of this block and its ancestors are assumed valid and not checked; 0 checks everything */
+extern uint256 hashAssumeValid;
 extern CFeeRate minRelayTxFee;
 extern bool fAlerts;
 
@@ -146,7 +171,6 @@ extern int64_t nReserveBalance;
 
 extern std::map<uint256, int64_t> mapRejectedBlocks;
 extern std::map<unsigned int, unsigned int> mapHashedBlocks;
-extern std::set<std::pair<COutPoint, unsigned int> > setStakeSeen;
 
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex* pindexBestHeader;
@@ -190,12 +214,27 @@ FILE* OpenUndoFile(const CDiskBlockPos& pos, bool fReadOnly = false);
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos& pos, const char* prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos* dbp = NULL);
+/** Write the coins database and the active chain's block index to a UTXO snapshot file */
+bool DumpUTXOSnapshot(const boost::filesystem::path& path, CUTXOSnapshotInfo& info, std::string& strError);
+/**
+ * Bootstrap a node that has no blocks beyond genesis from a UTXO snapshot file.
+ * The whole file is checked first and its checksum must be hashExpected, which is required.
+ * Refused while fTxIndex is set, as the index would lack the pre-snapshot transactions.
+ * A load that fails partway shuts the node down; the next startup rolls it back with a reindex.
+ * Once loaded, headers forking below the snapshot's tip are rejected as invalid.
+ * Takes cs_main only once the file has been checked, so callers must not hold it.
+ */
+bool LoadUTXOSnapshot(const boost::filesystem::path& path, const uint256& hashExpected, CUTXOSnapshotInfo& info, std::string& strError);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex();
 /** Load the block tree and coins database from disk */
 bool LoadBlockIndex();
 /** Unload database information */
 void UnloadBlockIndex();
+/** Re-hash the loaded block index and check proof-of-work on background threads */
+void StartBlockIndexVerification(boost::thread_group& threadGroup);
+/** Start the threads warming pcoinsTip from pcoinsdb ahead of block connection */
+void StartCoinsPrefetch(boost::thread_group& threadGroup, CCoinsViewDB* pcoinsdb);
 /** See whether the protocol update is enforced for connected nodes */
 int ActiveProtocol();
 /** Process protocol messages received from a given node */
@@ -410,6 +449,7 @@ public:
     }
 
     ScriptError GetScriptError() const { return error; }
+    unsigned int GetInputIndex() const { return nIn; }
 };
 
 
@@ -417,6 +457,12 @@ public:
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read the serialized block at pos as stored on disk, which is also its network serialization */
+bool ReadRawBlockFromDisk(std::vector<char>& vRaw, const CDiskBlockPos& pos);
+/** The same for the block of pindex, checking that it starts with the header the index holds */
+bool ReadRawBlockFromDisk(std::vector<char>& vRaw, const CBlockIndex* pindex);
+/** Get a block from the block cache, reading it from disk and caching it on a miss; empty on failure */
+CCachedBlockRef ReadBlockCached(const CBlockIndex* pindex);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -425,7 +471,7 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
  *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+bool DisconnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
 
 /** Reprocess a number of blocks to try and get on the correct chain again **/
 bool DisconnectBlocksAndReprocess(int blocks);
@@ -433,10 +479,16 @@ bool DisconnectBlocksAndReprocess(int blocks);
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false);
 
+/** Whether ConnectBlock may skip the scripts of pindex: it must be an ancestor both of the
+ *  -assumevalid block and of the best header, so a competing chain that does not build on the
+ *  assumed block is always verified in full. Until a checkpointed assumed block is indexed,
+ *  the last indexed checkpoint below it takes its place. */
+bool IsAssumedValid(const CBlockIndex* pindex);
+
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true, bool fCheckSig = true);
-bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev);
+bool CheckWork(const CBlock& block, CBlockIndex* const pindexPrev);
 
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex* pindexPrev);
@@ -580,6 +632,18 @@ public:
     std::string GetRejectReason() const { return strRejectReason; }
 };
 
+/** What a UTXO snapshot file holds, see DumpUTXOSnapshot() */
+struct CUTXOSnapshotInfo {
+    uint256 hashBlock;
+    int nHeight;
+    uint64_t nTransactions;
+    uint64_t nOutputs;
+    //! Checksum of the whole file
+    uint256 hashSnapshot;
+
+    CUTXOSnapshotInfo() : hashBlock(0), nHeight(0), nTransactions(0), nOutputs(0), hashSnapshot(0) {}
+};
+
 /** RAII wrapper for VerifyDB: Verify consistency of the block and coin databases */
 class CVerifyDB
 {
@@ -604,6 +668,9 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache* pcoinsTip;
 
+/** Global variable that points to the coins database under pcoinsTip (protected by cs_main) */
+extern CCoinsViewDB* pcoinsdbview;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB* pblocktree;
 
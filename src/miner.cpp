@@ -11,6 +11,7 @@
 #include "script/sign.h" // nanuchange
 
 #include "amount.h"
+#include "crypto/common.h"
 #include "hash.h"
 #include "main.h"
 #include "masternode-sync.h"
@@ -26,6 +27,10 @@
 #endif
 #include "masternode-payments.h"
 
+#include <deque>
+
+#include <boost/atomic.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 
@@ -410,8 +415,305 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
 //
 // Internal miner
 //
-double dHashesPerSec = 0.0;
-int64_t nHPSTimerStart = 0;
+
+/**
+ * Hash counters of one PoW worker thread. Only the owning worker writes them,
+ * so readers never contend with the search loop.
+ */
+struct CMinerThreadStats {
+    boost::atomic<uint64_t> nHashes;
+    boost::atomic<int64_t> nHashesPerSec;
+    boost::atomic<int64_t> nRateTime;
+
+    CMinerThreadStats() : nHashes(0), nHashesPerSec(0), nRateTime(0) {}
+};
+
+static CCriticalSection cs_minerStats;
+static std::vector<boost::shared_ptr<CMinerThreadStats> > vMinerStats;
+
+void GetMinerHashesPerSec(std::vector<int64_t>& vRates)
+{
+    LOCK(cs_minerStats);
+    vRates.clear();
+    int64_t nNow = GetTimeMillis();
+    BOOST_FOREACH (const boost::shared_ptr<CMinerThreadStats>& stats, vMinerStats) {
+        if (nNow - stats->nRateTime.load(boost::memory_order_relaxed) > 8000)
+            vRates.push_back(0);
+        else
+            vRates.push_back(stats->nHashesPerSec.load(boost::memory_order_relaxed));
+    }
+}
+
+CNonceSlice::CNonceSlice(unsigned int nThread, unsigned int nThreads)
+{
+    nBegin = ((uint64_t)nThread << 32) / nThreads;
+    nEnd = ((uint64_t)(nThread + 1) << 32) / nThreads;
+    nNext = nBegin;
+}
+
+bool CNonceSlice::Take(unsigned int nCount, uint32_t& nFirst)
+{
+    if (nNext + nCount > nEnd)
+        return false;
+    nFirst = nNext;
+    nNext += nCount;
+    return true;
+}
+
+CTimingHistogram::CTimingHistogram() : nCount(0), nTotalMicros(0), nMaxMicros(0)
+{
+    for (int i = 0; i < BUCKETS; i++)
+        vBuckets[i] = 0;
+}
+
+void CTimingHistogram::Add(int64_t nMicros)
+{
+    nMicros = max(nMicros, (int64_t)0);
+    int nBucket = 0;
+    while (nBucket < BUCKETS - 1 && (nMicros >> nBucket))
+        nBucket++;
+    vBuckets[nBucket].fetch_add(1, boost::memory_order_relaxed);
+    nCount.fetch_add(1, boost::memory_order_relaxed);
+    nTotalMicros.fetch_add(nMicros, boost::memory_order_relaxed);
+    int64_t nMax = nMaxMicros.load(boost::memory_order_relaxed);
+    while (nMicros > nMax && !nMaxMicros.compare_exchange_weak(nMax, nMicros, boost::memory_order_relaxed))
+        ;
+}
+
+CStakingMetrics::CStakingMetrics() : nUTXOs(0), nHashes(0), nLastPassUTXOs(0), nLastPassHashes(0), nLastPassMicros(0), nKernels(0), nBlocksAccepted(0), nBlocksRejected(0) {}
+
+void CStakingMetrics::AddPass(int64_t nMicros, uint64_t nPassUTXOs, uint64_t nPassHashes)
+{
+    passTime.Add(nMicros);
+    nUTXOs.fetch_add(nPassUTXOs, boost::memory_order_relaxed);
+    nHashes.fetch_add(nPassHashes, boost::memory_order_relaxed);
+    nLastPassUTXOs.store(nPassUTXOs, boost::memory_order_relaxed);
+    nLastPassHashes.store(nPassHashes, boost::memory_order_relaxed);
+    nLastPassMicros.store(nMicros, boost::memory_order_relaxed);
+}
+
+CStakingMetrics stakingMetrics;
+
+static const unsigned int MAX_TRACKED_STAKES = 1000;
+static CCriticalSection cs_stakedBlocks;
+static std::deque<uint256> dequeStakedBlocks;
+
+void RecordStakedBlock(const uint256& hash)
+{
+    LOCK(cs_stakedBlocks);
+    dequeStakedBlocks.push_back(hash);
+    if (dequeStakedBlocks.size() > MAX_TRACKED_STAKES)
+        dequeStakedBlocks.pop_front();
+}
+
+int CountOrphanedStakes(int& nTracked)
+{
+    std::deque<uint256> dequeCopy;
+    {
+        LOCK(cs_stakedBlocks);
+        dequeCopy = dequeStakedBlocks;
+    }
+
+    LOCK(cs_main);
+    int nOrphaned = 0;
+    BOOST_FOREACH(const uint256& hash, dequeCopy) {
+        BlockMap::iterator mi = mapBlockIndex.find(hash);
+        if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second))
+            nOrphaned++;
+    }
+    nTracked = dequeCopy.size();
+    return nOrphaned;
+}
+
+/**
+ * Hands the header of the current block template from the template builder
+ * to the PoW worker threads. Every worker sweeps its own slice of the nonce
+ * space and the extranonce only ever changes in the builder, so no two
+ * workers hash the same header.
+ */
+class CMinerJobQueue
+{
+private:
+    CWaitableCriticalSection cs;
+    CConditionVariable condWorkers;
+    CConditionVariable condBuilder;
+
+    CBlockHeader header;
+    CBlockIndex* pindexPrev;
+    bool fActive;
+    bool fSolved;
+    bool fExhausted;
+    CBlockHeader headerSolved;
+
+    //! Bumped on every publish or retract so workers can poll it without the lock
+    boost::atomic<unsigned int> nJobId;
+
+public:
+    CMinerJobQueue() : pindexPrev(NULL), fActive(false), fSolved(false), fExhausted(false), nJobId(0) {}
+
+    void Publish(const CBlockHeader& headerIn, CBlockIndex* pindexPrevIn)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        header = headerIn;
+        pindexPrev = pindexPrevIn;
+        fActive = true;
+        fSolved = false;
+        fExhausted = false;
+        nJobId++;
+        condWorkers.notify_all();
+    }
+
+    /** Stop the workers hashing the current header, e.g. once it is stale */
+    void Retract()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fActive = false;
+        nJobId++;
+    }
+
+    /** Block until a job other than nJob is published and return it */
+    void Fetch(CBlockHeader& headerOut, CBlockIndex*& pindexPrevOut, unsigned int& nJob)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (!fActive || nJobId == nJob)
+            condWorkers.wait(lock);
+        headerOut = header;
+        pindexPrevOut = pindexPrev;
+        nJob = nJobId;
+    }
+
+    bool IsCurrent(unsigned int nJob) const
+    {
+        return nJobId.load(boost::memory_order_relaxed) == nJob;
+    }
+
+    void Submit(unsigned int nJob, const CBlockHeader& headerIn)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (nJob != nJobId || fSolved)
+            return;
+        headerSolved = headerIn;
+        fSolved = true;
+        condBuilder.notify_all();
+    }
+
+    /** A worker ran out of nonces; ask the builder for a new extranonce */
+    void Exhausted(unsigned int nJob)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (nJob != nJobId)
+            return;
+        fExhausted = true;
+        condBuilder.notify_all();
+    }
+
+    /**
+     * Wait up to nMilliseconds for a worker to solve the current job. Returns
+     * true with the solved header, false on timeout or when the nonce space
+     * of the current job has run out (fExhaustedOut).
+     */
+    bool WaitForSolution(CBlockHeader& headerOut, bool& fExhaustedOut, int64_t nMilliseconds)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (!fSolved && !fExhausted)
+            condBuilder.timed_wait(lock, boost::posix_time::milliseconds(nMilliseconds));
+        fExhaustedOut = fExhausted;
+        if (!fSolved)
+            return false;
+        headerOut = headerSolved;
+        fActive = false;
+        nJobId++;
+        return true;
+    }
+};
+
+/**
+ * Wakes the stake minter as soon as something that changes the outcome of a
+ * stake attempt happens: a new tip, a wallet transaction or the wallet being
+ * locked or unlocked. Timed waits cover the next eligible timestamp slot.
+ * A new tip also calls off a kernel search that is still running.
+ */
+class CStakeScheduler : public CValidationInterface
+{
+private:
+    CWallet* pwallet;
+    boost::signals2::connection connTransaction;
+    boost::signals2::connection connStatus;
+
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    bool fEvent;
+    bool fWalletChanged;
+    const CBlockIndex* pindexTip;
+    int64_t nTipTimeMicros;
+
+    void Notify(bool fWallet)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fEvent = true;
+        fWalletChanged |= fWallet;
+        cond.notify_all();
+    }
+
+    void NotifyTransactionChanged(CWallet* wallet, const uint256& hash, ChangeType status) { Notify(true); }
+    void NotifyStatusChanged(CCryptoKeyStore* wallet) { Notify(true); }
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindex)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            pindexTip = pindex;
+            nTipTimeMicros = GetTimeMicros();
+        }
+        nStakeTipUpdates++;
+        Notify(false);
+    }
+
+public:
+    CStakeScheduler(CWallet* pwalletIn) : pwallet(pwalletIn), fEvent(false), fWalletChanged(true), pindexTip(NULL), nTipTimeMicros(0)
+    {
+        RegisterValidationInterface(this);
+        connTransaction = pwallet->NotifyTransactionChanged.connect(boost::bind(&CStakeScheduler::NotifyTransactionChanged, this, _1, _2, _3));
+        connStatus = pwallet->NotifyStatusChanged.connect(boost::bind(&CStakeScheduler::NotifyStatusChanged, this, _1));
+    }
+
+    ~CStakeScheduler()
+    {
+        connStatus.disconnect();
+        connTransaction.disconnect();
+        UnregisterValidationInterface(this);
+    }
+
+    /** Sleep until nTimeMillis (GetTimeMillis() clock) or the next event */
+    void WaitUntil(int64_t nTimeMillis)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (!fEvent) {
+            int64_t nNow = GetTimeMillis();
+            if (nNow >= nTimeMillis)
+                break;
+            cond.timed_wait(lock, boost::posix_time::milliseconds(nTimeMillis - nNow));
+        }
+        fEvent = false;
+    }
+
+    /** When pindex was announced as the new tip, 0 if it was not seen */
+    int64_t GetTipTime(const CBlockIndex* pindex)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        return pindex == pindexTip ? nTipTimeMicros : 0;
+    }
+
+    /** Whether the wallet changed since the last call */
+    bool WalletChanged()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        bool fChanged = fWalletChanged;
+        fWalletChanged = false;
+        return fChanged;
+    }
+};
 
 CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey, CWallet* pwallet, bool fProofOfStake) {
     CPubKey pubkey;
@@ -454,7 +756,7 @@ bool fGenerateBitcoins = false;
 
 // ***TODO*** that part changed in bitcoin, we are using a mix with old one here for now
 
-void BitcoinMiner(CWallet* pwallet, bool fProofOfStake) {
+void BitcoinMiner(CWallet* pwallet, bool fProofOfStake, CMinerJobQueue* pjobs) {
     LogPrintf("NanuCoinMiner started\n");
     SetThreadPriority(THREAD_PRIORITY_LOWEST);
     RenameThread("nanucoin-miner");
@@ -467,42 +769,49 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake) {
     static bool fMintableCoins = false;
     static int nMintableLastCheck = 0;
 
-    if (fProofOfStake && (GetTime() - nMintableLastCheck > 5 * 60)) // 5 minute check time
-    {
-        nMintableLastCheck = GetTime();
-        fMintableCoins = pwallet->MintableCoins();
-    }
+    boost::scoped_ptr<CStakeScheduler> scheduler;
+    const CBlockIndex* pindexLastStake = NULL;
+    int64_t nLastStakeTime = 0;
+    if (fProofOfStake)
+        scheduler.reset(new CStakeScheduler(pwallet));
 
     while (fGenerateBitcoins || fProofOfStake) {
         if (fProofOfStake) {
             if (chainActive.Tip()->nHeight < Params().LAST_POW_BLOCK()) {
-                MilliSleep(5000);
+                scheduler->WaitUntil(GetTimeMillis() + 60 * 1000);
                 continue;
             } //nanuchange
 
-            while (chainActive.Tip()->nTime < 1471482000 || vNodes.empty() || pwallet->IsLocked() || !fMintableCoins || nReserveBalance >= pwallet->GetBalance() || !masternodeSync.IsSynced()) {
+            // Recheck for mintable coins whenever the wallet changes, and once a minute while there are none
+            if (scheduler->WalletChanged() || (!fMintableCoins && GetTime() - nMintableLastCheck > 1 * 60)) {
+                nMintableLastCheck = GetTime();
+                fMintableCoins = pwallet->MintableCoins();
+            }
+
+            if (chainActive.Tip()->nTime < 1471482000 || vNodes.empty() || pwallet->IsLocked() || !fMintableCoins || nReserveBalance >= pwallet->GetBalance() || !masternodeSync.IsSynced()) {
                 nLastCoinStakeSearchInterval = 0;
-                // Do a separate 1 minute check here to ensure fMintableCoins is updated 
-                if (!fMintableCoins) { 
-                    if (GetTime() - nMintableLastCheck > 1 * 60) // 1 minute check time 
-                    { 
-                        nMintableLastCheck = GetTime(); 
-                        fMintableCoins = pwallet->MintableCoins(); 
-                    } 
-                }
-                MilliSleep(5000);
-                if (!fGenerateBitcoins && !fProofOfStake)
-                    continue;
+                // Peers and masternode sync raise no event, so they are still polled
+                scheduler->WaitUntil(GetTimeMillis() + 5000);
+                continue;
             }
 
-            if (mapHashedBlocks.count(chainActive.Tip()->nHeight)) //search our map of hashed blocks, see if bestblock has been hashed yet
-            {
-                if (GetTime() - mapHashedBlocks[chainActive.Tip()->nHeight] < max(pwallet->nHashInterval, (unsigned int) 1)) // wait half of the nHashDrift with max wait of 3 minutes
-                {
-                    MilliSleep(5000);
-                    continue;
-                }
+            // Stake on a new tip as soon as it arrives, then again every nHashInterval,
+            // but never at a time the network would not accept on top of the tip
+            const CBlockIndex* pindexTip = chainActive.Tip();
+            int64_t nNextStakeTime = (pindexTip->nTime + 1 - GetTimeOffset()) * 1000;
+            if (pindexTip == pindexLastStake)
+                nNextStakeTime = max(nNextStakeTime, nLastStakeTime + max(pwallet->nHashInterval, (unsigned int) 1) * 1000);
+            if (GetTimeMillis() < nNextStakeTime) {
+                scheduler->WaitUntil(nNextStakeTime);
+                continue;
+            }
+            if (pindexTip != pindexLastStake) {
+                int64_t nTipTime = scheduler->GetTipTime(pindexTip);
+                if (nTipTime)
+                    stakingMetrics.tipLatency.Add(GetTimeMicros() - nTipTime);
             }
+            pindexLastStake = pindexTip;
+            nLastStakeTime = GetTimeMillis();
         }
 
         //
@@ -531,7 +840,12 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake) {
 
             LogPrintf("CPUMiner : proof-of-stake block was signed %s \n", pblock->GetHash().ToString().c_str());
             SetThreadPriority(THREAD_PRIORITY_NORMAL);
-            ProcessBlockFound(pblock, *pwallet, reservekey);
+            if (ProcessBlockFound(pblock, *pwallet, reservekey)) {
+                stakingMetrics.nBlocksAccepted++;
+                RecordStakedBlock(pblock->GetHash());
+            } else {
+                stakingMetrics.nBlocksRejected++;
+            }
             SetThreadPriority(THREAD_PRIORITY_LOWEST);
 
             continue;
@@ -541,94 +855,149 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake) {
                 ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
 
         //
-        // Search
+        // Search: the worker threads hash the header, we only watch for a
+        // solution or for the template going stale
         //
+        assert(pjobs);
         int64_t nStart = GetTime();
-        uint256 hashTarget = uint256().SetCompact(pblock->nBits);
+        pjobs->Publish(pblock->GetBlockHeader(), pindexPrev);
         while (true) {
-            unsigned int nHashesDone = 0;
-
-            uint256 hash;
-            while (true) {
-                hash = pblock->GetHash();
-                if (hash <= hashTarget) {
-                    // Found a solution
-                    SetThreadPriority(THREAD_PRIORITY_NORMAL);
-                    LogPrintf("BitcoinMiner:\n");
-                    LogPrintf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", hash.GetHex(), hashTarget.GetHex());
-                    ProcessBlockFound(pblock, *pwallet, reservekey);
-                    SetThreadPriority(THREAD_PRIORITY_LOWEST);
-
-                    // In regression test mode, stop mining after a block is found. This
-                    // allows developers to controllably generate a block on demand.
-                    if (Params().MineBlocksOnDemand())
-                        throw boost::thread_interrupted();
+            CBlockHeader header;
+            bool fExhausted = false;
+            if (pjobs->WaitForSolution(header, fExhausted, 250)) {
+                // Found a solution
+                pblock->nTime = header.nTime;
+                pblock->nBits = header.nBits;
+                pblock->nNonce = header.nNonce;
+                SetThreadPriority(THREAD_PRIORITY_NORMAL);
+                LogPrintf("BitcoinMiner:\n");
+                LogPrintf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", pblock->GetHash().GetHex(), uint256().SetCompact(pblock->nBits).GetHex());
+                ProcessBlockFound(pblock, *pwallet, reservekey);
+                SetThreadPriority(THREAD_PRIORITY_LOWEST);
+
+                // In regression test mode, stop mining after a block is found. This
+                // allows developers to controllably generate a block on demand.
+                if (Params().MineBlocksOnDemand())
+                    throw boost::thread_interrupted();
+
+                break;
+            }
 
+            // Check for stop or if block needs to be rebuilt
+            boost::this_thread::interruption_point();
+            // Regtest mode doesn't require peers
+            bool fNoPeers = vNodes.empty() && Params().MiningRequiresPeers();
+            if (fExhausted || fNoPeers ||
+                (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60) ||
+                pindexPrev != chainActive.Tip()) {
+                // Keep the workers off the stale header while the template is rebuilt
+                pjobs->Retract();
+                if (fNoPeers)
+                    MilliSleep(1000);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * PoW worker: hash headers published by the template builder, sweeping the
+ * nonce slice [nThread, nThread + 1) * 2^32 / nThreads.
+ */
+void static ThreadPoWWorker(boost::shared_ptr<CMinerJobQueue> jobs, unsigned int nThread, unsigned int nThreads, boost::shared_ptr<CMinerThreadStats> stats)
+{
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    RenameThread("nanucoin-pow");
+
+    CXevanHasher hasher;
+    unsigned char batch[XEVAN_MAX_BATCH][CXevanHasher::HEADER_SIZE];
+    const unsigned char* pinput[XEVAN_MAX_BATCH];
+    uint32_t nonces[XEVAN_MAX_BATCH];
+    uint256 hashes[XEVAN_MAX_BATCH];
+    for (unsigned int i = 0; i < XEVAN_MAX_BATCH; i++)
+        pinput[i] = batch[i];
+    int64_t nTimerStart = GetTimeMillis();
+    uint64_t nTimerHashes = 0;
+    unsigned int nJob = 0;
+
+    try {
+        while (true) {
+            CBlockHeader header;
+            CBlockIndex* pindexPrev;
+            jobs->Fetch(header, pindexPrev, nJob);
+            CNonceSlice slice(nThread, nThreads);
+            uint256 hashTarget = uint256().SetCompact(header.nBits);
+
+            while (jobs->IsCurrent(nJob)) {
+                uint32_t nFirst;
+                if (!slice.Take(256, nFirst)) {
+                    jobs->Exhausted(nJob);
                     break;
                 }
-                pblock->nNonce += 1;
-                nHashesDone += 1;
-                if ((pblock->nNonce & 0xFF) == 0)
-                    break;
-            }
 
-            // Meter hashes/sec
-            static int64_t nHashCounter;
-            if (nHPSTimerStart == 0) {
-                nHPSTimerStart = GetTimeMillis();
-                nHashCounter = 0;
-            } else
-                nHashCounter += nHashesDone;
-            if (GetTimeMillis() - nHPSTimerStart > 4000) {
-                static CCriticalSection cs;
-                {
-                    LOCK(cs);
-                    if (GetTimeMillis() - nHPSTimerStart > 4000) {
-                        dHashesPerSec = 1000.0 * nHashCounter / (GetTimeMillis() - nHPSTimerStart);
-                        nHPSTimerStart = GetTimeMillis();
-                        nHashCounter = 0;
-                        static int64_t nLogTime;
-                        if (GetTime() - nLogTime > 30 * 60) {
-                            nLogTime = GetTime();
-                            LogPrintf("hashmeter %6.0f khash/s\n", dHashesPerSec / 1000.0);
+                // Only nNonce varies until nTime is updated below
+                for (unsigned int i = 0; i < XEVAN_MAX_BATCH; i++)
+                    memcpy(batch[i], BEGIN(header.nVersion), CXevanHasher::HEADER_SIZE);
+                bool fFound = false;
+                unsigned int nHashesDone = 0;
+                while (nHashesDone < 256 && !fFound) {
+                    for (unsigned int i = 0; i < XEVAN_MAX_BATCH; i++) {
+                        nonces[i] = nFirst + nHashesDone + i;
+                        WriteLE32(batch[i] + CXevanHasher::HEADER_SIZE - 4, nonces[i]);
+                    }
+                    hasher.HashFixed<CXevanHasher::HEADER_SIZE>(pinput, hashes, XEVAN_MAX_BATCH);
+                    nHashesDone += XEVAN_MAX_BATCH;
+                    for (unsigned int i = 0; i < XEVAN_MAX_BATCH && !fFound; i++) {
+                        if (hashes[i] <= hashTarget) {
+                            header.nNonce = nonces[i];
+                            fFound = true;
                         }
                     }
                 }
-            }
 
-            // Check for stop or if block needs to be rebuilt
-            boost::this_thread::interruption_point();
-            // Regtest mode doesn't require peers
-            if (vNodes.empty() && Params().MiningRequiresPeers())
-                break;
-            if (pblock->nNonce >= 0xffff0000)
-                break;
-            if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
-                break;
-            if (pindexPrev != chainActive.Tip())
-                break;
+                // Meter hashes/sec
+                stats->nHashes.fetch_add(nHashesDone, boost::memory_order_relaxed);
+                nTimerHashes += nHashesDone;
+                int64_t nNow = GetTimeMillis();
+                if (nNow - nTimerStart > 4000) {
+                    stats->nHashesPerSec.store(1000 * nTimerHashes / (nNow - nTimerStart), boost::memory_order_relaxed);
+                    stats->nRateTime.store(nNow, boost::memory_order_relaxed);
+                    nTimerStart = nNow;
+                    nTimerHashes = 0;
+                }
 
-            // Update nTime every few seconds
-            UpdateTime(pblock, pindexPrev);
-            if (Params().AllowMinDifficultyBlocks()) {
-                // Changing pblock->nTime can change work required on testnet:
-                hashTarget.SetCompact(pblock->nBits);
+                if (fFound) {
+                    jobs->Submit(nJob, header);
+                    break;
+                }
+
+                boost::this_thread::interruption_point();
+
+                // Update nTime every few seconds
+                UpdateTime(&header, pindexPrev);
+                if (Params().AllowMinDifficultyBlocks()) {
+                    // Changing header.nTime can change work required on testnet:
+                    hashTarget.SetCompact(header.nBits);
+                }
             }
         }
+    } catch (std::exception& e) {
+        LogPrintf("ThreadPoWWorker() exception: %s\n", e.what());
     }
 }
 
-void static ThreadBitcoinMiner(void* parg) {
+void static ThreadBitcoinMiner(CWallet* pwallet, boost::shared_ptr<CMinerJobQueue> jobs) {
     boost::this_thread::interruption_point();
-    CWallet* pwallet = (CWallet*) parg;
     try {
-        BitcoinMiner(pwallet, false);
+        BitcoinMiner(pwallet, false, jobs.get());
         boost::this_thread::interruption_point();
     } catch (std::exception& e) {
         LogPrintf("ThreadBitcoinMiner() exception");
     } catch (...) {
         LogPrintf("ThreadBitcoinMiner() exception");
     }
+    // Don't leave the workers hashing a header nobody will collect
+    jobs->Retract();
 
     LogPrintf("ThreadBitcoinMiner exiting\n");
 }
@@ -650,13 +1019,28 @@ void GenerateBitcoins(bool fGenerate, CWallet* pwallet, int nThreads) {
         delete minerThreads;
         minerThreads = NULL;
     }
+    {
+        LOCK(cs_minerStats);
+        vMinerStats.clear();
+    }
 
     if (nThreads == 0 || !fGenerate)
         return;
 
+    // One thread builds templates, the rest only hash; the builder mostly
+    // waits, so it only gets a thread of its own with -genproclimit=1
+    int nWorkers = std::max(nThreads - 1, 1);
+    boost::shared_ptr<CMinerJobQueue> jobs(new CMinerJobQueue());
     minerThreads = new boost::thread_group();
-    for (int i = 0; i < nThreads; i++)
-        minerThreads->create_thread(boost::bind(&ThreadBitcoinMiner, pwallet));
+    minerThreads->create_thread(boost::bind(&ThreadBitcoinMiner, pwallet, jobs));
+    for (int i = 0; i < nWorkers; i++) {
+        boost::shared_ptr<CMinerThreadStats> stats(new CMinerThreadStats());
+        {
+            LOCK(cs_minerStats);
+            vMinerStats.push_back(stats);
+        }
+        minerThreads->create_thread(boost::bind(&ThreadPoWWorker, jobs, i, nWorkers, stats));
+    }
 }
 
 #endif // ENABLE_WALLET
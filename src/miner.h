@@ -6,14 +6,20 @@
 #ifndef BITCOIN_MINER_H
 #define BITCOIN_MINER_H
 
+#include <cstddef>
 #include <stdint.h>
+#include <vector>
+
+#include <boost/atomic.hpp>
 
 class CBlock;
 class CBlockHeader;
 class CBlockIndex;
+class CMinerJobQueue;
 class CReserveKey;
 class CScript;
 class CWallet;
+class uint256;
 
 struct CBlockTemplate;
 
@@ -27,9 +33,79 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
 /** Check mined block */
 void UpdateTime(CBlockHeader* block, const CBlockIndex* pindexPrev);
 
-void BitcoinMiner(CWallet* pwallet, bool fProofOfStake);
+/** Stake, or build PoW templates for the worker threads fed through pjobs */
+void BitcoinMiner(CWallet* pwallet, bool fProofOfStake, CMinerJobQueue* pjobs = NULL);
+/** Recent hashes per second of each PoW worker thread, 0 for idle ones */
+void GetMinerHashesPerSec(std::vector<int64_t>& vRates);
+
+/** The share of the 32-bit nonce range one PoW worker thread searches, handed out in batches */
+class CNonceSlice
+{
+public:
+    //! Kept wider than nNonce, as the end of the last slice is 2^32
+    uint64_t nBegin;
+    uint64_t nEnd;
+    uint64_t nNext;
+
+    /** Slice nThread of nThreads equal parts */
+    CNonceSlice(unsigned int nThread, unsigned int nThreads);
+
+    /** The first of the next nCount nonces, or false once fewer than that are left */
+    bool Take(unsigned int nCount, uint32_t& nFirst);
+};
+
+/** Lock-free histogram of durations in power-of-two microsecond buckets */
+class CTimingHistogram
+{
+public:
+    //! Bucket i holds durations below 2^i us that do not fit bucket i - 1; the last one has no upper bound
+    static const int BUCKETS = 26;
+
+    CTimingHistogram();
+
+    void Add(int64_t nMicros);
+
+    uint64_t GetBucket(int nBucket) const { return vBuckets[nBucket].load(boost::memory_order_relaxed); }
+    uint64_t GetCount() const { return nCount.load(boost::memory_order_relaxed); }
+    int64_t GetTotalMicros() const { return nTotalMicros.load(boost::memory_order_relaxed); }
+    int64_t GetMaxMicros() const { return nMaxMicros.load(boost::memory_order_relaxed); }
+
+private:
+    boost::atomic<uint64_t> vBuckets[BUCKETS];
+    boost::atomic<uint64_t> nCount;
+    boost::atomic<int64_t> nTotalMicros;
+    boost::atomic<int64_t> nMaxMicros;
+};
+
+/** Staking telemetry, written by CreateCoinStake and the stake minter and read by getstakingmetrics */
+struct CStakingMetrics
+{
+    //! Duration of each CreateCoinStake pass that got as far as the kernel search
+    CTimingHistogram passTime;
+    //! Time from a new tip arriving to the first stake attempt on it
+    CTimingHistogram tipLatency;
+
+    boost::atomic<uint64_t> nUTXOs;
+    boost::atomic<uint64_t> nHashes;
+    boost::atomic<uint64_t> nLastPassUTXOs;
+    boost::atomic<uint64_t> nLastPassHashes;
+    boost::atomic<int64_t> nLastPassMicros;
+
+    boost::atomic<uint64_t> nKernels;
+    boost::atomic<uint64_t> nBlocksAccepted;
+    boost::atomic<uint64_t> nBlocksRejected;
+
+    CStakingMetrics();
+
+    /** Count a CreateCoinStake pass */
+    void AddPass(int64_t nMicros, uint64_t nPassUTXOs, uint64_t nPassHashes);
+};
+
+extern CStakingMetrics stakingMetrics;
 
-extern double dHashesPerSec;
-extern int64_t nHPSTimerStart;
+/** Remember a staked block that was accepted, to tell later if it was orphaned */
+void RecordStakedBlock(const uint256& hash);
+/** Of the last blocks passed to RecordStakedBlock (nTracked), how many left the active chain */
+int CountOrphanedStakes(int& nTracked);
 
 #endif // BITCOIN_MINER_H
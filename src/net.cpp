@@ -1600,6 +1600,13 @@ void StartNode(boost::thread_group& threadGroup)
 
     // ppcoin:mint proof-of-stake blocks in the background
     if (GetBoolArg("-staking", true)){
+        // The minter thread is the first of the -stakethreads searching for a kernel
+        int nStakeThreads = GetArg("-stakethreads", DEFAULT_STAKETHREADS);
+        if (nStakeThreads <= 0)
+            nStakeThreads = boost::thread::hardware_concurrency();
+        for (int i = 1; i < nStakeThreads; i++)
+            threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "stakesearch", &ThreadStakeSearch));
+
         LogPrintf("iniciando ThreadStakeMinter\n");
         threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "stakemint", &ThreadStakeMinter));
     }
@@ -428,6 +428,19 @@ public:
         }
     }
 
+    /** Push a message whose payload is already serialized */
+    void PushMessageRaw(const char* pszCommand, const char* pch, size_t nSize)
+    {
+        try {
+            BeginMessage(pszCommand);
+            ssSend.write(pch, nSize);
+            EndMessage();
+        } catch (...) {
+            AbortMessage();
+            throw;
+        }
+    }
+
     template <typename T1>
     void PushMessage(const char* pszCommand, const T1& a1)
     {
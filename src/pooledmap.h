@@ -0,0 +1,326 @@
+// Copyright (c) 2017-2018 The NanuCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_POOLEDMAP_H
+#define BITCOIN_POOLEDMAP_H
+
+#include "memusage.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+
+/**
+ * STL-like hash map for large, short-lived caches such as the coins cache.
+ *
+ * Elements are constructed in fixed-size chunks of a pool instead of one heap
+ * allocation each, and the index is a flat open-addressing table (linear
+ * probing) of hash/pointer pairs, so a lookup touches one or two cache lines
+ * before it reaches the element. Elements never move: pointers and references
+ * to them stay valid until the element is erased, even when the table grows.
+ * clear() hands all chunks back at once.
+ *
+ * Erasing leaves a tombstone in the table, so erasing an element while
+ * iterating (erase(it++)) is safe. Inserting may rebuild the table, which
+ * invalidates iterators for incrementing but not for dereferencing or erase().
+ */
+template <typename K, typename V, typename H>
+class pooledmap
+{
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<const key_type, mapped_type> value_type;
+    typedef size_t size_type;
+
+private:
+    /** Table entry. An empty slot has no node and nHash 0, a tombstone has no node and nHash 1. */
+    struct Slot {
+        size_t nHash;
+        value_type* node;
+
+        Slot() : nHash(0), node(NULL) {}
+    };
+
+    /** Pool storage for one element, or a link in the free list */
+    union Node {
+        Node* pnext;
+        typename boost::aligned_storage<sizeof(value_type), boost::alignment_of<value_type>::value>::type data;
+    };
+
+    //! Elements per pool chunk: about 256 KiB each
+    static const size_t CHUNK_NODES = sizeof(Node) >= 262144 ? 1 : 262144 / sizeof(Node);
+
+    //! Smallest table allocated; always a power of two
+    static const size_t MIN_SLOTS = 64;
+
+    H hasher;
+    std::vector<Slot> vSlots;
+    std::vector<Node*> vChunks;
+    Node* pfree;
+    size_t nChunkUsed;
+    size_t nSize;
+    size_t nDeleted;
+
+    // Not copyable
+    pooledmap(const pooledmap&);
+    pooledmap& operator=(const pooledmap&);
+
+    value_type* Allocate(const value_type& x)
+    {
+        Node* node;
+        if (pfree) {
+            node = pfree;
+            pfree = pfree->pnext;
+        } else {
+            if (vChunks.empty() || nChunkUsed == CHUNK_NODES) {
+                vChunks.push_back(new Node[CHUNK_NODES]);
+                nChunkUsed = 0;
+            }
+            node = &vChunks.back()[nChunkUsed++];
+        }
+        try {
+            return new (&node->data) value_type(x);
+        } catch (...) {
+            node->pnext = pfree;
+            pfree = node;
+            throw;
+        }
+    }
+
+    void Deallocate(value_type* p)
+    {
+        p->~value_type();
+        Node* node = reinterpret_cast<Node*>(p);
+        node->pnext = pfree;
+        pfree = node;
+    }
+
+    /** Slot holding key k, or vSlots.size() if there is none */
+    size_t Lookup(const key_type& k, size_t nHash) const
+    {
+        if (vSlots.empty())
+            return 0;
+        size_t nMask = vSlots.size() - 1;
+        for (size_t nPos = nHash & nMask;; nPos = (nPos + 1) & nMask) {
+            const Slot& slot = vSlots[nPos];
+            if (slot.node == NULL) {
+                if (slot.nHash == 0)
+                    return vSlots.size();
+            } else if (slot.nHash == nHash && slot.node->first == k) {
+                return nPos;
+            }
+        }
+    }
+
+    /** Slot for a new element with the given hash: the first empty slot or tombstone on its probe path */
+    size_t FreeSlot(size_t nHash) const
+    {
+        size_t nMask = vSlots.size() - 1;
+        size_t nPos = nHash & nMask;
+        while (vSlots[nPos].node != NULL)
+            nPos = (nPos + 1) & nMask;
+        return nPos;
+    }
+
+    /** Rebuild the table with nSlots slots, dropping tombstones */
+    void Rehash(size_t nSlots)
+    {
+        std::vector<Slot> vOld(nSlots);
+        vOld.swap(vSlots);
+        nDeleted = 0;
+        for (size_t i = 0; i < vOld.size(); i++) {
+            if (vOld[i].node != NULL)
+                vSlots[FreeSlot(vOld[i].nHash)] = vOld[i];
+        }
+    }
+
+    void SkipFree(size_t& nPos) const
+    {
+        while (nPos < vSlots.size() && vSlots[nPos].node == NULL)
+            nPos++;
+    }
+
+public:
+    class const_iterator;
+
+    class iterator
+    {
+    private:
+        const pooledmap* map;
+        size_t nPos;
+        value_type* node;
+        friend class pooledmap;
+        friend class const_iterator;
+
+        iterator(const pooledmap* mapIn, size_t nPosIn) : map(mapIn), nPos(nPosIn), node(nPosIn < mapIn->vSlots.size() ? mapIn->vSlots[nPosIn].node : NULL) {}
+
+    public:
+        iterator() : map(NULL), nPos(0), node(NULL) {}
+        value_type& operator*() const { return *node; }
+        value_type* operator->() const { return node; }
+        iterator& operator++()
+        {
+            nPos++;
+            map->SkipFree(nPos);
+            node = nPos < map->vSlots.size() ? map->vSlots[nPos].node : NULL;
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            iterator ret = *this;
+            ++*this;
+            return ret;
+        }
+        friend bool operator==(const iterator& a, const iterator& b) { return a.node == b.node; }
+        friend bool operator!=(const iterator& a, const iterator& b) { return a.node != b.node; }
+    };
+
+    class const_iterator
+    {
+    private:
+        iterator it;
+
+    public:
+        const_iterator() {}
+        const_iterator(const iterator& itIn) : it(itIn) {}
+        const value_type& operator*() const { return *it; }
+        const value_type* operator->() const { return it.operator->(); }
+        const_iterator& operator++()
+        {
+            ++it;
+            return *this;
+        }
+        const_iterator operator++(int)
+        {
+            const_iterator ret = *this;
+            ++it;
+            return ret;
+        }
+        friend bool operator==(const const_iterator& a, const const_iterator& b) { return a.it == b.it; }
+        friend bool operator!=(const const_iterator& a, const const_iterator& b) { return a.it != b.it; }
+    };
+
+    pooledmap() : pfree(NULL), nChunkUsed(0), nSize(0), nDeleted(0) {}
+
+    ~pooledmap()
+    {
+        clear();
+    }
+
+    iterator begin()
+    {
+        size_t nPos = 0;
+        SkipFree(nPos);
+        return iterator(this, nPos);
+    }
+    const_iterator begin() const
+    {
+        size_t nPos = 0;
+        SkipFree(nPos);
+        return iterator(this, nPos);
+    }
+    iterator end() { return iterator(this, vSlots.size()); }
+    const_iterator end() const { return iterator(this, vSlots.size()); }
+    size_type size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+    size_type bucket_count() const { return vSlots.size(); }
+
+    iterator find(const key_type& k) { return iterator(this, Lookup(k, hasher(k))); }
+    const_iterator find(const key_type& k) const { return iterator(this, Lookup(k, hasher(k))); }
+    size_type count(const key_type& k) const { return Lookup(k, hasher(k)) < vSlots.size() ? 1 : 0; }
+
+    std::pair<iterator, bool> insert(const value_type& x)
+    {
+        size_t nHash = hasher(x.first);
+        size_t nPos = Lookup(x.first, nHash);
+        if (nPos < vSlots.size())
+            return std::make_pair(iterator(this, nPos), false);
+        // Keep at most 3/4 of the slots in use, tombstones included
+        if ((nSize + nDeleted + 1) * 4 > vSlots.size() * 3) {
+            size_t nSlots = vSlots.empty() ? MIN_SLOTS : vSlots.size();
+            while ((nSize + 1) * 2 > nSlots)
+                nSlots *= 2;
+            Rehash(nSlots);
+        }
+        nPos = FreeSlot(nHash);
+        Slot& slot = vSlots[nPos];
+        slot.node = Allocate(x);
+        if (slot.nHash == 1)
+            nDeleted--;
+        slot.nHash = nHash;
+        nSize++;
+        return std::make_pair(iterator(this, nPos), true);
+    }
+
+    mapped_type& operator[](const key_type& k)
+    {
+        iterator it = find(k);
+        if (it == end())
+            it = insert(value_type(k, mapped_type())).first;
+        return it->second;
+    }
+
+    void erase(iterator it)
+    {
+        size_t nPos = it.nPos;
+        // The table may have been rebuilt since the iterator was taken
+        if (nPos >= vSlots.size() || vSlots[nPos].node != it.node)
+            nPos = Lookup(it.node->first, hasher(it.node->first));
+        assert(nPos < vSlots.size());
+        Slot& slot = vSlots[nPos];
+        Deallocate(slot.node);
+        slot.node = NULL;
+        slot.nHash = 1;
+        nSize--;
+        nDeleted++;
+    }
+
+    size_type erase(const key_type& k)
+    {
+        iterator it = find(k);
+        if (it == end())
+            return 0;
+        erase(it);
+        return 1;
+    }
+
+    /** Destroy all elements and return the pool to the system; the table keeps its size */
+    void clear()
+    {
+        for (size_t i = 0; i < vSlots.size(); i++) {
+            if (vSlots[i].node != NULL)
+                vSlots[i].node->~value_type();
+            vSlots[i] = Slot();
+        }
+        for (size_t i = 0; i < vChunks.size(); i++)
+            delete[] vChunks[i];
+        vChunks.clear();
+        pfree = NULL;
+        nChunkUsed = 0;
+        nSize = 0;
+        nDeleted = 0;
+    }
+
+    size_t DynamicMemoryUsage() const
+    {
+        return memusage::MallocUsage(sizeof(Node) * CHUNK_NODES) * vChunks.size() + memusage::DynamicUsage(vChunks) + memusage::DynamicUsage(vSlots);
+    }
+};
+
+namespace memusage
+{
+template <typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const pooledmap<X, Y, Z>& m)
+{
+    return m.DynamicMemoryUsage();
+}
+}
+
+#endif // BITCOIN_POOLEDMAP_H
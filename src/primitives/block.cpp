@@ -13,12 +13,44 @@
 #include "utilstrencodings.h"
 #include "crypto/common.h"
 #include "util.h"
+#include "xevan.h"
 
-uint256 CBlockHeader::GetHash() const
+uint256 CBlockHeader::ComputeHash() const
 {
     return XEVAN(BEGIN(nVersion), END(nNonce));
 }
 
+uint256 CBlockHeader::GetHash() const
+{
+    if (fHashCached)
+        return hashCached;
+    return ComputeHash();
+}
+
+void CBlockHeader::SetCachedHash(const uint256& hash)
+{
+    hashCached = hash;
+    fHashCached = true;
+}
+
+void PrecomputeBlockHashes(const std::vector<CBlockHeader*>& vHeaders)
+{
+    for (size_t nStart = 0; nStart < vHeaders.size(); nStart += XEVAN_MAX_BATCH) {
+        unsigned int nCount = std::min((size_t)XEVAN_MAX_BATCH, vHeaders.size() - nStart);
+        const unsigned char* pinput[XEVAN_MAX_BATCH];
+        size_t plen[XEVAN_MAX_BATCH];
+        uint256 hashes[XEVAN_MAX_BATCH];
+        for (unsigned int i = 0; i < nCount; i++) {
+            const CBlockHeader* pheader = vHeaders[nStart + i];
+            pinput[i] = (const unsigned char*)BEGIN(pheader->nVersion);
+            plen[i] = (const unsigned char*)END(pheader->nNonce) - pinput[i];
+        }
+        XEVANBatch(pinput, plen, hashes, nCount);
+        for (unsigned int i = 0; i < nCount; i++)
+            vHeaders[nStart + i]->SetCachedHash(hashes[i]);
+    }
+}
+
 uint256 CBlock::BuildMerkleTree(bool* fMutated) const
 {
     /* WARNING! If you're reading this because you're learning about crypto
@@ -33,6 +33,11 @@ public:
     uint32_t nBits;
     uint32_t nNonce;
 
+    // memory only: XEVAN result set by SetCachedHash on a header that is no
+    // longer modified (a received or stored block); GetHash only reads it
+    uint256 hashCached;
+    bool fHashCached;
+
     CBlockHeader()
     {
         SetNull();
@@ -49,6 +54,8 @@ public:
         READWRITE(nTime);
         READWRITE(nBits);
         READWRITE(nNonce);
+        if (ser_action.ForRead())
+            fHashCached = false;
     }
 
     void SetNull()
@@ -59,6 +66,7 @@ public:
         nTime = 0;
         nBits = 0;
         nNonce = 0;
+        fHashCached = false;
     }
 
     bool IsNull() const
@@ -66,8 +74,19 @@ public:
         return (nBits == 0);
     }
 
+    /** Block hash; the memoized value if SetCachedHash was called, XEVAN otherwise. */
     uint256 GetHash() const;
 
+    /** Always recompute XEVAN; for the nonce loop where every call is a fresh header. */
+    uint256 ComputeHash() const;
+
+    /**
+     * Memoize hash as the XEVAN result of the current header fields. Only for
+     * headers that are not modified afterwards; SetNull and deserializing
+     * into the header clear it.
+     */
+    void SetCachedHash(const uint256& hash);
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
@@ -120,13 +139,8 @@ public:
 
     CBlockHeader GetBlockHeader() const
     {
-        CBlockHeader block;
-        block.nVersion       = nVersion;
-        block.hashPrevBlock  = hashPrevBlock;
-        block.hashMerkleRoot = hashMerkleRoot;
-        block.nTime          = nTime;
-        block.nBits          = nBits;
-        block.nNonce         = nNonce;
+        // Slicing copy keeps the memoized hash along with the header fields
+        CBlockHeader block = *this;
         return block;
     }
 
@@ -162,6 +176,12 @@ public:
 };
 
 
+/**
+ * Compute and memoize the hashes of many headers at once with XEVANBatch(),
+ * so later GetHash() calls on them are free.
+ */
+void PrecomputeBlockHashes(const std::vector<CBlockHeader*>& vHeaders);
+
 /** Describes a place in the block chain to another node such that if the
  * other node doesn't have the same branch, it can find a recent common trunk.
  * The further back it is, the further before the fork it may be.
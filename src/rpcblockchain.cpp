@@ -14,6 +14,8 @@
 
 #include <stdint.h>
 
+#include <boost/filesystem.hpp>
+
 #include "json/json_spirit_value.h"
 
 using namespace json_spirit;
@@ -452,6 +454,74 @@ Value gettxoutsetinfo(const Array& params, bool fHelp)
     return ret;
 }
 
+static Object UTXOSnapshotInfoToJSON(const CUTXOSnapshotInfo& info, const boost::filesystem::path& path)
+{
+    Object ret;
+    ret.push_back(Pair("bestblock", info.hashBlock.GetHex()));
+    ret.push_back(Pair("height", info.nHeight));
+    ret.push_back(Pair("transactions", (int64_t)info.nTransactions));
+    ret.push_back(Pair("txouts", (int64_t)info.nOutputs));
+    ret.push_back(Pair("snapshothash", info.hashSnapshot.GetHex()));
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
+Value dumptxoutset(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"filename\"\n"
+            "\nWrites the unspent transaction output set and the block index of the active chain to a snapshot file,\n"
+            "which a new node can bootstrap from with loadtxoutset.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) The file to write, relative to the data directory unless absolute; it must not exist\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"bestblock\": \"hex\",     (string) the block the snapshot was taken at\n"
+            "  \"height\": n,              (numeric) its height\n"
+            "  \"transactions\": n,        (numeric) The number of transactions with unspent outputs\n"
+            "  \"txouts\": n,              (numeric) The number of unspent outputs\n"
+            "  \"snapshothash\": \"hex\",  (string) The checksum of the file, to pin when loading it\n"
+            "  \"path\": \"path\"          (string) The file written\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("dumptxoutset", "\"utxo.dat\"") + HelpExampleRpc("dumptxoutset", "\"utxo.dat\""));
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    CUTXOSnapshotInfo info;
+    std::string strError;
+    if (!DumpUTXOSnapshot(path, info, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+    return UTXOSnapshotInfoToJSON(info, path);
+}
+
+Value loadtxoutset(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 2)
+        throw runtime_error(
+            "loadtxoutset \"filename\" \"snapshothash\"\n"
+            "\nBootstraps a node that has no blocks beyond genesis from a snapshot written by dumptxoutset.\n"
+            "The block index and unspent outputs are taken as valid without replaying the blocks; the node then\n"
+            "syncs from the snapshot's tip. Blocks below it are not stored and cannot be served to peers.\n"
+            "Requires -txindex=0, as the transaction index would lack every transaction below the snapshot.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"filename\"       (string, required) The snapshot file, relative to the data directory unless absolute\n"
+            "2. \"snapshothash\"   (string, required) The checksum dumptxoutset reported; the file is refused unless it matches\n"
+            "\nResult: the same object as dumptxoutset returns\n"
+            "\nExamples:\n" +
+            HelpExampleCli("loadtxoutset", "\"utxo.dat\" \"0a1b...\"") + HelpExampleRpc("loadtxoutset", "\"utxo.dat\", \"0a1b...\""));
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    uint256 hashExpected = ParseHashV(params[1], "snapshothash");
+    CUTXOSnapshotInfo info;
+    std::string strError;
+    if (!LoadUTXOSnapshot(path, hashExpected, info, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+    return UTXOSnapshotInfoToJSON(info, path);
+}
+
 Value gettxout(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -565,7 +635,13 @@ Value getblockchaininfo(const Array& params, bool fHelp)
             "  \"bestblockhash\": \"...\", (string) the hash of the currently best block\n"
             "  \"difficulty\": xxxxxx,     (numeric) the current difficulty\n"
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
-            "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"chainwork\": \"xxxx\",    (string) total amount of work in active chain, in hexadecimal\n"
+            "  \"coinscache\": {           (object) in-memory UTXO cache on top of the chain state database\n"
+            "    \"transactions\": xxxx,   (numeric) cached transactions\n"
+            "    \"usage\": xxxx,          (numeric) memory used by the cache in bytes\n"
+            "    \"limit\": xxxx           (numeric) usage above which the cache is written to disk (set by -dbcache)\n"
+            "  },\n"
+            "  \"mempoolusage\": xxxx      (numeric) memory used by the transaction memory pool in bytes\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getblockchaininfo", "") + HelpExampleRpc("getblockchaininfo", ""));
@@ -578,6 +654,12 @@ Value getblockchaininfo(const Array& params, bool fHelp)
     obj.push_back(Pair("difficulty", (double)GetDifficulty()));
     obj.push_back(Pair("verificationprogress", Checkpoints::GuessVerificationProgress(chainActive.Tip())));
     obj.push_back(Pair("chainwork", chainActive.Tip()->nChainWork.GetHex()));
+    Object coinscache;
+    coinscache.push_back(Pair("transactions", (uint64_t)pcoinsTip->GetCacheSize()));
+    coinscache.push_back(Pair("usage", (uint64_t)pcoinsTip->DynamicMemoryUsage()));
+    coinscache.push_back(Pair("limit", (uint64_t)nCoinCacheUsage));
+    obj.push_back(Pair("coinscache", coinscache));
+    obj.push_back(Pair("mempoolusage", (uint64_t)mempool.DynamicMemoryUsage()));
     return obj;
 }
 
@@ -689,6 +771,7 @@ Value getmempoolinfo(const Array& params, bool fHelp)
             "{\n"
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
+            "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getmempoolinfo", "") + HelpExampleRpc("getmempoolinfo", ""));
@@ -696,6 +779,7 @@ Value getmempoolinfo(const Array& params, bool fHelp)
     Object ret;
     ret.push_back(Pair("size", (int64_t)mempool.size()));
     ret.push_back(Pair("bytes", (int64_t)mempool.GetTotalTxSize()));
+    ret.push_back(Pair("usage", (int64_t)mempool.DynamicMemoryUsage()));
 
     return ret;
 }
@@ -203,7 +203,7 @@ Value setgenerate(const Array& params, bool fHelp)
                 LOCK(cs_main);
                 IncrementExtraNonce(pblock, chainActive.Tip(), nExtraNonce);
             }
-            while (!CheckProofOfWork(pblock->GetHash(), pblock->nBits)) {
+            while (!CheckProofOfWork(pblock->ComputeHash(), pblock->nBits)) {
                 // Yes, there is a chance every nonce could fail to satisfy the -regtest
                 // target -- 1 in 2^(2^32). That ain't gonna happen.
                 ++pblock->nNonce;
@@ -227,19 +227,34 @@ Value setgenerate(const Array& params, bool fHelp)
 
 Value gethashespersec(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gethashespersec\n"
+            "gethashespersec ( perthread )\n"
             "\nReturns a recent hashes per second performance measurement while generating.\n"
             "See the getgenerate and setgenerate calls to turn generation on and off.\n"
+            "\nArguments:\n"
+            "1. perthread     (boolean, optional, default=false) Return the rate of each miner thread instead of the total\n"
             "\nResult:\n"
             "n            (numeric) The recent hashes per second when generation is on (will return 0 if generation is off)\n"
+            "\nResult (for perthread=true):\n"
+            "[ n, ... ]   (array of numeric) The recent hashes per second of each miner thread\n"
             "\nExamples:\n" +
-            HelpExampleCli("gethashespersec", "") + HelpExampleRpc("gethashespersec", ""));
+            HelpExampleCli("gethashespersec", "") + HelpExampleCli("gethashespersec", "true") + HelpExampleRpc("gethashespersec", ""));
+
+    std::vector<int64_t> vRates;
+    GetMinerHashesPerSec(vRates);
+
+    if (params.size() > 0 && params[0].get_bool()) {
+        Array ret;
+        BOOST_FOREACH (int64_t nRate, vRates)
+            ret.push_back(nRate);
+        return ret;
+    }
 
-    if (GetTimeMillis() - nHPSTimerStart > 8000)
-        return (int64_t)0;
-    return (int64_t)dHashesPerSec;
+    int64_t nTotal = 0;
+    BOOST_FOREACH (int64_t nRate, vRates)
+        nTotal += nRate;
+    return nTotal;
 }
 #endif
 
@@ -260,6 +275,7 @@ Value getmininginfo(const Array& params, bool fHelp)
             "  \"generate\": true|false     (boolean) If the generation is on or off (see getgenerate or setgenerate calls)\n"
             "  \"genproclimit\": n          (numeric) The processor limit for generation. -1 if no generation. (see getgenerate or setgenerate calls)\n"
             "  \"hashespersec\": n          (numeric) The hashes per second of the generation, or 0 if no generation.\n"
+            "  \"threadhashespersec\": [n,...] (array) The hashes per second of each miner thread\n"
             "  \"pooledtx\": n              (numeric) The size of the mem pool\n"
             "  \"testnet\": true|false      (boolean) If using testnet or not\n"
             "  \"chain\": \"xxxx\",         (string) current network name as defined in BIP70 (main, test, regtest)\n"
@@ -287,7 +303,10 @@ Value getmininginfo(const Array& params, bool fHelp)
     obj.push_back(Pair("chain", Params().NetworkIDString()));
 #ifdef ENABLE_WALLET
     obj.push_back(Pair("generate", getgenerate(params, false)));
-    obj.push_back(Pair("hashespersec", gethashespersec(params, false)));
+    obj.push_back(Pair("hashespersec", gethashespersec(Array(), false)));
+    Array perThread;
+    perThread.push_back(true);
+    obj.push_back(Pair("threadhashespersec", gethashespersec(perThread, false)));
 #endif
     return obj;
 }
@@ -9,6 +9,7 @@
 #include "clientversion.h"
 #include "init.h"
 #include "main.h"
+#include "miner.h"
 #include "masternode-sync.h"
 #include "net.h"
 #include "netbase.h"
@@ -491,4 +492,73 @@ Value getstakingstatus(const Array& params, bool fHelp)
     obj.push_back(Pair("mnsync", masternodeSync.IsSynced()));
     return obj;
 }
+
+static Object TimingHistogramToJSON(const CTimingHistogram& histogram)
+{
+    Object obj;
+    uint64_t nCount = histogram.GetCount();
+    obj.push_back(Pair("count", (uint64_t)nCount));
+    obj.push_back(Pair("meanms", nCount ? histogram.GetTotalMicros() / 1000.0 / nCount : 0.0));
+    obj.push_back(Pair("maxms", histogram.GetMaxMicros() / 1000.0));
+    Array buckets;
+    for (int i = 0; i < CTimingHistogram::BUCKETS; i++) {
+        if (!histogram.GetBucket(i))
+            continue;
+        Object bucket;
+        if (i < CTimingHistogram::BUCKETS - 1)
+            bucket.push_back(Pair("belowms", (double)((int64_t)1 << i) / 1000.0));
+        bucket.push_back(Pair("count", (uint64_t)histogram.GetBucket(i)));
+        buckets.push_back(bucket);
+    }
+    obj.push_back(Pair("buckets", buckets));
+    return obj;
+}
+
+Value getstakingmetrics(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getstakingmetrics\n"
+            "Returns timing and work counters of the stake minter since startup.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"passes\": { ... },                 (object) duration of each coinstake search pass (histogram, see below)\n"
+            "  \"utxosexamined\": n,              (numeric) stake inputs checked over all passes\n"
+            "  \"hashes\": n,                     (numeric) kernel hashes computed over all passes\n"
+            "  \"lastpass\": {                    (object) the most recent pass\n"
+            "    \"ms\": x.xxx,                   (numeric) duration in milliseconds\n"
+            "    \"utxosexamined\": n,            (numeric) stake inputs checked\n"
+            "    \"hashes\": n                    (numeric) kernel hashes computed\n"
+            "  },\n"
+            "  \"tiplatency\": { ... },             (object) time from a new tip arriving to the first stake attempt on it (histogram)\n"
+            "  \"kernelsfound\": n,               (numeric) passes that found a kernel\n"
+            "  \"blocksaccepted\": n,             (numeric) staked blocks accepted by this node\n"
+            "  \"blocksrejected\": n,             (numeric) staked blocks that were stale or invalid when found\n"
+            "  \"blocksorphaned\": n,             (numeric) accepted blocks, of the last \"blockstracked\", no longer in the active chain\n"
+            "  \"blockstracked\": n               (numeric) accepted blocks checked for \"blocksorphaned\"\n"
+            "}\n"
+            "\nEach histogram is {\"count\": n, \"meanms\": x.xxx, \"maxms\": x.xxx, \"buckets\": [{\"belowms\": x.xxx, \"count\": n}, ...]}\n"
+            "with power-of-two bucket bounds; empty buckets are left out and the last bucket has no bound.\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getstakingmetrics", "") + HelpExampleRpc("getstakingmetrics", ""));
+
+    Object obj;
+    obj.push_back(Pair("passes", TimingHistogramToJSON(stakingMetrics.passTime)));
+    obj.push_back(Pair("utxosexamined", (uint64_t)stakingMetrics.nUTXOs));
+    obj.push_back(Pair("hashes", (uint64_t)stakingMetrics.nHashes));
+    Object lastpass;
+    lastpass.push_back(Pair("ms", stakingMetrics.nLastPassMicros / 1000.0));
+    lastpass.push_back(Pair("utxosexamined", (uint64_t)stakingMetrics.nLastPassUTXOs));
+    lastpass.push_back(Pair("hashes", (uint64_t)stakingMetrics.nLastPassHashes));
+    obj.push_back(Pair("lastpass", lastpass));
+    obj.push_back(Pair("tiplatency", TimingHistogramToJSON(stakingMetrics.tipLatency)));
+    obj.push_back(Pair("kernelsfound", (uint64_t)stakingMetrics.nKernels));
+    obj.push_back(Pair("blocksaccepted", (uint64_t)stakingMetrics.nBlocksAccepted));
+    obj.push_back(Pair("blocksrejected", (uint64_t)stakingMetrics.nBlocksRejected));
+    int nTracked = 0;
+    int nOrphaned = CountOrphanedStakes(nTracked);
+    obj.push_back(Pair("blocksorphaned", nOrphaned));
+    obj.push_back(Pair("blockstracked", nTracked));
+    return obj;
+}
 #endif // ENABLE_WALLET
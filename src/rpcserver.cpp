@@ -259,6 +259,8 @@ static const CRPCCommand vRPCCommands[] =
         {"blockchain", "getmempoolinfo", &getmempoolinfo, true, true, false},
         {"blockchain", "getrawmempool", &getrawmempool, true, false, false},
         {"blockchain", "gettxout", &gettxout, true, false, false},
+        {"blockchain", "dumptxoutset", &dumptxoutset, true, true, false},
+        {"blockchain", "loadtxoutset", &loadtxoutset, false, true, false}, /* checks the file without cs_main */
         {"blockchain", "gettxoutsetinfo", &gettxoutsetinfo, true, false, false},
         {"blockchain", "verifychain", &verifychain, true, false, false},
         {"blockchain", "invalidateblock", &invalidateblock, true, true, false},
@@ -328,6 +330,7 @@ static const CRPCCommand vRPCCommands[] =
         {"wallet", "getreceivedbyaccount", &getreceivedbyaccount, false, false, true},
         {"wallet", "getreceivedbyaddress", &getreceivedbyaddress, false, false, true},
         {"wallet", "getstakingstatus", &getstakingstatus, false, false, true},
+        {"wallet", "getstakingmetrics", &getstakingmetrics, true, true, true},
         {"wallet", "getstakesplitthreshold", &getstakesplitthreshold, false, false, true},
         {"wallet", "gettransaction", &gettransaction, false, false, true},
         {"wallet", "getunconfirmedbalance", &getunconfirmedbalance, false, false, true},
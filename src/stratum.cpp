@@ -0,0 +1,596 @@
+// Copyright (c) 2017-2018 The NanuCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+
+#include "base58.h"
+#include "chainparams.h"
+#include "main.h"
+#include "miner.h"
+#include "netbase.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "sync.h"
+#include "timedata.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "utilstrencodings.h"
+
+#include "json/json_spirit_reader_template.h"
+#include "json/json_spirit_utils.h"
+#include "json/json_spirit_writer_template.h"
+
+#include <algorithm>
+#include <deque>
+#include <map>
+
+#include <boost/asio.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+using namespace boost::asio;
+using namespace json_spirit;
+using namespace std;
+
+/** Longest request line a miner may send */
+static const size_t MAX_STRATUM_LINE = 16 * 1024;
+/** Bytes queued for a miner that does not read them before it is dropped */
+static const size_t MAX_STRATUM_SEND_QUEUE = 1024 * 1024;
+/** Jobs kept for late submissions once newer ones are announced */
+static const size_t MAX_STRATUM_JOBS = 16;
+/** Seconds between jobs for a changed mempool, as getblocktemplate does */
+static const int64_t STRATUM_MEMPOOL_REFRESH = 5;
+
+static CScript StratumScriptSig(int nHeight, const std::vector<unsigned char>& vchExtraNonce)
+{
+    return (CScript() << nHeight << vchExtraNonce) + COINBASE_FLAGS;
+}
+
+static std::string HexBE32(uint32_t n)
+{
+    return strprintf("%08x", n);
+}
+
+static bool ParseHexBE32(const Value& val, uint32_t& n)
+{
+    if (val.type() != str_type || val.get_str().size() != 8 || !IsHex(val.get_str()))
+        return false;
+    n = strtoul(val.get_str().c_str(), NULL, 16);
+    return true;
+}
+
+bool CStratumJob::Init(const std::string& strIdIn, const CBlock& blockIn, int nHeightIn)
+{
+    strId = strIdIn;
+    nHeight = nHeightIn;
+    block = blockIn;
+    setSubmitted.clear();
+
+    const std::vector<unsigned char> vchZero(STRATUM_EXTRANONCE1_SIZE + STRATUM_EXTRANONCE2_SIZE, 0);
+    CMutableTransaction txCoinbase(block.vtx[0]);
+    txCoinbase.vin[0].scriptSig = StratumScriptSig(nHeight, vchZero);
+    if (txCoinbase.vin[0].scriptSig.size() > 100)
+        return false;
+    block.vtx[0] = txCoinbase;
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    vMerkleBranch = block.GetMerkleBranch(0);
+
+    // The extranonce push follows the height push at the start of the scriptSig
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block.vtx[0];
+    const CScript& scriptSig = block.vtx[0].vin[0].scriptSig;
+    size_t nOffset = 4 + GetSizeOfCompactSize(1) + 36 + GetSizeOfCompactSize(scriptSig.size()) +
+                     (CScript() << nHeight).size() + 1;
+    if (nOffset + vchZero.size() > ss.size() || (unsigned char)ss[nOffset - 1] != vchZero.size())
+        return false;
+    vchCoinbase1.assign(ss.begin(), ss.begin() + nOffset);
+    vchCoinbase2.assign(ss.begin() + nOffset + vchZero.size(), ss.end());
+    return true;
+}
+
+CTransaction CStratumJob::GetCoinbase(const std::vector<unsigned char>& vchExtraNonce) const
+{
+    CMutableTransaction txCoinbase(block.vtx[0]);
+    txCoinbase.vin[0].scriptSig = StratumScriptSig(nHeight, vchExtraNonce);
+    return txCoinbase;
+}
+
+CBlockHeader CStratumJob::GetHeader(const std::vector<unsigned char>& vchExtraNonce, uint32_t nTime, uint32_t nNonce) const
+{
+    CBlockHeader header = block.GetBlockHeader();
+    header.hashMerkleRoot = CBlock::CheckMerkleBranch(GetCoinbase(vchExtraNonce).GetHash(), vMerkleBranch, 0);
+    header.nTime = nTime;
+    header.nNonce = nNonce;
+    return header;
+}
+
+Array CStratumJob::GetNotifyParams(bool fCleanJobs) const
+{
+    // Stratum sends the previous block hash as eight 32-bit words, each
+    // byte-swapped relative to the header
+    std::vector<unsigned char> vchPrev(block.hashPrevBlock.begin(), block.hashPrevBlock.end());
+    for (size_t i = 0; i < vchPrev.size(); i += 4)
+        std::reverse(vchPrev.begin() + i, vchPrev.begin() + i + 4);
+
+    Array branch;
+    BOOST_FOREACH (const uint256& hash, vMerkleBranch)
+        branch.push_back(HexStr(hash.begin(), hash.end()));
+
+    Array params;
+    params.push_back(strId);
+    params.push_back(HexStr(vchPrev));
+    params.push_back(HexStr(vchCoinbase1));
+    params.push_back(HexStr(vchCoinbase2));
+    params.push_back(branch);
+    params.push_back(HexBE32(block.nVersion));
+    params.push_back(HexBE32(block.nBits));
+    params.push_back(HexBE32(block.nTime));
+    params.push_back(fCleanJobs);
+    return params;
+}
+
+//! These are created by StartStratumServer, destroyed in StopStratumServer
+static io_service* stratum_io_service = NULL;
+static boost::shared_ptr<ip::tcp::acceptor> stratum_acceptor;
+//! Runs ProcessNewBlock for solved blocks, off the connection thread
+static io_service* stratum_block_service = NULL;
+static io_service::work* stratum_block_work = NULL;
+static boost::thread_group* stratum_threads = NULL;
+
+static CCriticalSection cs_stratum;
+static std::map<uint32_t, boost::shared_ptr<CStratumJob> > mapStratumJobs;
+static boost::shared_ptr<CStratumJob> pStratumJobCurrent;
+static CScript scriptStratumPayout;
+static uint256 hashStratumShareTarget;
+
+void AddStratumJob(const boost::shared_ptr<CStratumJob>& job, bool fNewTip)
+{
+    LOCK(cs_stratum);
+    if (fNewTip)
+        mapStratumJobs.clear();
+    mapStratumJobs[strtoul(job->strId.c_str(), NULL, 16)] = job;
+    if (mapStratumJobs.size() > MAX_STRATUM_JOBS)
+        mapStratumJobs.erase(mapStratumJobs.begin());
+    pStratumJobCurrent = job;
+}
+
+CStratumSession::CStratumSession(uint32_t nExtraNonce1, const uint256& hashShareTargetIn) : fSubscribed(false), fAuthorized(false), hashShareTarget(hashShareTargetIn)
+{
+    vchExtraNonce1.resize(STRATUM_EXTRANONCE1_SIZE);
+    for (unsigned int i = 0; i < STRATUM_EXTRANONCE1_SIZE; i++)
+        vchExtraNonce1[i] = (nExtraNonce1 >> (8 * (STRATUM_EXTRANONCE1_SIZE - 1 - i))) & 0xff;
+}
+
+Value CStratumSession::Execute(const std::string& strMethod, const Array& params)
+{
+    if (strMethod == "mining.subscribe") {
+        fSubscribed = true;
+        Array subscription;
+        subscription.push_back("mining.notify");
+        subscription.push_back(HexStr(vchExtraNonce1));
+        Array subscriptions;
+        subscriptions.push_back(subscription);
+        Array result;
+        result.push_back(subscriptions);
+        result.push_back(HexStr(vchExtraNonce1));
+        result.push_back((int)STRATUM_EXTRANONCE2_SIZE);
+        return result;
+    }
+    if (strMethod == "mining.authorize") {
+        // Blocks pay to -stratumaddress, so the worker name is informational
+        fAuthorized = true;
+        return true;
+    }
+    if (strMethod == "mining.submit")
+        return Submit(params);
+    throw CStratumError(STRATUM_OTHER, "Method not found");
+}
+
+/** params: worker name, job id, extranonce2, ntime, nonce */
+bool CStratumSession::Submit(const Array& params)
+{
+    if (!fSubscribed)
+        throw CStratumError(STRATUM_NOT_SUBSCRIBED, "Not subscribed");
+    if (!fAuthorized)
+        throw CStratumError(STRATUM_UNAUTHORIZED, "Unauthorized worker");
+    uint32_t nTime, nNonce;
+    if (params.size() < 5 || params[1].type() != str_type || params[2].type() != str_type ||
+        params[2].get_str().size() != 2 * STRATUM_EXTRANONCE2_SIZE || !IsHex(params[2].get_str()) ||
+        !ParseHexBE32(params[3], nTime) || !ParseHexBE32(params[4], nNonce))
+        throw CStratumError(STRATUM_OTHER, "Invalid parameters");
+
+    std::vector<unsigned char> vchExtraNonce(vchExtraNonce1);
+    std::vector<unsigned char> vchExtraNonce2 = ParseHex(params[2].get_str());
+    vchExtraNonce.insert(vchExtraNonce.end(), vchExtraNonce2.begin(), vchExtraNonce2.end());
+
+    boost::shared_ptr<CStratumJob> job;
+    {
+        LOCK(cs_stratum);
+        std::map<uint32_t, boost::shared_ptr<CStratumJob> >::iterator it = mapStratumJobs.find(strtoul(params[1].get_str().c_str(), NULL, 16));
+        if (it != mapStratumJobs.end() && it->second->strId == params[1].get_str())
+            job = it->second;
+    }
+    if (!job)
+        throw CStratumError(STRATUM_JOB_NOT_FOUND, "Job not found");
+    if (nTime < job->block.nTime || nTime > GetAdjustedTime() + 7200)
+        throw CStratumError(STRATUM_OTHER, "Time out of range");
+
+    CBlockHeader header = job->GetHeader(vchExtraNonce, nTime, nNonce);
+    uint256 hash = header.GetHash();
+    uint256 hashBlockTarget = uint256().SetCompact(header.nBits);
+
+    // Only shares that meet the target are remembered, so a miner cannot
+    // grow the set with hashes that are worthless anyway
+    if (hash > hashBlockTarget && hash > hashShareTarget)
+        throw CStratumError(STRATUM_LOW_DIFFICULTY, "Low difficulty share");
+    {
+        LOCK(cs_stratum);
+        if (job->setSubmitted.count(hash))
+            throw CStratumError(STRATUM_DUPLICATE_SHARE, "Duplicate share");
+        // A full job still takes blocks, which are too rare to grow the set
+        if (job->setSubmitted.size() >= MAX_STRATUM_JOB_SHARES && hash > hashBlockTarget)
+            throw CStratumError(STRATUM_OTHER, "Too many shares for this job");
+        job->setSubmitted.insert(hash);
+    }
+
+    if (hash > hashBlockTarget) {
+        LogPrint("stratum", "Stratum: share %s from %s\n", hash.GetHex(), strPeer);
+        return true;
+    }
+
+    CBlock block(job->block);
+    block.vtx[0] = job->GetCoinbase(vchExtraNonce);
+    block.hashMerkleRoot = header.hashMerkleRoot;
+    block.nTime = header.nTime;
+    block.nNonce = header.nNonce;
+    LogPrintf("Stratum: proof-of-work found by %s\n  hash: %s\ntarget: %s\n", strPeer, hash.GetHex(), hashBlockTarget.GetHex());
+    SubmitBlock(block);
+    return true;
+}
+
+static void StratumProcessBlock(const CBlock& blockIn)
+{
+    CBlock block(blockIn);
+    CValidationState state;
+    if (!ProcessNewBlock(state, NULL, &block))
+        LogPrintf("Stratum: block %s rejected: %s\n", block.GetHash().GetHex(), state.GetRejectReason());
+}
+
+void CStratumSession::SubmitBlock(const CBlock& block)
+{
+    // Validation takes cs_main and can take long; the connections must keep
+    // being served meanwhile, so the block is checked on its own thread
+    stratum_block_service->post(boost::bind(&StratumProcessBlock, block));
+}
+
+class CStratumClient;
+//! Only touched from the io_service thread
+static std::set<boost::shared_ptr<CStratumClient> > setStratumClients;
+static uint32_t nStratumExtraNonce1 = 0;
+
+class CStratumClient : public CStratumSession, public boost::enable_shared_from_this<CStratumClient>
+{
+public:
+    ip::tcp::socket socket;
+    ip::tcp::endpoint peer;
+
+    CStratumClient(io_service& io) : CStratumSession(nStratumExtraNonce1++, hashStratumShareTarget), socket(io), buf(MAX_STRATUM_LINE), nQueueSize(0), fWriting(false) {}
+
+    void Start()
+    {
+        strPeer = peer.address().to_string();
+        LogPrint("stratum", "Stratum: connection from %s\n", strPeer);
+        Read();
+    }
+
+    void Close()
+    {
+        boost::system::error_code ec;
+        socket.close(ec);
+        setStratumClients.erase(shared_from_this());
+    }
+
+    void Notify(const CStratumJob& job, bool fCleanJobs)
+    {
+        if (!fSubscribed)
+            return;
+        Send("mining.notify", job.GetNotifyParams(fCleanJobs));
+    }
+
+private:
+    boost::asio::streambuf buf;
+    std::deque<std::string> queue;
+    //! Bytes in queue, the one being written included
+    size_t nQueueSize;
+    bool fWriting;
+
+    void Read()
+    {
+        async_read_until(socket, buf, '\n',
+            boost::bind(&CStratumClient::HandleRead, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void Write(const Object& obj)
+    {
+        std::string strLine = write_string(Value(obj), false) + "\n";
+        if (nQueueSize + strLine.size() > MAX_STRATUM_SEND_QUEUE) {
+            LogPrint("stratum", "Stratum: %s does not read its messages, disconnecting\n", strPeer);
+            Close();
+            return;
+        }
+        nQueueSize += strLine.size();
+        queue.push_back(strLine);
+        if (!fWriting)
+            WriteNext();
+    }
+
+    void WriteNext()
+    {
+        fWriting = true;
+        async_write(socket, buffer(queue.front()),
+            boost::bind(&CStratumClient::HandleWrite, shared_from_this(), boost::asio::placeholders::error));
+    }
+
+    void HandleWrite(const boost::system::error_code& error)
+    {
+        fWriting = false;
+        if (error) {
+            Close();
+            return;
+        }
+        nQueueSize -= queue.front().size();
+        queue.pop_front();
+        if (!queue.empty())
+            WriteNext();
+    }
+
+    void Send(const std::string& strMethod, const Array& params)
+    {
+        Object notification;
+        notification.push_back(Pair("id", Value::null));
+        notification.push_back(Pair("method", strMethod));
+        notification.push_back(Pair("params", params));
+        Write(notification);
+    }
+
+    void HandleRead(const boost::system::error_code& error)
+    {
+        if (error) {
+            // Also reached for lines longer than MAX_STRATUM_LINE
+            LogPrint("stratum", "Stratum: %s disconnected: %s\n", strPeer, error.message());
+            Close();
+            return;
+        }
+
+        std::istream is(&buf);
+        std::string strLine;
+        std::getline(is, strLine);
+
+        Value valRequest;
+        if (!read_string(strLine, valRequest) || valRequest.type() != obj_type) {
+            LogPrint("stratum", "Stratum: malformed request from %s\n", strPeer);
+            Close();
+            return;
+        }
+        const Object& request = valRequest.get_obj();
+        const Value& id = find_value(request, "id");
+        const Value& method = find_value(request, "method");
+        const Value& params = find_value(request, "params");
+
+        Object reply;
+        reply.push_back(Pair("id", id));
+        try {
+            if (method.type() != str_type || params.type() != array_type)
+                throw CStratumError(STRATUM_OTHER, "Invalid request");
+            reply.push_back(Pair("result", Execute(method.get_str(), params.get_array())));
+            reply.push_back(Pair("error", Value::null));
+        } catch (CStratumError& e) {
+            Array err;
+            err.push_back(e.nCode);
+            err.push_back(e.strMessage);
+            err.push_back(Value::null);
+            reply.push_back(Pair("result", Value::null));
+            reply.push_back(Pair("error", err));
+        } catch (std::exception& e) {
+            Array err;
+            err.push_back((int)STRATUM_OTHER);
+            err.push_back(std::string(e.what()));
+            err.push_back(Value::null);
+            reply.push_back(Pair("result", Value::null));
+            reply.push_back(Pair("error", err));
+        }
+        Write(reply);
+
+        // Hand out work right after the subscription reply
+        if (fSubscribed && method.type() == str_type && method.get_str() == "mining.subscribe") {
+            Array difficulty;
+            difficulty.push_back((int64_t)GetArg("-stratumdifficulty", DEFAULT_STRATUM_DIFFICULTY));
+            Send("mining.set_difficulty", difficulty);
+            boost::shared_ptr<CStratumJob> job;
+            {
+                LOCK(cs_stratum);
+                job = pStratumJobCurrent;
+            }
+            if (job)
+                Send("mining.notify", job->GetNotifyParams(true));
+        }
+
+        Read();
+    }
+};
+
+static void StratumBroadcast(boost::shared_ptr<CStratumJob> job, bool fCleanJobs)
+{
+    BOOST_FOREACH (const boost::shared_ptr<CStratumClient>& client, setStratumClients)
+        client->Notify(*job, fCleanJobs);
+}
+
+static void StratumListen();
+
+static void StratumAcceptHandler(boost::shared_ptr<CStratumClient> client, const boost::system::error_code& error)
+{
+    if (error == boost::asio::error::operation_aborted || !stratum_acceptor->is_open())
+        return;
+    if (error) {
+        LogPrintf("%s: Error: %s\n", __func__, error.message());
+    } else {
+        setStratumClients.insert(client);
+        client->Start();
+    }
+    StratumListen();
+}
+
+static void StratumListen()
+{
+    boost::shared_ptr<CStratumClient> client(new CStratumClient(*stratum_io_service));
+    stratum_acceptor->async_accept(client->socket, client->peer,
+        boost::bind(&StratumAcceptHandler, client, boost::asio::placeholders::error));
+}
+
+/** Whether a proof-of-work block can be built on pindexTip */
+bool IsStratumMiningPossible(const CBlockIndex* pindexTip, bool fInitialDownload)
+{
+    return pindexTip != NULL && !fInitialDownload && pindexTip->nHeight < Params().LAST_POW_BLOCK();
+}
+
+/**
+ * Build a job whenever the tip changes, or every few seconds while the
+ * mempool does, and push it to every subscribed miner.
+ */
+static void ThreadStratumJobs()
+{
+    RenameThread("nanucoin-stratum");
+
+    //! Tip seen on the last pass, so the next one waits for a change
+    CBlockIndex* pindexPrev = NULL;
+    //! Tip the current job builds on
+    CBlockIndex* pindexJob = NULL;
+    unsigned int nTransactionsUpdatedLast = 0;
+    int64_t nStart = 0;
+    uint32_t nJobId = 0;
+
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(csBestBlock);
+            if (chainActive.Tip() == pindexPrev)
+                cvBlockChange.timed_wait(lock, boost::posix_time::seconds(1));
+        }
+        boost::this_thread::interruption_point();
+
+        // Every path below ends up waiting at the top until the tip changes or a second passes
+        CBlockIndex* pindexTip = chainActive.Tip();
+        pindexPrev = pindexTip;
+        if (!IsStratumMiningPossible(pindexTip, IsInitialBlockDownload()))
+            continue;
+        bool fNewTip = pindexTip != pindexJob;
+        if (!fNewTip && (mempool.GetTransactionsUpdated() == nTransactionsUpdatedLast || GetTime() - nStart <= STRATUM_MEMPOOL_REFRESH))
+            continue;
+
+        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+        nStart = GetTime();
+        auto_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(scriptStratumPayout, NULL, false));
+        if (!pblocktemplate.get())
+            continue;
+        pindexJob = pindexTip;
+
+        boost::shared_ptr<CStratumJob> job(new CStratumJob());
+        nJobId++;
+        if (!job->Init(strprintf("%x", nJobId), pblocktemplate->block, pindexTip->nHeight + 1)) {
+            LogPrintf("%s: cannot split coinbase of block template\n", __func__);
+            continue;
+        }
+        AddStratumJob(job, fNewTip);
+        LogPrint("stratum", "Stratum: job %s at height %d with %u transactions\n", job->strId, job->nHeight, job->block.vtx.size());
+        stratum_io_service->post(boost::bind(&StratumBroadcast, job, fNewTip));
+    }
+}
+
+static void ThreadStratumIO()
+{
+    RenameThread("nanucoin-stratumio");
+    stratum_io_service->run();
+}
+
+static void ThreadStratumBlocks()
+{
+    RenameThread("nanucoin-stratumblk");
+    stratum_block_service->run();
+}
+
+bool StartStratumServer(std::string& strError)
+{
+    CBitcoinAddress address(GetArg("-stratumaddress", ""));
+    if (!address.IsValid()) {
+        strError = _("-stratum requires a valid -stratumaddress to pay mined blocks to");
+        return false;
+    }
+    int64_t nDifficulty = GetArg("-stratumdifficulty", DEFAULT_STRATUM_DIFFICULTY);
+    if (nDifficulty < 1) {
+        strError = strprintf(_("Invalid -stratumdifficulty: %d"), nDifficulty);
+        return false;
+    }
+    {
+        LOCK(cs_stratum);
+        scriptStratumPayout = GetScriptForDestination(address.Get());
+        hashStratumShareTarget = Params().ProofOfWorkLimit() / uint256(nDifficulty);
+    }
+
+    std::string strHost;
+    int nPort = GetArg("-stratumport", DEFAULT_STRATUM_PORT);
+    SplitHostPort(GetArg("-stratumbind", "127.0.0.1"), nPort, strHost);
+
+    assert(stratum_io_service == NULL);
+    stratum_io_service = new io_service();
+    try {
+        ip::tcp::endpoint endpoint(ip::address::from_string(strHost), nPort);
+        stratum_acceptor.reset(new ip::tcp::acceptor(*stratum_io_service));
+        stratum_acceptor->open(endpoint.protocol());
+        stratum_acceptor->set_option(ip::tcp::acceptor::reuse_address(true));
+        stratum_acceptor->bind(endpoint);
+        stratum_acceptor->listen(socket_base::max_connections);
+    } catch (boost::system::system_error& e) {
+        strError = strprintf(_("Unable to bind Stratum server to %s port %d: %s"), strHost, nPort, e.what());
+        stratum_acceptor.reset();
+        delete stratum_io_service;
+        stratum_io_service = NULL;
+        return false;
+    }
+    LogPrintf("Stratum server listening on %s port %d\n", strHost, nPort);
+
+    StratumListen();
+    stratum_block_service = new io_service();
+    stratum_block_work = new io_service::work(*stratum_block_service);
+    stratum_threads = new boost::thread_group();
+    stratum_threads->create_thread(&ThreadStratumIO);
+    stratum_threads->create_thread(&ThreadStratumBlocks);
+    stratum_threads->create_thread(&ThreadStratumJobs);
+    return true;
+}
+
+void StopStratumServer()
+{
+    if (stratum_io_service == NULL) return;
+
+    stratum_threads->interrupt_all();
+    stratum_io_service->stop();
+    stratum_block_service->stop();
+    stratum_threads->join_all();
+    delete stratum_threads;
+    stratum_threads = NULL;
+    delete stratum_block_work;
+    stratum_block_work = NULL;
+    delete stratum_block_service;
+    stratum_block_service = NULL;
+
+    setStratumClients.clear();
+    stratum_acceptor.reset();
+    delete stratum_io_service;
+    stratum_io_service = NULL;
+
+    LOCK(cs_stratum);
+    mapStratumJobs.clear();
+    pStratumJobCurrent.reset();
+}
@@ -0,0 +1,120 @@
+// Copyright (c) 2017-2018 The NanuCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_STRATUM_H
+#define BITCOIN_STRATUM_H
+
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "uint256.h"
+
+#include "json/json_spirit_value.h"
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+static const bool DEFAULT_STRATUM = false;
+static const unsigned short DEFAULT_STRATUM_PORT = 3333;
+/** Share difficulty; a share must hash below the PoW limit divided by this */
+static const unsigned int DEFAULT_STRATUM_DIFFICULTY = 1;
+/** Size of the per-connection extranonce1 and of the miner-chosen extranonce2 */
+static const unsigned int STRATUM_EXTRANONCE1_SIZE = 4;
+static const unsigned int STRATUM_EXTRANONCE2_SIZE = 4;
+//! Shares a job remembers for the duplicate check; past that it takes only blocks
+static const size_t MAX_STRATUM_JOB_SHARES = 16384;
+
+/**
+ * A PoW block template split the way Stratum v1 hands it out: the serialized
+ * coinbase around the extranonce1 + extranonce2 gap, and the merkle branch
+ * that links the coinbase to the merkle root.
+ */
+class CStratumJob
+{
+public:
+    std::string strId;
+    int nHeight;
+    //! Template with an all-zero extranonce in the coinbase
+    CBlock block;
+    std::vector<unsigned char> vchCoinbase1;
+    std::vector<unsigned char> vchCoinbase2;
+    std::vector<uint256> vMerkleBranch;
+    //! Header hashes already submitted against this job, at most MAX_STRATUM_JOB_SHARES shares
+    std::set<uint256> setSubmitted;
+
+    /** Split blockIn, which must extend a block at nHeightIn - 1 */
+    bool Init(const std::string& strIdIn, const CBlock& blockIn, int nHeightIn);
+
+    /** The coinbase carrying vchExtraNonce (extranonce1 followed by extranonce2) */
+    CTransaction GetCoinbase(const std::vector<unsigned char>& vchExtraNonce) const;
+
+    /** The header a miner hashed for the given mining.submit parameters */
+    CBlockHeader GetHeader(const std::vector<unsigned char>& vchExtraNonce, uint32_t nTime, uint32_t nNonce) const;
+
+    /** Params of the mining.notify message announcing this job */
+    json_spirit::Array GetNotifyParams(bool fCleanJobs) const;
+};
+
+/** Stratum error codes as used by the common pool software */
+enum StratumErrorCode {
+    STRATUM_OTHER = 20,
+    STRATUM_JOB_NOT_FOUND = 21,
+    STRATUM_DUPLICATE_SHARE = 22,
+    STRATUM_LOW_DIFFICULTY = 23,
+    STRATUM_UNAUTHORIZED = 24,
+    STRATUM_NOT_SUBSCRIBED = 25,
+};
+
+class CStratumError
+{
+public:
+    int nCode;
+    std::string strMessage;
+    CStratumError(int nCodeIn, const std::string& strMessageIn) : nCode(nCodeIn), strMessage(strMessageIn) {}
+};
+
+/**
+ * The request handling of one Stratum connection, without the socket.
+ * Requests are answered against the jobs published by AddStratumJob().
+ */
+class CStratumSession
+{
+public:
+    std::vector<unsigned char> vchExtraNonce1;
+    bool fSubscribed;
+    bool fAuthorized;
+    //! For the log
+    std::string strPeer;
+
+    CStratumSession(uint32_t nExtraNonce1, const uint256& hashShareTargetIn);
+    virtual ~CStratumSession() {}
+
+    /** Result of a request; throws CStratumError to answer with an error */
+    json_spirit::Value Execute(const std::string& strMethod, const json_spirit::Array& params);
+
+protected:
+    /** Hand a solved block over for validation; must not block */
+    virtual void SubmitBlock(const CBlock& block);
+
+private:
+    uint256 hashShareTarget;
+
+    bool Submit(const json_spirit::Array& params);
+};
+
+/** Make job the current one; a new tip drops all older jobs */
+void AddStratumJob(const boost::shared_ptr<CStratumJob>& job, bool fNewTip);
+
+class CBlockIndex;
+
+/** Whether a PoW block can be built on pindexTip for Stratum miners */
+bool IsStratumMiningPossible(const CBlockIndex* pindexTip, bool fInitialDownload);
+
+/** Start listening for Stratum miners; false with strError set on bad options */
+bool StartStratumServer(std::string& strError);
+void StopStratumServer();
+
+#endif // BITCOIN_STRATUM_H
@@ -405,6 +405,46 @@ public:
     }
 };
 
+/** Read-only stream over a byte range it does not own, such as a file mapping,
+ *  so objects are deserialized straight from it. The range must outlive the reader.
+ */
+class CBufferReader
+{
+private:
+    int nType;
+    int nVersion;
+    const char* pch;
+    const char* pend;
+
+public:
+    CBufferReader(const char* pchBegin, size_t nSize, int nTypeIn, int nVersionIn) : nType(nTypeIn), nVersion(nVersionIn), pch(pchBegin), pend(pchBegin + nSize) {}
+
+    //
+    // Stream subset
+    //
+    int GetType() { return nType; }
+    int GetVersion() { return nVersion; }
+    size_t size() const { return pend - pch; }
+    bool empty() const { return pch == pend; }
+
+    CBufferReader& read(char* pchOut, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CBufferReader::read : end of data");
+        memcpy(pchOut, pch, nSize);
+        pch += nSize;
+        return (*this);
+    }
+
+    template <typename T>
+    CBufferReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
 /** Non-refcounted RAII wrapper around a FILE* that implements a ring buffer to
  *  deserialize from. It guarantees the ability to rewind a given number of bytes.
  *
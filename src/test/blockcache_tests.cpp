@@ -0,0 +1,72 @@
+// Copyright (c) 2017-2018 The NanuCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+
+#include "streams.h"
+#include "version.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockcache_tests)
+
+static CBlock MakeBlock(unsigned int nNonce, unsigned int nOutputs)
+{
+    CBlock block;
+    block.nNonce = nNonce;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++)
+        tx.vout[i].scriptPubKey = CScript() << std::vector<unsigned char>(100, i);
+    block.vtx.push_back(tx);
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(blockcache_raw)
+{
+    CBlockCache cache(1 << 20);
+    CBlock block = MakeBlock(1, 10);
+    CCachedBlockRef pblock = cache.Add(uint256(1), block);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    BOOST_CHECK(std::vector<char>(ss.begin(), ss.end()) == pblock->vRaw);
+    BOOST_CHECK(pblock->block.nNonce == 1);
+
+    // Adding the same hash again returns the existing entry
+    BOOST_CHECK(cache.Add(uint256(1), MakeBlock(2, 1)) == pblock);
+    BOOST_CHECK(cache.Get(uint256(1)) == pblock);
+    BOOST_CHECK(!cache.Get(uint256(2)));
+    BOOST_CHECK_EQUAL(cache.Size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(blockcache_eviction)
+{
+    CBlock block = MakeBlock(0, 100);
+    size_t nBlockUsage = CCachedBlock(uint256(0), block).DynamicMemoryUsage();
+    CBlockCache cache(nBlockUsage * 3);
+
+    CCachedBlockRef pfirst = cache.Add(uint256(1), block);
+    cache.Add(uint256(2), block);
+    cache.Add(uint256(3), block);
+    BOOST_CHECK_EQUAL(cache.Size(), 3U);
+
+    // Using block 1 makes block 2 the least recently used
+    BOOST_CHECK(cache.Get(uint256(1)));
+    cache.Add(uint256(4), block);
+    BOOST_CHECK_EQUAL(cache.Size(), 3U);
+    BOOST_CHECK(cache.Get(uint256(1)));
+    BOOST_CHECK(!cache.Get(uint256(2)));
+    BOOST_CHECK(cache.DynamicMemoryUsage() <= nBlockUsage * 3);
+
+    // Evicted entries stay valid for their holders
+    cache.SetMaxUsage(0);
+    BOOST_CHECK_EQUAL(cache.Size(), 0U);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), 0U);
+    BOOST_CHECK(pfirst->hash == uint256(1));
+    BOOST_CHECK_EQUAL(pfirst->block.vtx[0].vout.size(), 100U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
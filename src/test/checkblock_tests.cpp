@@ -14,9 +14,11 @@
 
 #include <cstdio>
 
+#include <boost/bind.hpp>
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 
 BOOST_AUTO_TEST_SUITE(CheckBlock_tests)
@@ -66,4 +68,70 @@ BOOST_AUTO_TEST_CASE(May15)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(cached_block_hash)
+{
+    CBlock block;
+    block.nVersion = 1;
+    block.nTime = 1454124731;
+    block.nBits = 0x1e0ffff0;
+    block.nNonce = 42;
+
+    // Without a memoized value every call hashes the current fields
+    uint256 hash = block.GetHash();
+    BOOST_CHECK(hash == block.ComputeHash());
+    block.nNonce += 1;
+    BOOST_CHECK(block.GetHash() != hash);
+    BOOST_CHECK(block.GetHash() == block.ComputeHash());
+    block.nNonce -= 1;
+    BOOST_CHECK(block.GetHash() == hash);
+
+    // A memoized value is returned as is and kept by copies
+    block.SetCachedHash(hash);
+    BOOST_CHECK(block.GetHash() == hash);
+    BOOST_CHECK(block.GetBlockHeader().GetHash() == hash);
+    CBlock copy(block);
+    BOOST_CHECK(copy.GetHash() == hash);
+    BOOST_CHECK(CBlock(block.GetBlockHeader()).GetHash() == hash);
+
+    // Deserializing into a header drops it
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    CBlock other;
+    other.nTime = 1454124732;
+    other.nBits = 0x1e0ffff0;
+    ss << other;
+    ss >> copy;
+    BOOST_CHECK(copy.GetHash() == other.ComputeHash());
+
+    // And so does SetNull
+    block.SetNull();
+    BOOST_CHECK(block.GetHash() == block.ComputeHash());
+}
+
+static void HashSharedBlock(const CBlock* pblock, const uint256* phash, bool* pfOk)
+{
+    for (int i = 0; i < 100; i++) {
+        CBlock copy(*pblock);
+        if (pblock->GetHash() != *phash || copy.GetHash() != *phash)
+            *pfOk = false;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(cached_block_hash_shared)
+{
+    // Blocks from the block cache are hashed and copied by many threads at once
+    CBlock block;
+    block.nTime = 1454124731;
+    block.nBits = 0x1e0ffff0;
+    const uint256 hash = block.ComputeHash();
+    block.SetCachedHash(hash);
+
+    boost::thread_group threads;
+    bool fOk[4] = {true, true, true, true};
+    for (int i = 0; i < 4; i++)
+        threads.create_thread(boost::bind(&HashSharedBlock, &block, &hash, &fOk[i]));
+    threads.join_all();
+    for (int i = 0; i < 4; i++)
+        BOOST_CHECK(fOk[i]);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
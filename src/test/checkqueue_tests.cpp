@@ -0,0 +1,78 @@
+// Copyright (c) 2017-2018 The NanuCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_AUTO_TEST_SUITE(checkqueue_tests)
+
+static boost::atomic<unsigned int> nChecksRun(0);
+
+struct CTestCheck {
+    bool fOk;
+
+    CTestCheck() : fOk(true) {}
+    explicit CTestCheck(bool fOkIn) : fOk(fOkIn) {}
+
+    bool operator()()
+    {
+        nChecksRun++;
+        return fOk;
+    }
+
+    void swap(CTestCheck& check) { std::swap(fOk, check.fOk); }
+};
+
+static void RunQueue(CCheckQueue<CTestCheck>* pqueue)
+{
+    pqueue->Thread();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_work_stealing)
+{
+    CCheckQueue<CTestCheck> queue(16);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(boost::bind(&RunQueue, &queue));
+
+    for (unsigned int nRound = 0; nRound < 200; nRound++) {
+        nChecksRun = 0;
+        unsigned int nTotal = 0;
+        {
+            CCheckQueueControl<CTestCheck> control(&queue);
+            for (unsigned int nBatch = 0; nBatch < nRound % 7 + 1; nBatch++) {
+                std::vector<CTestCheck> vChecks(nRound % 50 + nBatch);
+                nTotal += vChecks.size();
+                control.Add(vChecks);
+            }
+            BOOST_CHECK(control.Wait());
+        }
+        BOOST_CHECK_EQUAL(nChecksRun, nTotal);
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    // A failure is reported along with the failed check, and everything is
+    // drained, though not necessarily run
+    for (unsigned int nRound = 0; nRound < 50; nRound++) {
+        CCheckQueueControl<CTestCheck> control(&queue);
+        std::vector<CTestCheck> vChecks(500);
+        vChecks[nRound * 7].fOk = false;
+        control.Add(vChecks);
+        CTestCheck checkFailed;
+        BOOST_CHECK(!control.Wait(&checkFailed));
+        BOOST_CHECK(!checkFailed.fOk);
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
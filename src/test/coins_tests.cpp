@@ -4,6 +4,7 @@
 
 #include "coins.h"
 #include "random.h"
+#include "txdb.h"
 #include "uint256.h"
 
 #include <vector>
@@ -58,6 +59,23 @@ public:
 
     bool GetStats(CCoinsStats& stats) const { return false; }
 };
+
+class CCoinsViewCacheTest : public CCoinsViewCache
+{
+public:
+    CCoinsViewCacheTest(CCoinsView* base) : CCoinsViewCache(base) {}
+
+    void SelfTest() const
+    {
+        // Manually recompute the dynamic usage of the whole data, and compare it.
+        size_t ret = memusage::DynamicUsage(cacheCoins);
+        for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
+            ret += it->second.coins.DynamicMemoryUsage();
+            ret += memusage::DynamicUsage(it->second.vParentUnspent);
+        }
+        BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
+    }
+};
 }
 
 BOOST_AUTO_TEST_SUITE(coins_tests)
@@ -89,8 +107,8 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
-    std::vector<CCoinsViewCache*> stack; // A stack of CCoinsViewCaches on top.
-    stack.push_back(new CCoinsViewCache(&base)); // Start with one cache.
+    std::vector<CCoinsViewCacheTest*> stack; // A stack of CCoinsViewCaches on top.
+    stack.push_back(new CCoinsViewCacheTest(&base)); // Start with one cache.
 
     // Use a limited set of random transaction ids, so we do test overwriting entries.
     std::vector<uint256> txids;
@@ -115,6 +133,8 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 coins.nVersion = insecure_rand();
                 coins.vout.resize(1);
                 coins.vout[0].nValue = insecure_rand();
+                std::vector<unsigned char> vchScript(insecure_rand() % 64, OP_NOP);
+                coins.vout[0].scriptPubKey = CScript(vchScript.begin(), vchScript.end());
                 *entry = coins;
             } else {
                 coins.Clear();
@@ -135,6 +155,9 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                     missed_an_entry = true;
                 }
             }
+            BOOST_FOREACH (const CCoinsViewCacheTest* test, stack) {
+                test->SelfTest();
+            }
         }
 
         if (insecure_rand() % 100 == 0) {
@@ -151,7 +174,7 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
                 } else {
                     removed_all_caches = true;
                 }
-                stack.push_back(new CCoinsViewCache(tip));
+                stack.push_back(new CCoinsViewCacheTest(tip));
                 if (stack.size() == 4) {
                     reached_4_caches = true;
                 }
@@ -175,4 +198,136 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+BOOST_AUTO_TEST_CASE(coins_cache_prefetch)
+{
+    CCoinsViewTest base;
+    CCoinsViewCache cache(&base);
+    uint256 txidDirty = GetRandHash();
+    uint256 txidNew = GetRandHash();
+
+    // A modified entry wins over what was read from the base view
+    {
+        CCoinsModifier modifier = cache.ModifyCoins(txidDirty);
+        modifier->nVersion = 2;
+        modifier->vout.resize(1);
+        modifier->vout[0].nValue = 7;
+    }
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.vout.resize(1);
+    coins.vout[0].nValue = 5;
+    BOOST_CHECK(!cache.AddPrefetched(txidDirty, coins));
+    BOOST_CHECK_EQUAL(cache.AccessCoins(txidDirty)->nVersion, 2);
+
+    BOOST_CHECK(cache.AddPrefetched(txidNew, coins));
+    BOOST_CHECK_EQUAL(cache.AccessCoins(txidNew)->vout[0].nValue, 5);
+
+    coins.vout.resize(1);
+    coins.vout[0].nValue = 6;
+    BOOST_CHECK(!cache.AddPrefetched(txidNew, coins));
+    BOOST_CHECK_EQUAL(cache.AccessCoins(txidNew)->vout[0].nValue, 5);
+
+    BOOST_CHECK(cache.Flush());
+    CCoins coinsBase;
+    BOOST_CHECK(base.GetCoins(txidDirty, coinsBase));
+    BOOST_CHECK_EQUAL(coinsBase.nVersion, 2);
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_per_output)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    BOOST_CHECK(db.SetPerOutput(true));
+    BOOST_CHECK(db.IsPerOutput());
+
+    uint256 txid = GetRandHash();
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.nHeight = 1234;
+    coins.fCoinStake = true;
+    coins.vout.resize(300);
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        coins.vout[i].nValue = i + 1;
+        coins.vout[i].scriptPubKey.assign(insecure_rand() % 64 + 1, (unsigned char)i);
+    }
+    {
+        CCoinsViewCache cache(&db);
+        *cache.ModifyCoins(txid) = coins;
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+    CCoins read;
+    BOOST_CHECK(db.GetCoins(txid, read));
+    BOOST_CHECK(read == coins);
+
+    // Spend a few outputs, including the last one
+    unsigned int nSpend[] = {0, 5, 299};
+    {
+        CCoinsViewCache cache(&db);
+        BOOST_FOREACH (unsigned int n, nSpend) {
+            BOOST_CHECK(cache.ModifyCoins(txid)->Spend(n));
+            BOOST_CHECK(coins.Spend(n));
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(db.GetCoins(txid, read));
+    BOOST_CHECK(read == coins);
+
+    // Converting back and forth keeps the coins
+    BOOST_CHECK(db.SetPerOutput(false));
+    BOOST_CHECK(db.GetCoins(txid, read));
+    BOOST_CHECK(read == coins);
+    BOOST_CHECK(db.SetPerOutput(true));
+    BOOST_CHECK(db.GetCoins(txid, read));
+    BOOST_CHECK(read == coins);
+
+    // A cursor walks the same coins in either layout
+    for (int i = 0; i < 2; i++) {
+        boost::scoped_ptr<CCoinsViewDBCursor> pcursor(db.Cursor());
+        uint256 txidRead;
+        BOOST_CHECK(pcursor->Next(txidRead, read));
+        BOOST_CHECK(txidRead == txid);
+        BOOST_CHECK(read == coins);
+        BOOST_CHECK(!pcursor->Next(txidRead, read));
+        BOOST_CHECK(db.SetPerOutput(i != 0));
+    }
+
+    // Spends and restored outputs in a child cache reach the database through its parent
+    {
+        CCoinsViewCache cache(&db);
+        BOOST_CHECK(cache.AccessCoins(txid));
+        CCoinsViewCache child(&cache);
+        BOOST_CHECK(child.ModifyCoins(txid)->Spend(7));
+        BOOST_CHECK(coins.Spend(7));
+        child.ModifyCoins(txid)->vout[5] = CTxOut(42, CScript() << OP_TRUE);
+        coins.vout[5] = CTxOut(42, CScript() << OP_TRUE);
+        BOOST_CHECK(child.Flush());
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(db.GetCoins(txid, read));
+    BOOST_CHECK(read == coins);
+
+    // A transaction spent entirely and added again replaces all of its outputs
+    {
+        CCoinsViewCache cache(&db);
+        cache.ModifyCoins(txid)->Clear();
+        coins.nHeight = 2345;
+        coins.vout.resize(10);
+        for (unsigned int i = 0; i < coins.vout.size(); i++)
+            coins.vout[i] = CTxOut(i + 1000, CScript() << OP_TRUE);
+        *cache.ModifyCoins(txid) = coins;
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(db.GetCoins(txid, read));
+    BOOST_CHECK(read == coins);
+
+    // Spending the rest removes the transaction
+    {
+        CCoinsViewCache cache(&db);
+        cache.ModifyCoins(txid)->Clear();
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!db.HaveCoins(txid));
+    BOOST_CHECK(!db.GetCoins(txid, read));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,8 +2,10 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "crypto/common.h"
 #include "hash.h"
 #include "utilstrencodings.h"
+#include "xevan.h"
 
 #include <vector>
 
@@ -46,4 +48,60 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+BOOST_AUTO_TEST_CASE(xevan_batch)
+{
+    const unsigned char zero[80] = {};
+    const std::string fox = "The quick brown fox jumps over the lazy dog";
+    const uint256 hashEmpty = uint256("b3c4d6d629be1849fbb5012b3cd9e01a487dcdd817b3ee7369b39e44c956264b");
+    const uint256 hashZero = uint256("f44677961234375b9651b90450c916989614784e6fecb3ca8919f8582a762c81");
+    const uint256 hashFox = uint256("63049293aab379151126e4c2a4aa090b5f3d7edfb4ed7b248eafe9e4a0d937fe");
+
+    // Portable code first, then whatever XEVANAutoDetect() selects for this CPU
+    for (int nPass = 0; nPass < 2; nPass++) {
+        if (nPass == 1)
+            BOOST_TEST_MESSAGE("XEVAN implementation: " + XEVANAutoDetect());
+
+        BOOST_CHECK(XEVAN(zero, zero) == hashEmpty);
+        BOOST_CHECK(XEVAN(zero, zero + sizeof(zero)) == hashZero);
+        BOOST_CHECK(XEVAN(fox.begin(), fox.end()) == hashFox);
+
+        // Every input of a batch must match its single-input hash
+        const unsigned char* pinput[XEVAN_MAX_BATCH];
+        size_t plen[XEVAN_MAX_BATCH];
+        uint256 hashes[XEVAN_MAX_BATCH];
+        for (unsigned int i = 0; i < XEVAN_MAX_BATCH; i++) {
+            pinput[i] = (i % 2) ? zero : (const unsigned char*)fox.data();
+            plen[i] = (i % 2) ? sizeof(zero) : fox.size();
+        }
+        plen[XEVAN_MAX_BATCH - 1] = 0;
+        XEVANBatch(pinput, plen, hashes, XEVAN_MAX_BATCH);
+        for (unsigned int i = 0; i < XEVAN_MAX_BATCH - 1; i++)
+            BOOST_CHECK(hashes[i] == ((i % 2) ? hashZero : hashFox));
+        BOOST_CHECK(hashes[XEVAN_MAX_BATCH - 1] == hashEmpty);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(xevan_header_fixed)
+{
+    unsigned char header[CXevanHasher::HEADER_SIZE];
+    for (unsigned int i = 0; i < sizeof(header); i++)
+        header[i] = (unsigned char)(i * 7 + 3);
+
+    CXevanHasher hasher;
+    BOOST_CHECK(hasher.HashHeader(header) == XEVAN(header, header + sizeof(header)));
+
+    // A batch of headers that differ only in nNonce, as the miner hashes them
+    unsigned char batch[XEVAN_MAX_BATCH][CXevanHasher::HEADER_SIZE];
+    const unsigned char* pinput[XEVAN_MAX_BATCH];
+    uint256 hashes[XEVAN_MAX_BATCH];
+    for (unsigned int i = 0; i < XEVAN_MAX_BATCH; i++) {
+        memcpy(batch[i], header, sizeof(header));
+        WriteLE32(batch[i] + CXevanHasher::HEADER_SIZE - 4, 0xfffffffc + i);
+        pinput[i] = batch[i];
+    }
+    hasher.HashFixed<CXevanHasher::HEADER_SIZE>(pinput, hashes, XEVAN_MAX_BATCH);
+    for (unsigned int i = 0; i < XEVAN_MAX_BATCH; i++)
+        BOOST_CHECK(hashes[i] == XEVAN(batch[i], batch[i] + sizeof(batch[i])));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
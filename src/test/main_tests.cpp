@@ -5,7 +5,12 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "primitives/transaction.h"
+#include "chainparams.h"
+#include "checkpoints.h"
 #include "main.h"
+#include "pow.h"
+#include "random.h"
+#include "txdb.h"
 
 #include <boost/test/unit_test.hpp>
 
@@ -24,4 +29,288 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK(nSum == 2099999997690000ULL);
 }
 
+BOOST_AUTO_TEST_CASE(raw_block_read)
+{
+    // The genesis block was written to disk by the test setup
+    LOCK(cs_main);
+    std::vector<char> vRaw;
+    BOOST_CHECK(ReadRawBlockFromDisk(vRaw, chainActive.Genesis()->GetBlockPos()));
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << Params().GenesisBlock();
+    BOOST_CHECK(std::vector<char>(ss.begin(), ss.end()) == vRaw);
+
+    // A position that is not the start of a block is refused
+    CDiskBlockPos pos = chainActive.Genesis()->GetBlockPos();
+    pos.nPos += 1;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vRaw, pos));
+
+    // Reading by index also checks the header against the index
+    BOOST_CHECK(ReadRawBlockFromDisk(vRaw, chainActive.Genesis()));
+    CBlockIndex index(*chainActive.Genesis());
+    index.nNonce++;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vRaw, &index));
+}
+
+/** Turns the block file mapper off again however a test case ends */
+struct BlockFileMapperReset {
+    ~BlockFileMapperReset()
+    {
+        blockFileMapper.SetFinishedFiles(0);
+        blockFileMapper.SetEnabled(false);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(mapped_block_read)
+{
+    // Treat the file holding the genesis block as finished, so reads go through a mapping
+    LOCK(cs_main);
+    CDiskBlockPos pos = chainActive.Genesis()->GetBlockPos();
+    BlockFileMapperReset reset;
+    blockFileMapper.SetEnabled(true);
+    blockFileMapper.SetFinishedFiles(pos.nFile + 1);
+#ifndef WIN32
+    // Files are mapped wherever there is mmap and a 64-bit address space
+    if (sizeof(void*) >= 8)
+        BOOST_REQUIRE(blockFileMapper.Get(pos.nFile, false, pos.nPos, false));
+#endif
+
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, pos));
+    BOOST_CHECK(block.GetHash() == Params().GenesisBlock().GetHash());
+
+    std::vector<char> vRaw;
+    BOOST_CHECK(ReadRawBlockFromDisk(vRaw, pos));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << Params().GenesisBlock();
+    BOOST_CHECK(std::vector<char>(ss.begin(), ss.end()) == vRaw);
+
+    pos.nPos += 1;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vRaw, pos));
+}
+
+/** Point the chain state at other databases, starting from an empty block index */
+static void SwitchChainState(CBlockTreeDB* pblocktreeIn, CCoinsViewDB* pcoinsdbviewIn, CCoinsViewCache* pcoinsTipIn)
+{
+    UnloadBlockIndex();
+    LOCK(cs_main);
+    pindexBestHeader = NULL;
+    pblocktree = pblocktreeIn;
+    pcoinsdbview = pcoinsdbviewIn;
+    pcoinsTip = pcoinsTipIn;
+}
+
+BOOST_AUTO_TEST_CASE(utxo_snapshot_roundtrip)
+{
+    CBlockTreeDB* pblocktreeOrig = pblocktree;
+    CCoinsViewDB* pcoinsdbviewOrig = pcoinsdbview;
+    CCoinsViewCache* pcoinsTipOrig = pcoinsTip;
+    seed_insecure_rand(true);
+
+    // A few blocks on top of genesis and some coins at their tip
+    CBlockTreeDB blocktreeSource(1 << 20, true);
+    CCoinsViewDB coinsdbSource(1 << 23, true);
+    CCoinsViewCache coinsSource(&coinsdbSource);
+    SwitchChainState(&blocktreeSource, &coinsdbSource, &coinsSource);
+    BOOST_REQUIRE(InitBlockIndex());
+    std::vector<uint64_t> vStakeModifier;
+    CBlockIndex indexTipSource;
+    {
+        LOCK(cs_main);
+        CBlockIndex* pindexPrev = chainActive.Tip();
+        for (int nHeight = 1; nHeight <= 3; nHeight++) {
+            CBlock block;
+            block.nVersion = pindexPrev->nVersion;
+            block.hashPrevBlock = pindexPrev->GetBlockHash();
+            block.hashMerkleRoot = GetRandHash();
+            block.nTime = pindexPrev->nTime + 60;
+            block.nBits = pindexPrev->nBits;
+            // Snapshot headers have to meet their claimed work
+            while (!CheckProofOfWork(block.GetHash(), block.nBits))
+                block.nNonce++;
+            CBlockIndex* pindex = new CBlockIndex(block);
+            BlockMap::iterator mi = mapBlockIndex.insert(std::make_pair(block.GetHash(), pindex)).first;
+            pindex->phashBlock = &mi->first;
+            pindex->pprev = pindexPrev;
+            pindex->nHeight = nHeight;
+            pindex->nTx = 1;
+            pindex->nChainTx = pindexPrev->nChainTx + 1;
+            pindex->nChainWork = pindexPrev->nChainWork + GetBlockProof(*pindex);
+            pindex->nStatus = BLOCK_VALID_SCRIPTS;
+            pindex->SetStakeModifier(((uint64_t)insecure_rand() << 32) | insecure_rand(), true);
+            pindex->BuildSkip();
+            vStakeModifier.push_back(pindex->nStakeModifier);
+            chainActive.SetTip(pindex);
+            pindexPrev = pindex;
+        }
+        for (int i = 0; i < 20; i++) {
+            CCoinsModifier coins = pcoinsTip->ModifyCoins(GetRandHash());
+            coins->nVersion = 1;
+            coins->nHeight = 1 + i % 3;
+            coins->vout.resize(1 + i % 4);
+            for (unsigned int j = 0; j < coins->vout.size(); j++) {
+                coins->vout[j].nValue = (i + j + 1) * COIN;
+                coins->vout[j].scriptPubKey = CScript() << OP_TRUE;
+            }
+        }
+        pcoinsTip->SetBestBlock(chainActive.Tip()->GetBlockHash());
+        indexTipSource = *chainActive.Tip();
+    }
+
+    boost::filesystem::path path = GetDataDir() / "utxo_snapshot_roundtrip.dat";
+    CUTXOSnapshotInfo info;
+    std::string strError;
+    BOOST_REQUIRE_MESSAGE(DumpUTXOSnapshot(path, info, strError), strError);
+    BOOST_CHECK_EQUAL(info.nHeight, 3);
+    BOOST_CHECK_EQUAL(info.nTransactions, 20U);
+    CCoinsStats statsSource;
+    BOOST_REQUIRE(coinsdbSource.GetStats(statsSource));
+
+    // A fresh chain state adopts the same coins and tip
+    CBlockTreeDB blocktreeLoaded(1 << 20, true);
+    CCoinsViewDB coinsdbLoaded(1 << 23, true);
+    CCoinsViewCache coinsLoaded(&coinsdbLoaded);
+    SwitchChainState(&blocktreeLoaded, &coinsdbLoaded, &coinsLoaded);
+    BOOST_REQUIRE(InitBlockIndex());
+    CUTXOSnapshotInfo infoLoaded;
+    // Not with a transaction index, which would lack the transactions below the snapshot
+    const bool fTxIndexOrig = fTxIndex;
+    fTxIndex = true;
+    BOOST_CHECK(!LoadUTXOSnapshot(path, info.hashSnapshot, infoLoaded, strError));
+    fTxIndex = false;
+    // Nor without the checksum to hold the file to
+    BOOST_CHECK(!LoadUTXOSnapshot(path, uint256(0), infoLoaded, strError));
+    // Loading ends with CheckBlockIndex, which asserts on the blocks without data it leaves
+    BOOST_REQUIRE(fCheckBlockIndex);
+    BOOST_REQUIRE_MESSAGE(LoadUTXOSnapshot(path, info.hashSnapshot, infoLoaded, strError), strError);
+    fTxIndex = fTxIndexOrig;
+    BOOST_CHECK(infoLoaded.hashBlock == info.hashBlock);
+
+    CCoinsStats statsLoaded;
+    BOOST_REQUIRE(coinsdbLoaded.GetStats(statsLoaded));
+    BOOST_CHECK(statsLoaded.hashBlock == statsSource.hashBlock);
+    BOOST_CHECK_EQUAL(statsLoaded.nHeight, statsSource.nHeight);
+    BOOST_CHECK_EQUAL(statsLoaded.nTransactions, statsSource.nTransactions);
+    BOOST_CHECK_EQUAL(statsLoaded.nTransactionOutputs, statsSource.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(statsLoaded.nTotalAmount, statsSource.nTotalAmount);
+    BOOST_CHECK(statsLoaded.hashSerialized == statsSource.hashSerialized);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == info.hashBlock);
+        BOOST_CHECK_EQUAL(chainActive.Height(), indexTipSource.nHeight);
+        BOOST_CHECK(chainActive.Tip()->nChainWork == indexTipSource.nChainWork);
+        BOOST_CHECK_EQUAL(chainActive.Tip()->nChainTx, indexTipSource.nChainTx);
+        for (int nHeight = 1; nHeight <= chainActive.Height(); nHeight++)
+            BOOST_CHECK_EQUAL(chainActive[nHeight]->nStakeModifier, vStakeModifier[nHeight - 1]);
+    }
+    // The node stays on the snapshot's tip
+    CValidationState state;
+    BOOST_CHECK(ActivateBestChain(state));
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == info.hashBlock);
+    {
+        // Nothing below the snapshot's tip can be reorganized away
+        LOCK(cs_main);
+        for (int nHeight = 1; nHeight <= chainActive.Height(); nHeight++) {
+            CBlockHeader header;
+            header.nVersion = chainActive[nHeight]->nVersion;
+            header.hashPrevBlock = chainActive[nHeight - 1]->GetBlockHash();
+            header.hashMerkleRoot = GetRandHash();
+            header.nTime = chainActive[nHeight]->nTime + 1;
+            header.nBits = chainActive[nHeight]->nBits;
+            CValidationState stateFork;
+            int nDoS = 0;
+            BOOST_CHECK(!ContextualCheckBlockHeader(header, stateFork, chainActive[nHeight - 1]));
+            BOOST_CHECK(stateFork.IsInvalid(nDoS) && nDoS == 100);
+            BOOST_CHECK_EQUAL(stateFork.GetRejectReason(), "bad-fork-prior-to-snapshot");
+        }
+        CValidationState stateInvalidate;
+        BOOST_CHECK(!InvalidateBlock(stateInvalidate, chainActive[2]));
+        BOOST_CHECK(!(chainActive[2]->nStatus & BLOCK_FAILED_MASK));
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == info.hashBlock);
+    }
+
+    SwitchChainState(pblocktreeOrig, pcoinsdbviewOrig, pcoinsTipOrig);
+    BOOST_CHECK(LoadBlockIndex());
+}
+
+BOOST_AUTO_TEST_CASE(assumevalid_unindexed)
+{
+    // A chain through the built-in checkpoints, connected while the assumed
+    // block at a later checkpoint is not yet in mapBlockIndex
+    const Checkpoints::MapCheckpoints& checkpoints = *Params().Checkpoints().mapCheckpoints;
+    const int nAssumedHeight = 710;
+    BOOST_REQUIRE(checkpoints.count(nAssumedHeight));
+    const uint256 hashAssumed = checkpoints.find(nAssumedHeight)->second;
+    BOOST_REQUIRE(!mapBlockIndex.count(hashAssumed));
+
+    std::vector<uint256> vHashMain(1000);
+    std::vector<CBlockIndex> vBlocksMain(1000);
+    for (unsigned int i = 0; i < vBlocksMain.size(); i++) {
+        vHashMain[i] = checkpoints.count(i) ? checkpoints.find(i)->second : GetRandHash();
+        vBlocksMain[i].nHeight = i;
+        vBlocksMain[i].pprev = i ? &vBlocksMain[i - 1] : NULL;
+        vBlocksMain[i].phashBlock = &vHashMain[i];
+        vBlocksMain[i].BuildSkip();
+    }
+
+    // A side chain forking off between the checkpoints at 85 and 275
+    std::vector<uint256> vHashSide(400);
+    std::vector<CBlockIndex> vBlocksSide(400);
+    for (unsigned int i = 0; i < vBlocksSide.size(); i++) {
+        vHashSide[i] = GetRandHash();
+        vBlocksSide[i].nHeight = i + 201;
+        vBlocksSide[i].pprev = i ? &vBlocksSide[i - 1] : &vBlocksMain[200];
+        vBlocksSide[i].phashBlock = &vHashSide[i];
+        vBlocksSide[i].BuildSkip();
+    }
+
+    LOCK(cs_main);
+    const uint256 hashAssumeValidOrig = hashAssumeValid;
+    CBlockIndex* pindexBestHeaderOrig = pindexBestHeader;
+    hashAssumeValid = hashAssumed;
+    pindexBestHeader = &vBlocksMain[999];
+
+    // Nothing is skipped before a checkpoint below the assumed block is indexed
+    BOOST_CHECK(!IsAssumedValid(&vBlocksMain[100]));
+
+    // Then scripts are skipped up to and including that checkpoint
+    mapBlockIndex[vHashMain[275]] = &vBlocksMain[275];
+    BOOST_CHECK(IsAssumedValid(&vBlocksMain[0]));
+    BOOST_CHECK(IsAssumedValid(&vBlocksMain[100]));
+    BOOST_CHECK(IsAssumedValid(&vBlocksMain[275]));
+    BOOST_CHECK(!IsAssumedValid(&vBlocksMain[276]));
+    BOOST_CHECK(!IsAssumedValid(&vBlocksMain[nAssumedHeight]));
+
+    // A side block between two checkpoints can not lead to the assumed block
+    BOOST_CHECK(!IsAssumedValid(&vBlocksSide[49]));
+    BOOST_CHECK(!IsAssumedValid(&vBlocksSide[100]));
+
+    // Nor does anything below the checkpoint when the best header leaves it
+    pindexBestHeader = &vBlocksSide[399];
+    BOOST_CHECK(!IsAssumedValid(&vBlocksMain[100]));
+    pindexBestHeader = &vBlocksMain[999];
+
+    // Once indexed, the assumed block itself is the boundary
+    mapBlockIndex[hashAssumed] = &vBlocksMain[nAssumedHeight];
+    BOOST_CHECK(IsAssumedValid(&vBlocksMain[nAssumedHeight - 1]));
+    BOOST_CHECK(IsAssumedValid(&vBlocksMain[nAssumedHeight]));
+    BOOST_CHECK(!IsAssumedValid(&vBlocksMain[nAssumedHeight + 1]));
+    BOOST_CHECK(!IsAssumedValid(&vBlocksSide[49]));
+    mapBlockIndex.erase(hashAssumed);
+
+    // An assumed block that is neither indexed nor a checkpoint skips nothing
+    hashAssumeValid = GetRandHash();
+    BOOST_CHECK(!IsAssumedValid(&vBlocksMain[100]));
+
+    // Nor does a checkpoint once checkpoints are disabled
+    hashAssumeValid = hashAssumed;
+    Checkpoints::fEnabled = false;
+    BOOST_CHECK(!IsAssumedValid(&vBlocksMain[100]));
+    Checkpoints::fEnabled = true;
+
+    mapBlockIndex.erase(vHashMain[275]);
+    pindexBestHeader = pindexBestHeaderOrig;
+    hashAssumeValid = hashAssumeValidOrig;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
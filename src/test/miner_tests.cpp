@@ -264,4 +264,25 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     Checkpoints::fEnabled = true;
 }
 
+BOOST_AUTO_TEST_CASE(nonce_slices)
+{
+    // The last slice ends at 2^32 and must run out rather than wrap back to 0
+    CNonceSlice slice(3, 4);
+    BOOST_CHECK_EQUAL(slice.nBegin, 0xC0000000ULL);
+    BOOST_CHECK_EQUAL(slice.nEnd, 0x100000000ULL);
+    slice.nNext = slice.nEnd - 512;
+    uint32_t nFirst;
+    BOOST_CHECK(slice.Take(256, nFirst));
+    BOOST_CHECK_EQUAL(nFirst, 0xFFFFFE00U);
+    BOOST_CHECK(slice.Take(256, nFirst));
+    BOOST_CHECK_EQUAL(nFirst, 0xFFFFFF00U);
+    BOOST_CHECK(!slice.Take(256, nFirst));
+    BOOST_CHECK(!slice.Take(1, nFirst));
+
+    // Slices cover the range without gaps
+    for (unsigned int n = 0; n < 2; n++)
+        BOOST_CHECK_EQUAL(CNonceSlice(n, 3).nEnd, CNonceSlice(n + 1, 3).nBegin);
+    BOOST_CHECK_EQUAL(CNonceSlice(2, 3).nEnd, 0x100000000ULL);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
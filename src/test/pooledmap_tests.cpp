@@ -0,0 +1,94 @@
+// Copyright (c) 2017-2018 The NanuCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "pooledmap.h"
+
+#include "random.h"
+
+#include <map>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(pooledmap_tests)
+
+struct CTestHasher {
+    // Few distinct hashes, so probe chains and tombstones get exercised
+    size_t operator()(unsigned int k) const { return k % 37; }
+};
+
+typedef pooledmap<unsigned int, std::string, CTestHasher> CTestMap;
+
+BOOST_AUTO_TEST_CASE(pooledmap_random)
+{
+    CTestMap map;
+    std::map<unsigned int, std::string> mapRef;
+
+    for (unsigned int i = 0; i < 20000; i++) {
+        unsigned int k = insecure_rand() % 2000;
+        switch (insecure_rand() % 4) {
+        case 0:
+        case 1: {
+            std::string str(insecure_rand() % 40, 'a' + k % 26);
+            std::pair<CTestMap::iterator, bool> ret = map.insert(std::make_pair(k, str));
+            BOOST_CHECK_EQUAL(ret.second, mapRef.insert(std::make_pair(k, str)).second);
+            BOOST_CHECK_EQUAL(ret.first->second, mapRef[k]);
+            break;
+        }
+        case 2:
+            BOOST_CHECK_EQUAL(map.erase(k), mapRef.erase(k));
+            break;
+        case 3:
+            map[k] += "x";
+            mapRef[k] += "x";
+            break;
+        }
+        BOOST_CHECK_EQUAL(map.size(), mapRef.size());
+    }
+
+    size_t nCount = 0;
+    for (CTestMap::const_iterator it = map.begin(); it != map.end(); it++) {
+        BOOST_CHECK(mapRef.count(it->first));
+        BOOST_CHECK_EQUAL(it->second, mapRef[it->first]);
+        nCount++;
+    }
+    BOOST_CHECK_EQUAL(nCount, mapRef.size());
+    BOOST_CHECK(map.DynamicMemoryUsage() > 0);
+
+    // Erase every other element while iterating
+    for (CTestMap::iterator it = map.begin(); it != map.end();) {
+        if (it->first % 2)
+            map.erase(it++);
+        else
+            it++;
+    }
+    for (std::map<unsigned int, std::string>::iterator it = mapRef.begin(); it != mapRef.end(); it++)
+        BOOST_CHECK_EQUAL(map.count(it->first), (size_t)(it->first % 2 == 0));
+
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+    BOOST_CHECK(map.find(0) == map.end());
+}
+
+BOOST_AUTO_TEST_CASE(pooledmap_stable_elements)
+{
+    CTestMap map;
+    std::string* pstr = &map[7];
+    *pstr = "seven";
+    CTestMap::iterator it = map.find(7);
+
+    // Growing the table moves slots but not elements
+    for (unsigned int k = 100; k < 10000; k++)
+        map[k] = "filler";
+    BOOST_CHECK_EQUAL(pstr, &map[7]);
+    BOOST_CHECK_EQUAL(*pstr, "seven");
+
+    // An iterator taken before the table grew can still be erased
+    map.erase(it);
+    BOOST_CHECK(map.find(7) == map.end());
+    BOOST_CHECK_EQUAL(map.size(), 9900U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,160 @@
+// Copyright (c) 2017-2018 The NanuCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "kernel.h"
+#include "main.h"
+#include "random.h"
+
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+BOOST_AUTO_TEST_SUITE(stakemodifier_tests)
+
+// What GetKernelStakeModifier used to find by walking chainActive
+static const CBlockIndex* WalkChain(int nHeightFrom, int64_t nTime)
+{
+    for (int nHeight = nHeightFrom + 1; nHeight <= chainActive.Height(); nHeight++) {
+        const CBlockIndex* pindex = chainActive[nHeight];
+        if (pindex->GeneratedStakeModifier() && pindex->GetBlockTime() >= nTime)
+            return pindex;
+    }
+    return NULL;
+}
+
+BOOST_AUTO_TEST_CASE(stake_modifier_index)
+{
+    LOCK(cs_main);
+    CBlockIndex* pindexTipOrig = chainActive.Tip();
+    seed_insecure_rand(true);
+
+    // Block times jitter around a 60 second spacing, so they are not monotonic
+    std::vector<CBlockIndex> vIndex(1000);
+    for (unsigned int i = 0; i < vIndex.size(); i++) {
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = (i == 0) ? NULL : &vIndex[i - 1];
+        vIndex[i].nTime = 1500000000 + 60 * i + insecure_rand() % 600;
+        vIndex[i].SetStakeModifier(i, insecure_rand() % 3 != 0);
+    }
+
+    CStakeModifierIndex index;
+    for (unsigned int nTip = 0; nTip < vIndex.size(); nTip += 97) {
+        // Resync after the chain moved outside Connect/Disconnect
+        chainActive.SetTip(&vIndex[nTip]);
+        index.Sync();
+        for (int i = 0; i < 200; i++) {
+            int nHeightFrom = insecure_rand() % (nTip + 1);
+            int64_t nTime = vIndex[nHeightFrom].GetBlockTime() + insecure_rand() % 3000;
+            BOOST_CHECK(index.Find(nHeightFrom, nTime) == WalkChain(nHeightFrom, nTime));
+        }
+    }
+
+    // Incremental updates, as done by ConnectTip/DisconnectTip
+    for (unsigned int nTip = vIndex.size() - 1; nTip > 500; nTip--) {
+        chainActive.SetTip(&vIndex[nTip - 1]);
+        index.Disconnect(&vIndex[nTip]);
+    }
+    for (unsigned int nTip = 501; nTip < 700; nTip++) {
+        chainActive.SetTip(&vIndex[nTip]);
+        index.Connect(&vIndex[nTip]);
+        int nHeightFrom = insecure_rand() % (nTip + 1);
+        int64_t nTime = vIndex[nHeightFrom].GetBlockTime() + insecure_rand() % 3000;
+        BOOST_CHECK(index.Find(nHeightFrom, nTime) == WalkChain(nHeightFrom, nTime));
+    }
+
+    chainActive.SetTip(pindexTipOrig);
+}
+
+BOOST_AUTO_TEST_CASE(stake_kernel_prefix)
+{
+    seed_insecure_rand(true);
+    for (int i = 0; i < 200; i++) {
+        uint64_t nStakeModifier = ((uint64_t)insecure_rand() << 32) | insecure_rand();
+        unsigned int nTimeBlockFrom = insecure_rand();
+        COutPoint prevout(GetRandHash(), insecure_rand() % 16);
+        int64_t nValueIn = ((int64_t)(insecure_rand() % 100000)) * COIN;
+        // Keep the target near the hash range so both outcomes occur
+        unsigned int nBits = 0x1d00ffff + (insecure_rand() % 4) * 0x01000000;
+        uint256 bnTargetPerCoinDay;
+        bnTargetPerCoinDay.SetCompact(nBits);
+
+        CStakeKernel kernel(nStakeModifier, nTimeBlockFrom, prevout, nValueIn, nBits);
+        for (unsigned int nTimeTx = nTimeBlockFrom; nTimeTx < nTimeBlockFrom + 4; nTimeTx++) {
+            uint256 hash = stakeHash(nTimeTx, nStakeModifier, prevout.n, prevout.hash, nTimeBlockFrom);
+            BOOST_CHECK(kernel.GetHash(nTimeTx) == hash);
+            BOOST_CHECK_EQUAL(kernel.IsTargetHit(hash), stakeTargetHit(hash, nValueIn, bnTargetPerCoinDay));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stake_kernel_parallel_search)
+{
+    LOCK(cs_main);
+    CBlockIndex* pindexTipOrig = chainActive.Tip();
+    seed_insecure_rand(true);
+
+    std::vector<CBlockIndex> vIndex(200);
+    for (unsigned int i = 0; i < vIndex.size(); i++) {
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = (i == 0) ? NULL : &vIndex[i - 1];
+        vIndex[i].nTime = 1500000000 + 60 * i;
+        vIndex[i].SetStakeModifier(((uint64_t)insecure_rand() << 32) | insecure_rand(), true);
+    }
+    chainActive.SetTip(&vIndex.back());
+    stakeModifierIndex.Sync();
+    unsigned int nTimeTx = chainActive.Tip()->GetBlockTime();
+
+    std::vector<CStakeCandidate> vCandidates;
+    for (int i = 0; i < 400; i++) {
+        const CBlockIndex* pindexFrom = &vIndex[insecure_rand() % 50];
+        uint64_t nStakeModifier = 0;
+        int nStakeModifierHeight = 0;
+        int64_t nStakeModifierTime = 0;
+        BOOST_REQUIRE(GetKernelStakeModifier(pindexFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false));
+        vCandidates.push_back(CStakeCandidate(pindexFrom, nStakeModifier, 100 * COIN, COutPoint(GetRandHash(), i % 3)));
+    }
+
+    // From almost no kernels to a kernel every few candidates
+    const unsigned int vBits[] = {0x1b00ffff, 0x1c00ffff, 0x1c7fffff};
+    BOOST_FOREACH(unsigned int nBits, vBits) {
+        size_t nFoundSerial = 0;
+        unsigned int nTimeSerial = 0;
+        uint256 hashSerial;
+        bool fSerial = SearchStakeKernels(vCandidates, nBits, nTimeTx, 45, 0, nStakeTipUpdates, nFoundSerial, nTimeSerial, hashSerial);
+
+        // Any number of workers must settle on the kernel a serial sweep finds
+        for (int nThreads = 2; nThreads <= 8; nThreads *= 2) {
+            boost::thread_group threadGroup;
+            for (int i = 1; i < nThreads; i++)
+                threadGroup.create_thread(&ThreadStakeSearch);
+            // The same workers serve consecutive searches
+            for (int nRun = 0; nRun < 3; nRun++) {
+                size_t nFound = 0;
+                unsigned int nTime = 0;
+                uint256 hash;
+                BOOST_CHECK_EQUAL(SearchStakeKernels(vCandidates, nBits, nTimeTx, 45, 0, nStakeTipUpdates, nFound, nTime, hash), fSerial);
+                if (fSerial) {
+                    BOOST_CHECK_EQUAL(nFound, nFoundSerial);
+                    BOOST_CHECK_EQUAL(nTime, nTimeSerial);
+                    BOOST_CHECK(hash == hashSerial);
+                }
+            }
+            threadGroup.interrupt_all();
+            threadGroup.join_all();
+        }
+    }
+
+    // Nothing is returned once a new tip was announced
+    size_t nFound = 0;
+    unsigned int nTime = 0;
+    uint256 hash;
+    BOOST_CHECK(!SearchStakeKernels(vCandidates, 0x1c7fffff, nTimeTx, 45, 0, nStakeTipUpdates - 1, nFound, nTime, hash));
+
+    chainActive.SetTip(pindexTipOrig);
+    stakeModifierIndex.Sync();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,195 @@
+// Copyright (c) 2017-2018 The NanuCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "stratum.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "streams.h"
+#include "utilstrencodings.h"
+
+#include <boost/test/unit_test.hpp>
+
+using namespace json_spirit;
+
+BOOST_AUTO_TEST_SUITE(stratum_tests)
+
+static CBlock StratumTestBlock(unsigned int nTx)
+{
+    CBlock block;
+    block.nVersion = 1;
+    block.hashPrevBlock = uint256("000000000000000000000000000000000000000000000000000000000a0b0c0d");
+    block.nTime = 1454124731;
+    block.nBits = 0x1e0ffff0;
+    for (unsigned int i = 0; i < nTx; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        if (i > 0)
+            tx.vin[0].prevout = COutPoint(uint256(i), 0);
+        else
+            tx.vin[0].prevout.SetNull();
+        tx.vout.resize(1);
+        tx.vout[0].nValue = i + 1;
+        block.vtx.push_back(tx);
+    }
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(stratum_job_split)
+{
+    const unsigned int nBranchSize[] = {0, 0, 1, 2, 2, 3};
+    for (unsigned int nTx = 1; nTx <= 5; nTx++) {
+        CStratumJob job;
+        BOOST_CHECK(job.Init("1", StratumTestBlock(nTx), 1234));
+        BOOST_CHECK_EQUAL(job.vMerkleBranch.size(), nBranchSize[nTx]);
+
+        // What a miner concatenates must be exactly the coinbase we rebuild
+        std::vector<unsigned char> vchExtraNonce = ParseHex("0000002adeadbeef");
+        std::vector<unsigned char> vchCoinbase(job.vchCoinbase1);
+        vchCoinbase.insert(vchCoinbase.end(), vchExtraNonce.begin(), vchExtraNonce.end());
+        vchCoinbase.insert(vchCoinbase.end(), job.vchCoinbase2.begin(), job.vchCoinbase2.end());
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << job.GetCoinbase(vchExtraNonce);
+        BOOST_CHECK(std::vector<unsigned char>(ss.begin(), ss.end()) == vchCoinbase);
+
+        // The merkle branch must lead to the root of the full block
+        CBlockHeader header = job.GetHeader(vchExtraNonce, 1454124800, 7);
+        CBlock block(job.block);
+        block.vtx[0] = job.GetCoinbase(vchExtraNonce);
+        BOOST_CHECK(header.hashMerkleRoot == block.BuildMerkleTree());
+        BOOST_CHECK_EQUAL(header.nTime, 1454124800U);
+        BOOST_CHECK_EQUAL(header.nNonce, 7U);
+        BOOST_CHECK(header.hashPrevBlock == block.hashPrevBlock);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stratum_notify_params)
+{
+    CStratumJob job;
+    BOOST_CHECK(job.Init("1f", StratumTestBlock(2), 1234));
+    Array params = job.GetNotifyParams(true);
+    BOOST_CHECK_EQUAL(params.size(), 9U);
+    BOOST_CHECK_EQUAL(params[0].get_str(), "1f");
+    // Each 32-bit word of the previous hash is byte-swapped
+    BOOST_CHECK_EQUAL(params[1].get_str().substr(0, 8), "0a0b0c0d");
+    BOOST_CHECK_EQUAL(params[4].get_array().size(), 1U);
+    BOOST_CHECK_EQUAL(params[5].get_str(), "00000001");
+    BOOST_CHECK_EQUAL(params[6].get_str(), "1e0ffff0");
+    BOOST_CHECK_EQUAL(params[8].get_bool(), true);
+}
+
+BOOST_AUTO_TEST_CASE(stratum_idle)
+{
+    // No jobs while syncing, or once the PoW phase is over
+    CBlockIndex index;
+    index.nHeight = Params().LAST_POW_BLOCK() - 1;
+    BOOST_CHECK(IsStratumMiningPossible(&index, false));
+    BOOST_CHECK(!IsStratumMiningPossible(&index, true));
+    index.nHeight = Params().LAST_POW_BLOCK();
+    BOOST_CHECK(!IsStratumMiningPossible(&index, false));
+    BOOST_CHECK(!IsStratumMiningPossible(NULL, false));
+}
+
+/** Keeps solved blocks instead of handing them to validation */
+class CTestStratumSession : public CStratumSession
+{
+public:
+    std::vector<CBlock> vBlocks;
+
+    CTestStratumSession(const uint256& hashShareTarget) : CStratumSession(0x2a, hashShareTarget) {}
+
+protected:
+    void SubmitBlock(const CBlock& block) { vBlocks.push_back(block); }
+};
+
+/** Error code of a mining.submit, or 0 if the share was accepted */
+static int StratumSubmit(CStratumSession& session, const std::string& strJob, uint32_t nNonce)
+{
+    Array params;
+    params.push_back("worker");
+    params.push_back(strJob);
+    params.push_back("deadbeef");
+    params.push_back("56ac5f00");
+    params.push_back(strprintf("%08x", nNonce));
+    try {
+        BOOST_CHECK(session.Execute("mining.submit", params).get_bool());
+    } catch (CStratumError& e) {
+        return e.nCode;
+    }
+    return 0;
+}
+
+BOOST_AUTO_TEST_CASE(stratum_submit)
+{
+    // A block target no hash meets, so every share stays a share
+    CBlock blockHard = StratumTestBlock(3);
+    blockHard.nBits = 0x03000001;
+    boost::shared_ptr<CStratumJob> jobHard(new CStratumJob());
+    BOOST_CHECK(jobHard->Init("1", blockHard, 1234));
+    AddStratumJob(jobHard, true);
+
+    CTestStratumSession sessionLow(uint256(0));
+    BOOST_CHECK_EQUAL(StratumSubmit(sessionLow, "1", 1), STRATUM_NOT_SUBSCRIBED);
+    sessionLow.Execute("mining.subscribe", Array());
+    BOOST_CHECK_EQUAL(StratumSubmit(sessionLow, "1", 1), STRATUM_UNAUTHORIZED);
+    sessionLow.Execute("mining.authorize", Array());
+
+    // Low difficulty shares are rejected and not remembered
+    BOOST_CHECK_EQUAL(StratumSubmit(sessionLow, "1", 1), STRATUM_LOW_DIFFICULTY);
+    BOOST_CHECK_EQUAL(StratumSubmit(sessionLow, "1", 1), STRATUM_LOW_DIFFICULTY);
+    BOOST_CHECK(jobHard->setSubmitted.empty());
+    BOOST_CHECK_EQUAL(StratumSubmit(sessionLow, "2", 1), STRATUM_JOB_NOT_FOUND);
+
+    // Any hash meets the share target of this session
+    CTestStratumSession session(~uint256(0));
+    session.Execute("mining.subscribe", Array());
+    session.Execute("mining.authorize", Array());
+    BOOST_CHECK_EQUAL(StratumSubmit(session, "1", 1), 0);
+    BOOST_CHECK_EQUAL(jobHard->setSubmitted.size(), 1U);
+    BOOST_CHECK_EQUAL(StratumSubmit(session, "1", 1), STRATUM_DUPLICATE_SHARE);
+    BOOST_CHECK_EQUAL(StratumSubmit(session, "1", 2), 0);
+    BOOST_CHECK(session.vBlocks.empty());
+
+    // Roughly every other hash meets this block target
+    CBlock blockEasy = StratumTestBlock(3);
+    blockEasy.nBits = 0x207fffff;
+    boost::shared_ptr<CStratumJob> jobEasy(new CStratumJob());
+    BOOST_CHECK(jobEasy->Init("2", blockEasy, 1234));
+    AddStratumJob(jobEasy, false);
+
+    std::vector<unsigned char> vchExtraNonce(session.vchExtraNonce1);
+    std::vector<unsigned char> vchExtraNonce2 = ParseHex("deadbeef");
+    vchExtraNonce.insert(vchExtraNonce.end(), vchExtraNonce2.begin(), vchExtraNonce2.end());
+    uint32_t nNonce = 0;
+    while (jobEasy->GetHeader(vchExtraNonce, 0x56ac5f00, nNonce).GetHash() > uint256().SetCompact(blockEasy.nBits))
+        nNonce++;
+    BOOST_CHECK_EQUAL(StratumSubmit(session, "2", nNonce), 0);
+    BOOST_REQUIRE_EQUAL(session.vBlocks.size(), 1U);
+    const CBlock& block = session.vBlocks[0];
+    BOOST_CHECK(block.GetHash() == jobEasy->GetHeader(vchExtraNonce, 0x56ac5f00, nNonce).GetHash());
+    BOOST_CHECK(block.hashMerkleRoot == CBlock(block).BuildMerkleTree());
+    BOOST_CHECK_EQUAL(block.nNonce, nNonce);
+
+    // A job full of shares turns further shares away, but not blocks
+    for (uint64_t n = 0; jobEasy->setSubmitted.size() < MAX_STRATUM_JOB_SHARES; n++)
+        jobEasy->setSubmitted.insert(uint256(n));
+    uint32_t nNonceShare = nNonce + 1;
+    while (jobEasy->GetHeader(vchExtraNonce, 0x56ac5f00, nNonceShare).GetHash() <= uint256().SetCompact(blockEasy.nBits))
+        nNonceShare++;
+    BOOST_CHECK_EQUAL(StratumSubmit(session, "2", nNonceShare), STRATUM_OTHER);
+    BOOST_CHECK_EQUAL(jobEasy->setSubmitted.size(), MAX_STRATUM_JOB_SHARES);
+    nNonce++;
+    while (jobEasy->GetHeader(vchExtraNonce, 0x56ac5f00, nNonce).GetHash() > uint256().SetCompact(blockEasy.nBits))
+        nNonce++;
+    BOOST_CHECK_EQUAL(StratumSubmit(session, "2", nNonce), 0);
+    BOOST_CHECK_EQUAL(session.vBlocks.size(), 2U);
+
+    // The older job of the same tip is still accepted
+    BOOST_CHECK_EQUAL(StratumSubmit(session, "1", 3), 0);
+    AddStratumJob(jobEasy, true);
+    BOOST_CHECK_EQUAL(StratumSubmit(session, "1", 4), STRATUM_JOB_NOT_FOUND);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -5,16 +5,110 @@
 
 #include "txdb.h"
 
+#include "crypto/common.h"
 #include "main.h"
 #include "pow.h"
+#include "ui_interface.h"
 #include "uint256.h"
 
 #include <stdint.h>
+#include <string.h>
 
 #include <boost/thread.hpp>
 
 using namespace std;
 
+/**
+ * Key of a record in the per-output layout: 'u' and the txid for the
+ * transaction header, followed by the big-endian output index for an output.
+ * A transaction's outputs thus sort right after its header, in order.
+ */
+class CCoinsOutputKey
+{
+public:
+    uint256 txid;
+    bool fHeader;
+    uint32_t n;
+
+    CCoinsOutputKey(const uint256& txidIn) : txid(txidIn), fHeader(true), n(0) {}
+    CCoinsOutputKey(const uint256& txidIn, uint32_t nIn) : txid(txidIn), fHeader(false), n(nIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return fHeader ? 33 : 37;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ::Serialize(s, 'u', nType, nVersion);
+        ::Serialize(s, txid, nType, nVersion);
+        if (!fHeader) {
+            unsigned char pch[4];
+            WriteBE32(pch, n);
+            s.write((const char*)pch, 4);
+        }
+    }
+};
+
+/** The transaction-wide fields of a CCoins, stored as the header record of the per-output layout */
+class CCoinsHeader
+{
+private:
+    CCoins& coins;
+
+public:
+    CCoinsHeader(CCoins& coinsIn) : coins(coinsIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(VARINT(coins.nVersion));
+        unsigned int nCode = (coins.fCoinBase ? 1 : 0) | (coins.fCoinStake ? 2 : 0);
+        READWRITE(VARINT(nCode));
+        coins.fCoinBase = (nCode & 1) != 0;
+        coins.fCoinStake = (nCode & 2) != 0;
+        READWRITE(VARINT(coins.nHeight));
+    }
+};
+
+/**
+ * Read the per-output records of txid into coins, leaving pcursor on the
+ * first record past them. Returns false if the transaction has no header.
+ */
+static bool ReadCoinsPerOutput(leveldb::Iterator* pcursor, const uint256& txid, CCoins& coins)
+{
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << CCoinsOutputKey(txid);
+    leveldb::Slice slHeader(&ssKeySet[0], ssKeySet.size());
+    pcursor->Seek(slHeader);
+    coins.Clear();
+    if (!pcursor->Valid() || pcursor->key() != slHeader) {
+        if (!pcursor->status().ok())
+            HandleError(pcursor->status());
+        return false;
+    }
+    leveldb::Slice slValue = pcursor->value();
+    CDataStream ssHeader(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+    ssHeader >> REF(CCoinsHeader(coins));
+    for (pcursor->Next(); pcursor->Valid(); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        if (slKey.size() != slHeader.size() + 4 || memcmp(slKey.data(), slHeader.data(), slHeader.size()) != 0)
+            break;
+        uint32_t n = ReadBE32((const unsigned char*)slKey.data() + slHeader.size());
+        if (n >= coins.vout.size())
+            coins.vout.resize(n + 1);
+        slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> REF(CTxOutCompressor(coins.vout[n]));
+    }
+    if (!pcursor->status().ok())
+        HandleError(pcursor->status());
+    return true;
+}
+
 void static BatchWriteCoins(CLevelDBBatch& batch, const uint256& hash, const CCoins& coins)
 {
     if (coins.IsPruned())
@@ -23,22 +117,72 @@ void static BatchWriteCoins(CLevelDBBatch& batch, const uint256& hash, const CCo
         batch.Write(make_pair('c', hash), coins);
 }
 
+/**
+ * Queue the per-output records that make the database match a dirty cache
+ * entry. A fresh entry has no records yet; otherwise only the outputs whose
+ * state differs from the parent bitmask of the entry are written or erased,
+ * so nothing has to be read back first.
+ */
+void static BatchWriteCoinsPerOutput(CLevelDBBatch& batch, const uint256& hash, const CCoinsCacheEntry& entry)
+{
+    const CCoins& coins = entry.coins;
+    bool fFresh = (entry.flags & CCoinsCacheEntry::FRESH) != 0;
+    bool fReplaced = (entry.flags & CCoinsCacheEntry::REPLACED) != 0;
+    bool fPruned = coins.IsPruned();
+    assert(fFresh || !entry.vParentUnspent.empty());
+    if (fPruned) {
+        if (!fFresh)
+            batch.Erase(CCoinsOutputKey(hash));
+    } else if (fFresh || fReplaced) {
+        batch.Write(CCoinsOutputKey(hash), CCoinsHeader(REF(coins)));
+    }
+    size_t nOutputs = std::max(coins.vout.size(), entry.vParentUnspent.size() * 8);
+    for (unsigned int n = 0; n < nOutputs; n++) {
+        bool fHave = !fPruned && n < coins.vout.size() && !coins.vout[n].IsNull();
+        bool fHad = entry.IsParentUnspent(n);
+        if (fHave && (!fHad || fReplaced))
+            batch.Write(CCoinsOutputKey(hash, n), CTxOutCompressor(REF(coins.vout[n])));
+        else if (!fHave && fHad)
+            batch.Erase(CCoinsOutputKey(hash, n));
+    }
+}
+
 void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
 {
     batch.Write('B', hash);
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe), nWriteCount(0)
 {
+    char ch;
+    fPerOutput = db.Read('L', ch) ? ch == '1' : DEFAULT_UTXO_PER_OUTPUT;
 }
 
 bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins) const
 {
+    if (fPerOutput) {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewLookupIterator());
+        return ReadCoinsPerOutput(pcursor.get(), txid, coins);
+    }
     return db.Read(make_pair('c', txid), coins);
 }
 
+void CCoinsViewDB::GetCoins(const std::vector<uint256>& vTxid, size_t nBegin, size_t nEnd, std::vector<std::pair<uint256, CCoins> >& vFound) const
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(fPerOutput ? const_cast<CLevelDBWrapper*>(&db)->NewLookupIterator() : NULL);
+    for (size_t i = nBegin; i < nEnd; i++) {
+        CCoins coins;
+        if (fPerOutput ? ReadCoinsPerOutput(pcursor.get(), vTxid[i], coins) : db.Read(make_pair('c', vTxid[i]), coins)) {
+            vFound.push_back(make_pair(vTxid[i], CCoins()));
+            vFound.back().second.swap(coins);
+        }
+    }
+}
+
 bool CCoinsViewDB::HaveCoins(const uint256& txid) const
 {
+    if (fPerOutput)
+        return db.Exists(CCoinsOutputKey(txid));
     return db.Exists(make_pair('c', txid));
 }
 
@@ -57,7 +201,10 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
+            if (fPerOutput)
+                BatchWriteCoinsPerOutput(batch, it->first, it->second);
+            else
+                BatchWriteCoins(batch, it->first, it->second.coins);
             changed++;
         }
         count++;
@@ -68,7 +215,120 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
         BatchWriteHashBestChain(batch, hashBlock);
 
     LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+    bool ret = db.WriteBatch(batch);
+    nWriteCount++;
+    return ret;
+}
+
+bool CCoinsViewDB::SetPerOutput(bool fPerOutputIn)
+{
+    fPerOutput = fPerOutputIn;
+    if (!db.Write('L', fPerOutput ? '1' : '0'))
+        return false;
+
+    // Records left in the other layout are converted; this also finishes a
+    // conversion that was interrupted, as every batch moves whole transactions
+    char chFrom = fPerOutput ? 'c' : 'u';
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << chFrom;
+    pcursor->Seek(ssKeySet.str());
+    if (!pcursor->Valid() || pcursor->key()[0] != chFrom)
+        return true;
+
+    LogPrintf("Converting the chainstate database to one record per %s...\n", fPerOutput ? "output" : "transaction");
+    uiInterface.InitMessage(_("Converting chainstate database..."));
+    int64_t nStart = GetTimeMillis();
+    CLevelDBBatch batch;
+    unsigned int nRecords = 0;
+    uint64_t nTransactions = 0;
+    while (pcursor->Valid() && pcursor->key()[0] == chFrom) {
+        boost::this_thread::interruption_point();
+        uint256 txid;
+        CCoinsCacheEntry entry;
+        CCoins& coins = entry.coins;
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            ssKey >> txid;
+            if (fPerOutput) {
+                leveldb::Slice slValue = pcursor->value();
+                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+                ssValue >> coins;
+                batch.Erase(make_pair('c', txid));
+                entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+                BatchWriteCoinsPerOutput(batch, txid, entry);
+                pcursor->Next();
+            } else {
+                // Walks the cursor past the transaction's outputs
+                if (!ReadCoinsPerOutput(pcursor.get(), txid, coins))
+                    return error("%s : output records without a header for %s", __func__, txid.ToString());
+                batch.Erase(CCoinsOutputKey(txid));
+                for (unsigned int n = 0; n < coins.vout.size(); n++) {
+                    if (!coins.vout[n].IsNull())
+                        batch.Erase(CCoinsOutputKey(txid, n));
+                }
+                coins.Cleanup();
+                BatchWriteCoins(batch, txid, coins);
+            }
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+        nRecords += 2 + coins.vout.size();
+        nTransactions++;
+        if (nRecords >= 100000) {
+            if (!db.WriteBatch(batch))
+                return false;
+            batch = CLevelDBBatch();
+            nRecords = 0;
+            LogPrint("coindb", "Converted %u transactions\n", nTransactions);
+        }
+    }
+    if (!db.WriteBatch(batch, true))
+        return false;
+    LogPrintf("Converted %u transactions in %dms\n", nTransactions, GetTimeMillis() - nStart);
+    return true;
+}
+
+CCoinsViewDBCursor* CCoinsViewDB::Cursor() const
+{
+    CCoinsViewDBCursor* pcursor = new CCoinsViewDBCursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator(), fPerOutput ? 'u' : 'c');
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << pcursor->chType;
+    pcursor->pcursor->Seek(ssKeySet.str());
+    return pcursor;
+}
+
+CCoinsViewDBCursor::CCoinsViewDBCursor(leveldb::Iterator* pcursorIn, char chTypeIn) : pcursor(pcursorIn), chType(chTypeIn)
+{
+}
+
+bool CCoinsViewDBCursor::Next(uint256& txid, CCoins& coins)
+{
+    if (!pcursor->Valid() || pcursor->key()[0] != chType) {
+        if (!pcursor->status().ok())
+            HandleError(pcursor->status());
+        return false;
+    }
+    leveldb::Slice slKey = pcursor->key();
+    CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+    char chKeyType;
+    ssKey >> chKeyType;
+    ssKey >> txid;
+    if (chType == 'u') {
+        // Walks the cursor past the transaction's outputs
+        if (!ReadCoinsPerOutput(pcursor.get(), txid, coins))
+            throw std::runtime_error("output records without a header for " + txid.ToString());
+        coins.Cleanup();
+    } else {
+        leveldb::Slice slValue = pcursor->value();
+        CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> coins;
+        pcursor->Next();
+    }
+    return true;
 }
 
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
@@ -80,6 +340,14 @@ bool CBlockTreeDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
     return Write(make_pair('b', blockindex.GetBlockHash()), blockindex);
 }
 
+bool CBlockTreeDB::WriteBlockIndex(const std::vector<CBlockIndex*>& vIndex)
+{
+    CLevelDBBatch batch;
+    BOOST_FOREACH (CBlockIndex* pindex, vIndex)
+        batch.Write(make_pair('b', pindex->GetBlockHash()), CDiskBlockIndex(pindex));
+    return WriteBatch(batch);
+}
+
 bool CBlockTreeDB::WriteBlockFileInfo(int nFile, const CBlockFileInfo& info)
 {
     return Write(make_pair('f', nFile), info);
@@ -126,6 +394,7 @@ bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
+    bool fInTx = false;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
@@ -156,12 +425,41 @@ bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
                 }
                 stats.nSerializedSize += 32 + slValue.size();
                 ss << VARINT(0);
+            } else if (chType == 'u') {
+                // Hashed the same way as the per-transaction records above
+                leveldb::Slice slValue = pcursor->value();
+                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+                uint256 txhash;
+                ssKey >> txhash;
+                if (ssKey.empty()) {
+                    if (fInTx)
+                        ss << VARINT(0);
+                    CCoins coins;
+                    ssValue >> REF(CCoinsHeader(coins));
+                    ss << txhash;
+                    ss << VARINT(coins.nVersion);
+                    ss << (coins.fCoinBase ? 'c' : 'n');
+                    ss << VARINT(coins.nHeight);
+                    stats.nTransactions++;
+                    fInTx = true;
+                } else {
+                    uint32_t n = ReadBE32((const unsigned char*)slKey.data() + 33);
+                    CTxOut out;
+                    ssValue >> REF(CTxOutCompressor(out));
+                    stats.nTransactionOutputs++;
+                    ss << VARINT(n + 1);
+                    ss << out;
+                    nTotalAmount += out.nValue;
+                }
+                stats.nSerializedSize += slKey.size() - 1 + slValue.size();
             }
             pcursor->Next();
         } catch (std::exception& e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
     }
+    if (fInTx)
+        ss << VARINT(0);
     stats.nHeight = mapBlockIndex.find(GetBestBlock())->second->nHeight;
     stats.hashSerialized = ss.GetHash();
     stats.nTotalAmount = nTotalAmount;
@@ -195,6 +493,16 @@ bool CBlockTreeDB::ReadFlag(const std::string& name, bool& fValue)
     return true;
 }
 
+bool CBlockTreeDB::WriteSnapshotBase(const uint256& hash)
+{
+    return Write('S', hash);
+}
+
+bool CBlockTreeDB::ReadSnapshotBase(uint256& hash)
+{
+    return Read('S', hash);
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
@@ -212,13 +520,20 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
             char chType;
             ssKey >> chType;
             if (chType == 'b') {
+                // The record key already holds the block hash, so there is no
+                // need to rebuild the header and run XEVAN here. Consistency of
+                // key, header and proof-of-work is checked in the background by
+                // StartBlockIndexVerification().
+                uint256 hash;
+                ssKey >> hash;
                 leveldb::Slice slValue = pcursor->value();
                 CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
                 CDiskBlockIndex diskindex;
                 ssValue >> diskindex;
+                diskindex.hashBlock = hash;
 
                 // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
+                CBlockIndex* pindexNew = InsertBlockIndex(hash);
                 pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
                 pindexNew->pnext = InsertBlockIndex(diskindex.hashNext);
                 pindexNew->nHeight = diskindex.nHeight;
@@ -242,16 +557,6 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 pindexNew->nStakeTime = diskindex.nStakeTime;
                 pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
 
-                //if (pindexNew->nHeight <= Params().LAST_POW_BLOCK()) {
-                if (pindexNew->IsProofOfWork()) {
-                    if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits))
-                        return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
-                }
-                
-                // ppcoin: build setStakeSeen
-                if (pindexNew->IsProofOfStake())
-                    setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
-
                 pcursor->Next();
             } else {
                 break; // if shutdown requested or finished loading block index
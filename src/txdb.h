@@ -14,7 +14,11 @@
 #include <utility>
 #include <vector>
 
+#include <boost/atomic.hpp>
+#include <boost/scoped_ptr.hpp>
+
 class CCoins;
+class CCoinsViewDBCursor;
 class uint256;
 
 //! -dbcache default (MiB)
@@ -23,21 +27,75 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -utxoperoutput default for a new chainstate
+static const bool DEFAULT_UTXO_PER_OUTPUT = false;
 
-/** CCoinsView backed by the LevelDB coin database (chainstate/) */
+/**
+ * CCoinsView backed by the LevelDB coin database (chainstate/).
+ *
+ * Coins are stored either as one record per transaction ('c') or, in the
+ * per-output layout, as a header record per transaction plus one record per
+ * unspent output ('u'). In the latter, spending an output deletes just that
+ * output's record instead of rewriting the rest of the transaction; which
+ * records to touch follows from the cache entry, without reading them back.
+ * Lookups still load every output of a transaction, as the coins caches hold
+ * whole-transaction CCoins.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CLevelDBWrapper db;
+    //! Committed BatchWrite calls, see GetWriteCount()
+    boost::atomic<uint64_t> nWriteCount;
+    //! Whether the per-output layout is in use
+    bool fPerOutput;
 
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
     bool GetCoins(const uint256& txid, CCoins& coins) const;
+    /**
+     * Look up vTxid[nBegin..nEnd) and append the ones found to vFound. The
+     * per-output layout reads them all through one iterator.
+     */
+    void GetCoins(const std::vector<uint256>& vTxid, size_t nBegin, size_t nEnd, std::vector<std::pair<uint256, CCoins> >& vFound) const;
     bool HaveCoins(const uint256& txid) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
     bool GetStats(CCoinsStats& stats) const;
+
+    /**
+     * Number of batches written so far. It is bumped after the write, so coins
+     * read from another thread after seeing a count are at least that recent.
+     */
+    uint64_t GetWriteCount() const { return nWriteCount; }
+
+    bool IsPerOutput() const { return fPerOutput; }
+
+    /**
+     * Switch to the per-output or the per-transaction layout, converting the
+     * records stored in the other one. Must be called before the view is used.
+     */
+    bool SetPerOutput(bool fPerOutputIn);
+
+    //! Cursor over all coins, as of the time it is created. The caller owns it.
+    CCoinsViewDBCursor* Cursor() const;
+};
+
+/** Iterates over the transactions with unspent outputs of a CCoinsViewDB, in txid order */
+class CCoinsViewDBCursor
+{
+private:
+    boost::scoped_ptr<leveldb::Iterator> pcursor;
+    //! Record type of the layout in use
+    char chType;
+
+    CCoinsViewDBCursor(leveldb::Iterator* pcursorIn, char chTypeIn);
+    friend class CCoinsViewDB;
+
+public:
+    /** Read the next transaction's coins, or return false at the end. Throws on corrupt records. */
+    bool Next(uint256& txid, CCoins& coins);
 };
 
 /** Access to the block database (blocks/index/) */
@@ -52,6 +110,7 @@ private:
 
 public:
     bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
+    bool WriteBlockIndex(const std::vector<CBlockIndex*>& vIndex);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo& fileinfo);
     bool WriteBlockFileInfo(int nFile, const CBlockFileInfo& fileinfo);
     bool ReadLastBlockFile(int& nFile);
@@ -62,6 +121,8 @@ public:
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >& list);
     bool WriteFlag(const std::string& name, bool fValue);
     bool ReadFlag(const std::string& name, bool& fValue);
+    bool WriteSnapshotBase(const uint256& hash);
+    bool ReadSnapshotBase(uint256& hash);
     bool LoadBlockIndexGuts();
 };
 
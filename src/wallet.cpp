@@ -12,6 +12,7 @@
 #include "coincontrol.h"
 #include "kernel.h"
 #include "masternode-budget.h"
+#include "miner.h"
 #include "net.h"
 #include "script/script.h"
 #include "script/sign.h"
@@ -388,6 +389,8 @@ bool CWallet::IsSpent(const uint256& hash, unsigned int n) const {
 
 void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid) {
     mapTxSpends.insert(make_pair(outpoint, wtxid));
+    if (fStakeCoinsLoaded && IsSpent(outpoint.hash, outpoint.n))
+        mapStakeCoins.erase(outpoint);
 
     pair<TxSpends::iterator, TxSpends::iterator> range;
     range = mapTxSpends.equal_range(outpoint);
@@ -404,6 +407,30 @@ void CWallet::AddToSpends(const uint256& wtxid) {
     AddToSpends(txin.prevout, wtxid);
 }
 
+void CWallet::UpdateStakeCoins(const CWalletTx& wtx) {
+    AssertLockHeld(cs_wallet);
+    if (!fStakeCoinsLoaded)
+        return; // built in one pass on first use
+    AssertLockHeld(cs_main); // IsSpent
+
+    const uint256& hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        const COutPoint outpoint(hash, i);
+        if (wtx.hashBlock == 0 || wtx.vout[i].nValue <= 0 || IsSpent(hash, i) || !(IsMine(wtx.vout[i]) & ISMINE_SPENDABLE)) {
+            mapStakeCoins.erase(outpoint);
+            continue;
+        }
+
+        CStakeCoin& coin = mapStakeCoins[outpoint];
+        if (coin.hashBlock != wtx.hashBlock)
+            coin.pindexFrom = NULL;
+        coin.hashBlock = wtx.hashBlock;
+        coin.nValue = wtx.vout[i].nValue;
+        coin.nTxTime = wtx.GetTxTime();
+        coin.fCoinBaseMaturity = wtx.IsCoinBase() || wtx.IsCoinStake();
+    }
+}
+
 bool CWallet::GetMasternodeVinAndKeys(CTxIn& txinRet, CPubKey& pubKeyRet, CKey& keyRet, std::string strTxHash, std::string strOutputIndex) {
     // wait for reindex and/or import to finish
     if (fImporting || fReindex) return false;
@@ -682,6 +709,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet) {
             if (!wtx.WriteToDisk())
                 return false;
 
+        UpdateStakeCoins(wtx);
+
         // Break debit/credit balance caches:
         wtx.MarkDirty();
 
@@ -727,11 +756,13 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock) {
 
     // If a transaction changes 'conflicted' state, that changes the balance
     // available of the outputs it spends. So force those to be
-    // recomputed, also:
+    // recomputed, also. The same goes for whether they can still stake:
 
     BOOST_FOREACH(const CTxIn& txin, tx.vin) {
-        if (mapWallet.count(txin.prevout.hash))
+        if (mapWallet.count(txin.prevout.hash)) {
             mapWallet[txin.prevout.hash].MarkDirty();
+            UpdateStakeCoins(mapWallet[txin.prevout.hash]);
+        }
     }
 }
 
@@ -742,6 +773,7 @@ void CWallet::EraseFromWallet(const uint256& hash) {
         LOCK(cs_wallet);
         if (mapWallet.erase(hash))
             CWalletDB(strWalletFile).EraseTx(hash);
+        mapStakeCoins.erase(mapStakeCoins.lower_bound(COutPoint(hash, 0)), mapStakeCoins.upper_bound(COutPoint(hash, std::numeric_limits<uint32_t>::max())));
     }
     return;
 }
@@ -1506,27 +1538,62 @@ bool less_then_denom(const COutput& out1, const COutput& out2) {
     return (!found1 && found2);
 }
 
-bool CWallet::SelectStakeCoins(std::set<std::pair<const CWalletTx*, unsigned int> >& setCoins, int64_t nTargetAmount) const {
-    vector<COutput> vCoins;
-    AvailableCoins(vCoins, true);
+void CWallet::LoadStakeCoins() {
+    AssertLockHeld(cs_wallet);
+    if (!fStakeCoinsLoaded) {
+        fStakeCoinsLoaded = true;
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            UpdateStakeCoins(it->second);
+    }
+}
+
+bool CWallet::IsStakeCoinMature(CStakeCoin& coin) {
+    AssertLockHeld(cs_main);
+    //check that it is in the active chain and matured
+    if (!coin.pindexFrom) {
+        BlockMap::iterator mi = mapBlockIndex.find(coin.hashBlock);
+        if (mi == mapBlockIndex.end())
+            return false;
+        coin.pindexFrom = mi->second;
+    }
+    if (!chainActive.Contains(coin.pindexFrom))
+        return false;
+    int nDepth = chainActive.Height() - coin.pindexFrom->nHeight + 1;
+    return nDepth >= (coin.fCoinBaseMaturity ? Params().COINBASE_MATURITY() + 1 : 10);
+}
+
+bool CWallet::SelectStakeCoins(std::vector<CStakeCandidate>& vCandidates, int64_t nTargetAmount) {
+    LOCK2(cs_main, cs_wallet);
+    LoadStakeCoins();
+
     int64_t nAmountSelected = 0;
+    for (map<COutPoint, CStakeCoin>::iterator it = mapStakeCoins.begin(); it != mapStakeCoins.end(); ++it) {
+        CStakeCoin& coin = it->second;
 
-    BOOST_FOREACH(const COutput& out, vCoins) {
         //make sure not to outrun target amount
-        if (nAmountSelected + out.tx->vout[out.i].nValue > nTargetAmount)
+        if (nAmountSelected + coin.nValue > nTargetAmount)
             continue;
 
         //check for min age
-        if (GetTime() - out.tx->GetTxTime() < nStakeMinAge)
+        if (GetTime() - coin.nTxTime < nStakeMinAge)
+            continue;
+
+        if (IsLockedCoin(it->first.hash, it->first.n))
             continue;
 
-        //check that it is matured
-        if (out.nDepth < (out.tx->IsCoinStake() ? Params().COINBASE_MATURITY() : 10))
+        if (!IsStakeCoinMature(coin))
+            continue;
+
+        //the search threads do not take cs_main, so the stake modifier is looked up here
+        uint64_t nStakeModifier = 0;
+        int nStakeModifierHeight = 0;
+        int64_t nStakeModifierTime = 0;
+        if (!GetKernelStakeModifier(coin.pindexFrom, nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false))
             continue;
 
         //add to our stake set
-        setCoins.insert(make_pair(out.tx, out.i));
-        nAmountSelected += out.tx->vout[out.i].nValue;
+        vCandidates.push_back(CStakeCandidate(coin.pindexFrom, nStakeModifier, coin.nValue, it->first));
+        nAmountSelected += coin.nValue;
     }
     return true;
 }
@@ -1538,14 +1605,13 @@ bool CWallet::MintableCoins() {
     if (nBalance <= nReserveBalance)
         return false;
 
-    vector<COutput> vCoins;
-    AvailableCoins(vCoins, true);
-
-    BOOST_FOREACH(const COutput& out, vCoins) {
-        if (GetTime() - out.tx->GetTxTime() > nStakeMinAge)
+    LOCK2(cs_main, cs_wallet);
+    LoadStakeCoins();
+    for (map<COutPoint, CStakeCoin>::iterator it = mapStakeCoins.begin(); it != mapStakeCoins.end(); ++it) {
+        if (GetTime() - it->second.nTxTime >= nStakeMinAge && !IsLockedCoin(it->first.hash, it->first.n) &&
+            IsStakeCoinMature(it->second))
             return true;
     }
-
     return false;
 }
 
@@ -2259,6 +2325,8 @@ vector<const CWalletTx*> vwtxPrevFix;
 CMutableTransaction txNewFix;
 
 bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, CMutableTransaction& txNew, unsigned int& nTxNewTime) {
+    int64_t nStartMicros = GetTimeMicros();
+
     // The following split & combine thresholds are important to security
     // Should not be adjusted if you don't understand the consequences
     //int64_t nCombineThreshold = 0;
@@ -2280,19 +2348,20 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     if (nBalance <= nReserveBalance)
         return false;
 
-    // presstab HyperStake - Initialize as static and don't update the set on every run of CreateCoinStake() in order to lighten resource use
-    static std::set<pair<const CWalletTx*, unsigned int> > setStakeCoins;
-    static int nLastStakeSetUpdate = 0;
-
-    if (GetTime() - nLastStakeSetUpdate > nStakeSetUpdateTime) {
-        setStakeCoins.clear();
-        if (!SelectStakeCoins(setStakeCoins, nBalance - nReserveBalance))
+    // The stake set is kept up to date by the wallet, so it is cheap to select on every run.
+    // The tip is read with it, so a search on stake modifiers of an old tip is called off.
+    std::vector<CStakeCandidate> vCandidates;
+    const CBlockIndex* pindexPrev = NULL;
+    unsigned int nTipUpdates = 0;
+    {
+        LOCK(cs_main);
+        pindexPrev = chainActive.Tip();
+        nTipUpdates = nStakeTipUpdates;
+        if (!SelectStakeCoins(vCandidates, nBalance - nReserveBalance))
             return false;
-
-        nLastStakeSetUpdate = GetTime();
     }
 
-    if (setStakeCoins.empty())
+    if (vCandidates.empty())
         return false;
 
     vector<const CWalletTx*> vwtxPrev;
@@ -2300,91 +2369,75 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     int64_t nCredit = 0;
     CScript scriptPubKeyKernel;
 
-    //prevent staking a time that won't be accepted
-    if (GetAdjustedTime() <= chainActive.Tip()->nTime)
-        MilliSleep(10000);
+    //prevent staking a time that won't be accepted; the stake minter waits for the next slot
+    if (GetAdjustedTime() <= pindexPrev->nTime)
+        return false;
 
-    BOOST_FOREACH(PAIRTYPE(const CWalletTx*, unsigned int) pcoin, setStakeCoins) {
-        //make sure that enough time has elapsed between
-        CBlockIndex* pindex = NULL;
-        BlockMap::iterator it = mapBlockIndex.find(pcoin.first->hashBlock);
-        if (it != mapBlockIndex.end())
-            pindex = it->second;
-        else {
-            if (fDebug)
-                LogPrintf("CreateCoinStake() failed to find block index \n");
-            continue;
+    //iterates each utxo inside of CheckStakeKernelHash(), spread over the -stakethreads workers
+    size_t nKernel = 0;
+    uint256 hashProofOfStake = 0;
+    nTxNewTime = GetAdjustedTime();
+    CStakeSearchStats stats;
+    bool fKernelFound = SearchStakeKernels(vCandidates, nBits, nTxNewTime, nHashDrift, pindexPrev->GetMedianTimePast(), nTipUpdates, nKernel, nTxNewTime, hashProofOfStake, &stats);
+    stakingMetrics.AddPass(GetTimeMicros() - nStartMicros, stats.nExamined, stats.nHashes);
+    if (fKernelFound)
+        stakingMetrics.nKernels++;
+
+    mapHashedBlocks.clear();
+    mapHashedBlocks[pindexPrev->nHeight] = GetTime(); //store a time stamp of when we last hashed on this block
+
+    const CWalletTx* pcoin = fKernelFound ? GetWalletTx(vCandidates[nKernel].prevout.hash) : NULL;
+    if (pcoin) {
+        unsigned int nOut = vCandidates[nKernel].prevout.n;
+
+        // Found a kernel
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("CreateCoinStake : kernel found\n");
+
+        vector<valtype> vSolutions;
+        txnouttype whichType;
+        CScript scriptPubKeyOut;
+        scriptPubKeyKernel = pcoin->vout[nOut].scriptPubKey;
+        if (!Solver(scriptPubKeyKernel, whichType, vSolutions)) {
+            LogPrintf("CreateCoinStake : failed to parse kernel\n");
+            return false;
         }
-
-        // Read block header
-        CBlockHeader block = pindex->GetBlockHeader();
-
-        bool fKernelFound = false;
-        uint256 hashProofOfStake = 0;
-        COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-        nTxNewTime = GetAdjustedTime();
-
-        //iterates each utxo inside of CheckStakeKernelHash()
-        if (CheckStakeKernelHash(nBits, block, *pcoin.first, prevoutStake, nTxNewTime, nHashDrift, false, hashProofOfStake, true)) {
-            //Double check that this will pass time requirements
-            if (nTxNewTime <= chainActive.Tip()->GetMedianTimePast()) {
-                LogPrintf("CreateCoinStake() : kernel found, but it is too far in the past \n");
-                continue;
-            }
-
-            // Found a kernel
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("CreateCoinStake : parsed kernel type=%d\n", whichType);
+        if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH) {
             if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : kernel found\n");
-
-            vector<valtype> vSolutions;
-            txnouttype whichType;
-            CScript scriptPubKeyOut;
-            scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
-            if (!Solver(scriptPubKeyKernel, whichType, vSolutions)) {
-                LogPrintf("CreateCoinStake : failed to parse kernel\n");
-                break;
-            }
-            if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : parsed kernel type=%d\n", whichType);
-            if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH) {
+                LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
+            return false; // only support pay to public key and pay to address
+        }
+        if (whichType == TX_PUBKEYHASH) // pay to address type
+        {
+            //convert to pay to public key type
+            CKey key;
+            if (!keystore.GetKey(uint160(vSolutions[0]), key)) {
                 if (fDebug && GetBoolArg("-printcoinstake", false))
-                    LogPrintf("CreateCoinStake : no support for kernel type=%d\n", whichType);
-                break; // only support pay to public key and pay to address
+                    LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
+                return false; // unable to find corresponding public key
             }
-            if (whichType == TX_PUBKEYHASH) // pay to address type
-            {
-                //convert to pay to public key type
-                CKey key;
-                if (!keystore.GetKey(uint160(vSolutions[0]), key)) {
-                    if (fDebug && GetBoolArg("-printcoinstake", false))
-                        LogPrintf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
-                    break; // unable to find corresponding public key
-                }
 
-                scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
-            } else
-                scriptPubKeyOut = scriptPubKeyKernel;
+            scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
+        } else
+            scriptPubKeyOut = scriptPubKeyKernel;
 
-            txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
-            nCredit += pcoin.first->vout[pcoin.second].nValue;
-            vwtxPrev.push_back(pcoin.first);
-            txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+        txNew.vin.push_back(CTxIn(pcoin->GetHash(), nOut));
+        nCredit += pcoin->vout[nOut].nValue;
+        vwtxPrev.push_back(pcoin);
+        txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
 
-            //presstab HyperStake - calculate the total size of our new output including the stake reward so that we can use it to decide whether to split the stake outputs
-            const CBlockIndex* pIndex0 = chainActive.Tip();
-            uint64_t nTotalSize = pcoin.first->vout[pcoin.second].nValue + GetBlockValue(pIndex0->nHeight);
+        //presstab HyperStake - calculate the total size of our new output including the stake reward so that we can use it to decide whether to split the stake outputs
+        const CBlockIndex* pIndex0 = chainActive.Tip();
+        uint64_t nTotalSize = pcoin->vout[nOut].nValue + GetBlockValue(pIndex0->nHeight);
 
-            //presstab HyperStake - if MultiSend is set to send in coinstake we will add our outputs here (values asigned further down)
-            if (nTotalSize / 2 > nStakeSplitThreshold * COIN)
-                txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
+        //presstab HyperStake - if MultiSend is set to send in coinstake we will add our outputs here (values asigned further down)
+        if (nTotalSize / 2 > nStakeSplitThreshold * COIN)
+            txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
 
-            if (fDebug && GetBoolArg("-printcoinstake", false))
-                LogPrintf("CreateCoinStake : added kernel type=%d\n", whichType);
-            fKernelFound = true;
-            break;
-        }
-        if (fKernelFound)
-            break; // if kernel is found stop searching
+        if (fDebug && GetBoolArg("-printcoinstake", false))
+            LogPrintf("CreateCoinStake : added kernel type=%d\n", whichType);
     }
     if (nCredit == 0 || nCredit > nBalance - nReserveBalance)
         return false;
@@ -2442,7 +2495,6 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     }
 
     // Successfully generated coinstake
-    nLastStakeSetUpdate = 0; //this will trigger stake set to repopulate next round
     return true;
 
     //}
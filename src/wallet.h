@@ -122,6 +122,21 @@ public:
     StringMap destdata;
 };
 
+/** A spendable wallet output confirmed in a block, which can stake once it is deep and old enough */
+class CStakeCoin
+{
+public:
+    uint256 hashBlock;
+    CAmount nValue;
+    int64_t nTxTime;
+    //! Coinbase and coinstake outputs have to reach coinbase maturity
+    bool fCoinBaseMaturity;
+    //! Block holding the output, looked up from hashBlock on first use
+    const CBlockIndex* pindexFrom;
+
+    CStakeCoin() : hashBlock(0), nValue(0), nTxTime(0), fCoinBaseMaturity(false), pindexFrom(NULL) {}
+};
+
 /** 
  * A CWallet is an extension of a keystore, which also maintains a set of transactions and balances,
  * and provides the ability to create new transactions.
@@ -154,9 +169,23 @@ private:
 
     void SyncMetaData(std::pair<TxSpends::iterator, TxSpends::iterator>);
 
+    /**
+     * Unspent outputs that may stake, kept in step with mapWallet by
+     * AddToWallet, AddToSpends and SyncTransaction so staking never scans the
+     * whole wallet. Depth and age are checked when coins are selected, so
+     * coins that mature on a new block are picked up right away.
+     */
+    std::map<COutPoint, CStakeCoin> mapStakeCoins;
+    bool fStakeCoinsLoaded;
+    void UpdateStakeCoins(const CWalletTx& wtx);
+    //! Build mapStakeCoins in one pass on first use
+    void LoadStakeCoins();
+    //! Whether coin's block is in the active chain and deep enough for it to stake
+    bool IsStakeCoinMature(CStakeCoin& coin);
+
 public:
     bool MintableCoins();
-    bool SelectStakeCoins(std::set<std::pair<const CWalletTx*, unsigned int> >& setCoins, int64_t nTargetAmount) const;
+    bool SelectStakeCoins(std::vector<CStakeCandidate>& vCandidates, int64_t nTargetAmount);
     bool SelectCoinsDark(int64_t nValueMin, int64_t nValueMax, std::vector<CTxIn>& setCoinsRet, int64_t& nValueRet, int nObfuscationRoundsMin, int nObfuscationRoundsMax) const;
     bool SelectCoinsByDenominations(int nDenom, int64_t nValueMin, int64_t nValueMax, std::vector<CTxIn>& vCoinsRet, std::vector<COutput>& vCoinsRet2, int64_t& nValueRet, int nObfuscationRoundsMin, int nObfuscationRoundsMax);
     bool SelectCoinsDarkDenominated(int64_t nTargetValue, std::vector<CTxIn>& setCoinsRet, int64_t& nValueRet) const;
@@ -190,7 +219,6 @@ public:
     unsigned int nHashDrift;
     unsigned int nHashInterval;
     uint64_t nStakeSplitThreshold;
-    int nStakeSetUpdateTime;
 
     //MultiSend
     std::vector<std::pair<std::string, int> > vMultiSend;
@@ -236,7 +264,7 @@ public:
         nHashDrift = 45;
         nStakeSplitThreshold = 2000;
         nHashInterval = 22;
-        nStakeSetUpdateTime = 300; // 5 minutes
+        fStakeCoinsLoaded = false;
 
         //MultiSend
         vMultiSend.clear();
@@ -0,0 +1,184 @@
+// Copyright (c) 2018 The NanuCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/nanucoin-config.h"
+#endif
+
+#include "xevan.h"
+
+#ifdef ENABLE_AESNI
+#include "crypto/echo512_aesni.h"
+#endif
+
+#include <assert.h>
+#include <string.h>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/once.hpp>
+
+namespace
+{
+typedef void (*StageInitFn)(void*);
+typedef void (*StageWriteFn)(void*, const void*, size_t);
+typedef void (*StageCloseFn)(void*, void*);
+typedef void (*StageFixedFn)(const unsigned char in[128], unsigned char out[64]);
+
+struct Stage {
+    StageInitFn init;
+    StageWriteFn write;
+    StageCloseFn close;
+    size_t nContextSize;
+    size_t nOutputSize;
+};
+
+/** The 17 primitives in order; XEVAN runs this sequence twice. */
+const Stage stages[] = {
+    {sph_blake512_init, sph_blake512, sph_blake512_close, sizeof(sph_blake512_context), 64},
+    {sph_bmw512_init, sph_bmw512, sph_bmw512_close, sizeof(sph_bmw512_context), 64},
+    {sph_groestl512_init, sph_groestl512, sph_groestl512_close, sizeof(sph_groestl512_context), 64},
+    {sph_skein512_init, sph_skein512, sph_skein512_close, sizeof(sph_skein512_context), 64},
+    {sph_jh512_init, sph_jh512, sph_jh512_close, sizeof(sph_jh512_context), 64},
+    {sph_keccak512_init, sph_keccak512, sph_keccak512_close, sizeof(sph_keccak512_context), 64},
+    {sph_luffa512_init, sph_luffa512, sph_luffa512_close, sizeof(sph_luffa512_context), 64},
+    {sph_cubehash512_init, sph_cubehash512, sph_cubehash512_close, sizeof(sph_cubehash512_context), 64},
+    {sph_shavite512_init, sph_shavite512, sph_shavite512_close, sizeof(sph_shavite512_context), 64},
+    {sph_simd512_init, sph_simd512, sph_simd512_close, sizeof(sph_simd512_context), 64},
+    {sph_echo512_init, sph_echo512, sph_echo512_close, sizeof(sph_echo512_context), 64},
+    {sph_hamsi512_init, sph_hamsi512, sph_hamsi512_close, sizeof(sph_hamsi512_context), 64},
+    {sph_fugue512_init, sph_fugue512, sph_fugue512_close, sizeof(sph_fugue512_context), 64},
+    {sph_shabal512_init, sph_shabal512, sph_shabal512_close, sizeof(sph_shabal512_context), 64},
+    {sph_whirlpool_init, sph_whirlpool, sph_whirlpool_close, sizeof(sph_whirlpool_context), 64},
+    {sph_sha512_init, sph_sha512, sph_sha512_close, sizeof(sph_sha512_context), 64},
+    {sph_haval256_5_init, sph_haval256_5, sph_haval256_5_close, sizeof(sph_haval256_5_context), 32},
+};
+
+static const unsigned int NUM_STAGES = sizeof(stages) / sizeof(stages[0]);
+static const unsigned int STAGE_ECHO = 10;
+
+/** Optional faster implementation of each stage on a 128-byte input; none means the sph code */
+struct FixedStages {
+    StageFixedFn fn[NUM_STAGES];
+};
+
+const FixedStages stagesPortable = {};
+FixedStages stagesDetected = {};
+boost::once_flag onceDetect = BOOST_ONCE_INIT;
+std::string strDetected;
+
+/** Table in use: stagesPortable until XEVANAutoDetect() publishes stagesDetected */
+boost::atomic<const FixedStages*> pstagesFixed(&stagesPortable);
+
+void DetectStages()
+{
+    strDetected = "standard";
+#ifdef ENABLE_AESNI
+    if (Echo512AESNIAvailable()) {
+        stagesDetected.fn[STAGE_ECHO] = Echo512AESNI128;
+        strDetected += " echo(aesni)";
+    }
+#endif
+}
+
+/** Freshly initialized context of every stage, copied instead of calling *_init. */
+struct InitialContexts {
+    CXevanHasher::StageContext ctx[NUM_STAGES];
+
+    InitialContexts()
+    {
+        for (unsigned int s = 0; s < NUM_STAGES; s++)
+            stages[s].init(&ctx[s]);
+    }
+};
+
+const InitialContexts& GetInitialContexts()
+{
+    static const InitialContexts initial;
+    return initial;
+}
+
+inline void StageStart(unsigned int s, CXevanHasher::StageContext& ctx)
+{
+    memcpy(&ctx, &GetInitialContexts().ctx[s], stages[s].nContextSize);
+}
+} // namespace
+
+std::string XEVANAutoDetect()
+{
+    GetInitialContexts();
+
+    // The table is filled once and only then published, so hashers running
+    // meanwhile keep reading a complete one
+    boost::call_once(DetectStages, onceDetect);
+    pstagesFixed.store(&stagesDetected, boost::memory_order_release);
+    return strDetected;
+}
+
+CXevanHasher::CXevanHasher()
+{
+    // Bytes 64..127 of every work block are never written and must stay zero
+    memset(work, 0, sizeof(work));
+}
+
+void CXevanHasher::Finish(uint256 pout[], unsigned int nCount)
+{
+    const FixedStages& fixed = *pstagesFixed.load(boost::memory_order_acquire);
+    unsigned char digest[64];
+    for (unsigned int nStep = 1; nStep < 2 * NUM_STAGES; nStep++) {
+        const unsigned int s = nStep % NUM_STAGES;
+        const Stage& stage = stages[s];
+        for (unsigned int i = 0; i < nCount; i++) {
+            if (fixed.fn[s]) {
+                fixed.fn[s](work[i], digest);
+            } else {
+                StageStart(s, ctx);
+                stage.write(&ctx, work[i], WORK_SIZE);
+                stage.close(&ctx, digest);
+            }
+            memcpy(work[i], digest, stage.nOutputSize);
+            memset(work[i] + stage.nOutputSize, 0, sizeof(digest) - stage.nOutputSize);
+        }
+    }
+
+    for (unsigned int i = 0; i < nCount; i++)
+        memcpy(pout[i].begin(), work[i], 32);
+}
+
+void CXevanHasher::Hash(const unsigned char* const pinput[], const size_t plen[], uint256 pout[], unsigned int nCount)
+{
+    static const unsigned char pblank[1] = {};
+    assert(nCount <= XEVAN_MAX_BATCH);
+    for (unsigned int i = 0; i < nCount; i++) {
+        StageStart(0, ctx);
+        sph_blake512(&ctx.blake, plen[i] ? pinput[i] : pblank, plen[i]);
+        sph_blake512_close(&ctx.blake, work[i]);
+    }
+    Finish(pout, nCount);
+}
+
+template <size_t N>
+void CXevanHasher::HashFixed(const unsigned char* const pinput[], uint256 pout[], unsigned int nCount)
+{
+    assert(nCount <= XEVAN_MAX_BATCH);
+    for (unsigned int i = 0; i < nCount; i++) {
+        StageStart(0, ctx);
+        sph_blake512(&ctx.blake, pinput[i], N);
+        sph_blake512_close(&ctx.blake, work[i]);
+    }
+    Finish(pout, nCount);
+}
+
+template void CXevanHasher::HashFixed<CXevanHasher::HEADER_SIZE>(const unsigned char* const pinput[], uint256 pout[], unsigned int nCount);
+
+uint256 CXevanHasher::HashHeader(const unsigned char header[HEADER_SIZE])
+{
+    uint256 hash;
+    HashFixed<HEADER_SIZE>(&header, &hash, 1);
+    return hash;
+}
+
+void XEVANBatch(const unsigned char* const pinput[], const size_t plen[], uint256 pout[], unsigned int nCount)
+{
+    CXevanHasher().Hash(pinput, plen, pout, nCount);
+}
@@ -0,0 +1,107 @@
+// Copyright (c) 2018 The NanuCoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_XEVAN_H
+#define BITCOIN_XEVAN_H
+
+#include "uint256.h"
+
+#include "crypto/sph_blake.h"
+#include "crypto/sph_bmw.h"
+#include "crypto/sph_cubehash.h"
+#include "crypto/sph_echo.h"
+#include "crypto/sph_fugue.h"
+#include "crypto/sph_groestl.h"
+#include "crypto/sph_hamsi.h"
+#include "crypto/sph_haval.h"
+#include "crypto/sph_jh.h"
+#include "crypto/sph_keccak.h"
+#include "crypto/sph_luffa.h"
+#include "crypto/sph_sha2.h"
+#include "crypto/sph_shabal.h"
+#include "crypto/sph_shavite.h"
+#include "crypto/sph_simd.h"
+#include "crypto/sph_skein.h"
+#include "crypto/sph_whirlpool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/** Maximum number of independent inputs hashed by one XEVANBatch() call */
+static const unsigned int XEVAN_MAX_BATCH = 8;
+
+/**
+ * Select the fastest available implementation of each XEVAN stage for this
+ * CPU. Until this is called only the portable code is used; threads already
+ * hashing switch over between two hashes. Returns a short description for
+ * the log.
+ */
+std::string XEVANAutoDetect();
+
+/**
+ * Reusable XEVAN hasher. Each stage starts from a copy of a pre-initialized
+ * context instead of running its *_init again, and the 33 inner stages hash
+ * their 128-byte input through the generic sph functions unless
+ * XEVANAutoDetect() installed a faster one.
+ */
+class CXevanHasher
+{
+public:
+    /** Serialized size of a CBlockHeader */
+    static const size_t HEADER_SIZE = 80;
+
+    CXevanHasher();
+
+    /** Hash nCount inputs of arbitrary, possibly different, lengths. */
+    void Hash(const unsigned char* const pinput[], const size_t plen[], uint256 pout[], unsigned int nCount);
+
+    /** Hash nCount inputs that are all exactly N bytes long (instantiated for HEADER_SIZE). */
+    template <size_t N>
+    void HashFixed(const unsigned char* const pinput[], uint256 pout[], unsigned int nCount);
+
+    /** Hash a single serialized block header. */
+    uint256 HashHeader(const unsigned char header[HEADER_SIZE]);
+
+    union StageContext {
+        sph_blake512_context blake;
+        sph_bmw512_context bmw;
+        sph_groestl512_context groestl;
+        sph_skein512_context skein;
+        sph_jh512_context jh;
+        sph_keccak512_context keccak;
+        sph_luffa512_context luffa;
+        sph_cubehash512_context cubehash;
+        sph_shavite512_context shavite;
+        sph_simd512_context simd;
+        sph_echo512_context echo;
+        sph_hamsi512_context hamsi;
+        sph_fugue512_context fugue;
+        sph_shabal512_context shabal;
+        sph_whirlpool_context whirlpool;
+        sph_sha512_context sha2;
+        sph_haval256_5_context haval;
+    };
+
+private:
+    /** Input block of every stage after the first: previous digest, zero padded */
+    static const size_t WORK_SIZE = 128;
+
+    StageContext ctx;
+    unsigned char work[XEVAN_MAX_BATCH][WORK_SIZE];
+
+    /** Run stages 1..33 on the work blocks of the first nCount inputs. */
+    void Finish(uint256 pout[], unsigned int nCount);
+};
+
+/**
+ * Hash nCount (at most XEVAN_MAX_BATCH) independent inputs. Each input is
+ * still hashed by scalar code; the batch only runs the 34 stages one at a
+ * time across all inputs, so each primitive's tables stay hot in cache while
+ * it is applied to every input. pout[i] equals
+ * XEVAN(pinput[i], pinput[i] + plen[i]).
+ */
+void XEVANBatch(const unsigned char* const pinput[], const size_t plen[], uint256 pout[], unsigned int nCount);
+
+#endif // BITCOIN_XEVAN_H
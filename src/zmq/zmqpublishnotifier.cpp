@@ -178,21 +178,24 @@ bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
     LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
 // XX42    const Consensus::Params& consensusParams = Params().GetConsensus();
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    CCachedBlockRef pcached;
+    std::vector<char> vRaw;
     {
         LOCK(cs_main);
-        CBlock block;
 // XX42        if(!ReadBlockFromDisk(block, pindex, consensusParams))
-        if(!ReadBlockFromDisk(block, pindex))
+        // A miss is read from disk without filling the block cache, which
+        // ConnectTip keeps free of blocks during initial sync and reindex
+        pcached = blockcache.Get(pindex->GetBlockHash());
+        if(!pcached && !ReadRawBlockFromDisk(vRaw, pindex))
         {
             zmqError("Can't read block from disk");
             return false;
         }
-
-        ss << block;
     }
 
-    return SendMessage(MSG_RAWBLOCK, &(*ss.begin()), ss.size());
+    // The cached serialization is exactly the raw block
+    const std::vector<char>& vData = pcached ? pcached->vRaw : vRaw;
+    return SendMessage(MSG_RAWBLOCK, &vData[0], vData.size());
 }
 
 bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &transaction)